@@ -21,14 +21,46 @@
 #include <vector>
 #include <list>
 #include <map>
+#include <set>
+#include <memory>
+#include <unordered_map>
 #include <algorithm>
+#include <iterator>
+#include <functional>
 #include <cstring>
 #include <climits>
 #include <exception>
+#include <stdexcept>
+#include <tuple>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+#include <typeinfo>
+#include <cstdio>
+#include <cctype>
+#include <sstream>
+#include <future>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 struct abstract_field;
 struct table;
 struct dbcontext;
+struct abstract_persistent;
+
+template <typename E>
+struct plan;
 
 struct abstract_dbset
 {
@@ -39,9 +71,30 @@ struct abstract_dbset
 	/* Check if object exists in set */
 	virtual bool exists(table* obj) = 0;
 	
+	/* Changes are complete, publish them */
+	virtual void finish() = 0;
+	
+	/* Remember changes from now on, so they can be undone */
+	virtual void record() = 0;
+	
+	/* Undo remembered changes */
+	virtual void undo() = 0;
+	
+	/* Keep remembered changes */
+	virtual void forget() = 0;
+	
 	dbcontext* parent_;
 };
 
+/* Publishes changes of set when they are complete, or fail half way */
+struct finish_guard
+{
+	explicit finish_guard(abstract_dbset* set): set_(set) {}
+	~finish_guard() { set_->finish(); }
+	
+	abstract_dbset* set_;
+};
+
 /* Constraints implementation */
 struct abstract_constraint
 {
@@ -51,6 +104,12 @@ struct abstract_constraint
 	virtual void operator()(abstract_field*, table*, abstract_dbset*) = 0;
 };
 
+/* Thrown when row does not satisfy constraint, row is not changed */
+struct constraint_violation: std::runtime_error
+{
+	constraint_violation(const std::string& what): std::runtime_error(what) {}
+};
+
 struct constraint_expr: std::list<abstract_constraint*>, abstract_constraint
 {
 	constraint_expr() {}
@@ -88,6 +147,72 @@ struct constraint_expr: std::list<abstract_constraint*>, abstract_constraint
 	}
 };
 
+struct table_schema;
+
+/* Fields of table, told apart by offset of member */
+typedef std::vector<std::ptrdiff_t> field_ids;
+
+/* Fields assigned by statement, see query_cache */
+template <typename E>
+struct assigned_fields;
+
+/* Expression which reads only evaluated row, see dbset::change */
+template <typename E, typename = void>
+struct row_local;
+
+/**
+ * Field description shared by all rows of a table.
+ */
+struct field_schema
+{
+	field_schema(table_schema* table, std::ptrdiff_t offset,
+		const std::string& name, const std::string& type):
+		table_(table), offset_(offset), name_(name), type_(type), triggered_(false) {}
+	
+	table_schema* table_;
+	std::ptrdiff_t offset_; /* Position of field inside row */
+	std::string name_;
+	std::string type_;
+	constraint_expr constraint;
+	bool triggered_; /* May be written by trigger */
+	
+	/* Field described by this schema in given row */
+	abstract_field* get(table* row) const
+	{
+		return reinterpret_cast<abstract_field*>(
+			reinterpret_cast<char*>(row) + offset_);
+	}
+};
+
+/**
+ * Constraint of a field. Constraints are stored once in field_schema,
+ * so this is just a reference to it.
+ */
+struct constraint_ref
+{
+	constraint_ref(): schema_(NULL) {}
+	
+	/**
+	 * Add constraint, or set whole expression, while table schema is
+	 * being defined. Constraints set by other rows are ignored.
+	 */
+	inline constraint_ref& operator=(abstract_constraint& impl);
+	inline constraint_ref& operator=(const constraint_expr& expr);
+	
+	std::size_t size() const
+	{
+		return schema_->constraint.size();
+	}
+	
+	/* Evaluate */
+	void operator()(abstract_field* fld, table* tbl, abstract_dbset* set)
+	{
+		schema_->constraint(fld, tbl, set);
+	}
+	
+	field_schema* schema_;
+};
+
 /* Interfaces */
 struct abstract_field
 {
@@ -95,6 +220,18 @@ struct abstract_field
 	virtual std::string name() = 0;
 	virtual bool operator==(abstract_field& other) = 0;
 	
+	/* Binary representation of value, see serializer */
+	virtual void write(std::string& out) const = 0;
+	virtual bool read(const char*& p, const char* end) = 0;
+	virtual std::size_t width() const = 0;
+	
+	/* Text representation of value, see text_format */
+	virtual void format(std::string& out) const = 0;
+	virtual bool parse(const char* p, std::size_t n) = 0;
+	
+	/* Hash of value, equal values have equal hashes. See field_hash */
+	virtual std::size_t hash() const = 0;
+	
 	bool operator==(abstract_field* other)
 	{
 		return this->operator==(*other);
@@ -105,7 +242,9 @@ struct abstract_field
 		return !this->operator==(other);
 	}
 	
-	constraint_expr constraint; /* Constraint expr */
+	constraint_ref constraint; /* Constraint expr */
+	
+	field_schema* schema() const { return constraint.schema_; }
 };
 
 
@@ -113,6 +252,7 @@ struct abstract_field
 
 struct expression_functor
 {
+	virtual ~expression_functor() {}
 	virtual bool operator()(table*) = 0;
 };
 
@@ -169,35 +309,278 @@ struct expression
 		bool empty() const { return !ctor_; }
 };
 
+/**
+ * Table description shared by all rows: fields, constraints and
+ * triggers. Rows carry only a pointer to it, so a row costs only its
+ * values.
+ * Rows constructed with table(this, name) have schema of their type,
+ * defined at once by default constructed prototype row before first row
+ * of the type is constructed. Rows constructed with table(name) share
+ * schema of table with that name, defined by the first row of table, and
+ * must be of one type.
+ * Constraints and triggers are the ones set by the row which defines
+ * schema; other rows may set them too, but they are ignored.
+ */
+struct table_schema
+{
+	typedef std::vector<std::unique_ptr<field_schema> > fields_t;
+	
+	/* Trigger list 
+	 * When expr1 evaluates to true, then evaluate second expression */	
+	typedef std::list<std::pair<expression_functor*, expression_functor*> > triggers_t;
+	
+	table_schema(): type_(NULL), defined_(false) {}
+	
+	~table_schema()
+	{
+		clear();
+	}
+	
+	/**
+	 * Schema of rows of type T, defined on first call. Other threads
+	 * wait until it is defined. Schemas live until exit.
+	 */
+	template <typename T>
+	static table_schema& of()
+	{
+		static_assert(std::is_default_constructible<T>::value,
+			"row needs default constructor, which defines schema");
+		static table_schema schema;
+		static thread_local bool defining = false; /* Prototype is constructed by this thread */
+		if (defining || schema.defined_.load(std::memory_order_acquire))
+			return schema;
+		
+		std::lock_guard<std::mutex> lock(schema.mutex_);
+		if (schema.defined_)
+			return schema;
+		schema.type_ = &typeid(T);
+		defining = true;
+		try
+		{
+			T prototype;
+		}
+		catch (...)
+		{
+			defining = false;
+			schema.clear();
+			throw;
+		}
+		defining = false;
+		schema.defined_.store(true, std::memory_order_release);
+		return schema;
+	}
+	
+	/**
+	 * Schema of table with given name, for rows constructed with
+	 * table(name). First row of table defines it. Its constructor is
+	 * known to be finished when the row is copied, put into set, or
+	 * when its thread constructs the next row of table; rows constructed
+	 * on other threads wait until then. Schemas live until exit.
+	 */
+	static table_schema& named(const std::string& name)
+	{
+		static std::mutex mutex;
+		static std::map<std::string, std::unique_ptr<table_schema> > schemas;
+		table_schema* schema;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			std::unique_ptr<table_schema>& entry = schemas[name];
+			if (!entry)
+			{
+				entry.reset(new table_schema());
+				entry->name_ = name;
+				entry->definer_ = std::this_thread::get_id();
+				return *entry;
+			}
+			schema = entry.get();
+		}
+		if (schema->defined_.load(std::memory_order_acquire))
+			return *schema;
+		if (schema->definer_ == std::this_thread::get_id())
+		{
+			schema->defined();
+			return *schema;
+		}
+		std::unique_lock<std::mutex> lock(schema->mutex_);
+		while (!schema->defined_)
+			schema->wake_.wait(lock);
+		return *schema;
+	}
+	
+	/* Row defining schema of table(name) is complete, see named() */
+	void defined()
+	{
+		if (definer_ == std::thread::id() || defined_.load(std::memory_order_acquire))
+			return;
+		std::lock_guard<std::mutex> lock(mutex_);
+		defined_.store(true, std::memory_order_release);
+		wake_.notify_all();
+	}
+	
+	/**
+	 * Set of rows of given type uses schema. Rows of table(name) are
+	 * typed by the first set they are put into.
+	 * @throw std::logic_error if schema is of other type
+	 */
+	void typed(const std::type_info& type)
+	{
+		const std::type_info* expected = NULL;
+		if (type_.load(std::memory_order_relaxed) != &type &&
+			!type_.compare_exchange_strong(expected, &type) && *expected != type)
+			throw std::logic_error("table " + name_ + " has rows of other type");
+		defined();
+	}
+	
+	/* Row which defines schema is being constructed? Only its thread sees schema then. */
+	bool defining() const
+	{
+		return !defined_.load(std::memory_order_relaxed);
+	}
+	
+	/**
+	 * Find field at given offset, or describe new one while schema is
+	 * being defined.
+	 */
+	field_schema* add_field(std::ptrdiff_t offset, abstract_field* fld,
+		const std::string& name)
+	{
+		for (fields_t::iterator it(fields_.begin()), end(fields_.end()); it != end; ++it)
+		{
+			if ((*it)->offset_ == offset)
+				return it->get();
+		}
+		if (!defining())
+			throw std::logic_error("field " + name + " is not in schema of " + name_);
+		fields_.push_back(std::unique_ptr<field_schema>(
+			new field_schema(this, offset, name, fld->type())));
+		return fields_.back().get();
+	}
+	
+	std::string name_;
+	fields_t fields_;
+	triggers_t triggers;
+	std::atomic<const std::type_info*> type_; /* Type of rows */
+	std::atomic<bool> defined_; /* Set once, when defining row is constructed */
+
+private:
+	table_schema(const table_schema&);
+	table_schema& operator=(const table_schema&);
+	
+	void clear()
+	{
+		fields_.clear();
+		for (triggers_t::iterator it(triggers.begin()), end(triggers.end()); it != end; ++it)
+		{
+			delete it->first;
+			delete it->second;
+		}
+		triggers.clear();
+	}
+	
+	std::mutex mutex_; /* Held while prototype is constructed */
+	std::condition_variable wake_; /* Rows of table(name) wait for definition */
+	std::thread::id definer_; /* Thread defining schema of table(name) */
+};
+
+constraint_ref& constraint_ref::operator=(abstract_constraint& impl)
+{
+	if (schema_->table_->defining())
+		schema_->constraint = impl;
+	return *this;
+}
+
+constraint_ref& constraint_ref::operator=(const constraint_expr& expr)
+{
+	if (schema_->table_->defining())
+		schema_->constraint = expr;
+	return *this;
+}
+
 struct table
 {
+	/**
+	 * @param row row being constructed, its type identifies schema
+	 * @param tablename name of table
+	 * @code person(): table(this, "person"), id(this, "id") {} @endcode
+	 */
+	template <typename T>
+	table(T*, const std::string& tablename) :
+		schema_(&table_schema::of<T>()), parent_(NULL)
+	{
+		if (schema_->defining())
+			schema_->name_ = tablename;
+	}
+	
+	/**
+	 * Row of table with given name, which does not need default
+	 * constructor. Rows of one name share schema, see table_schema::named().
+	 * @code person(const string& name): table("person"), name(this, "name", name) {} @endcode
+	 */
 	table(const std::string& tablename) :
-		tablename_(tablename), parent_(NULL) {}
+		schema_(&table_schema::named(tablename)), parent_(NULL) {}
 	
-	void add_field(abstract_field* field)
+	/* Constructor of copied row is finished, so is schema it defines */
+	table(const table& other) : schema_(other.schema_), parent_(other.parent_)
 	{
-		fields_.push_back(field);
+		schema_->defined();
 	}
 	
-	typedef std::vector<abstract_field*> fields_t;
+	table(table&& other) noexcept : schema_(other.schema_), parent_(other.parent_)
+	{
+		schema_->defined();
+	}
 	
-	fields_t fields_;
-	std::string tablename_;
+	table& operator=(const table& other)
+	{
+		schema_ = other.schema_;
+		parent_ = other.parent_;
+		return *this;
+	}
 	
-	/* Trigger list 
-	 * When expr1 evaluates to true, then evaluate second expression */	
-	typedef std::list<std::pair<expression_functor*, expression_functor*> > triggers_t;
-	triggers_t triggers;
+	field_schema* add_field(abstract_field* field, const std::string& name)
+	{
+		return schema_->add_field(reinterpret_cast<char*>(field) -
+			reinterpret_cast<char*>(this), field, name);
+	}
 	
+	typedef table_schema::fields_t fields_t;
+	typedef table_schema::triggers_t triggers_t;
+	
+	const std::string& tablename() const { return schema_->name_; }
+	
+	/**
+	 * Add trigger while schema is being defined. Triggers added by
+	 * other rows are ignored.
+	 */
 	template <typename Cond, typename Stmt>
 	void addTrigger(const Cond cond, const Stmt stmt)
 	{
-		triggers.push_back(triggers_t::value_type(
-			new expression_functor_wrapper<Cond, typename Cond::object_type>(cond),
-			new expression_functor_wrapper<Stmt, typename Stmt::object_type>(stmt)
-		));
+		if (!schema_->defining())
+			return;
+		schema_->triggers.push_back(triggers_t::value_type(
+			new expression_functor_wrapper<typename plan<Cond>::type,
+				typename Cond::object_type>(plan<Cond>::make(cond)),
+			new expression_functor_wrapper<Stmt, typename Stmt::object_type>(stmt)));
+		
+		/* Ids of fields are offsets in row, offsets in schema are from table */
+		typedef typename Stmt::object_type row_type;
+		row_type* row = static_cast<row_type*>(this);
+		std::ptrdiff_t base = reinterpret_cast<char*>(static_cast<table*>(row)) -
+			reinterpret_cast<char*>(row);
+		field_ids written;
+		bool known = assigned_fields<Stmt>::collect(stmt, written);
+		for (fields_t::iterator it(schema_->fields_.begin()),
+			end(schema_->fields_.end()); it != end; ++it)
+		{
+			if (!known || std::find(written.begin(), written.end(),
+				(*it)->offset_ + base) != written.end())
+			{
+				(*it)->triggered_ = true;
+			}
+		}
 	}
 	
+	table_schema* schema_;
 	abstract_dbset* parent_;
 };
 
@@ -224,6 +607,18 @@ struct constraint: abstract_constraint
 	}
 };
 
+/**
+ * Value of field is not repeated in set. Checked by set with hash index
+ * of field, after triggers are evaluated, so triggers may fill it.
+ */
+struct unique_impl: abstract_constraint
+{
+	virtual void operator()(abstract_field*, table*, abstract_dbset*) {}
+};
+
+/* Unique field identifying row, see dbset::get() */
+struct primary_key_impl: unique_impl {};
+
 /* end */
 
 /* 
@@ -240,6 +635,166 @@ struct get_type<std::string> { std::string value() const { return "TEXT"; } };
 template <>
 struct get_type<int> { std::string value() const { return "INTEGER"; } };
 
+/*
+ * Binary representation of type, used by write-ahead log and snapshots.
+ * Plain values are stored as their bytes. Other types, which may own
+ * memory, need their own specialization.
+ */
+template <typename T>
+struct serializer
+{
+	static_assert(std::is_trivially_copyable<T>::value,
+		"type of field is not trivially copyable, specialize serializer for it");
+	
+	/* Size of every value, 0 if it varies */
+	enum { width = sizeof(T) };
+	
+	static void write(std::string& out, const T& value)
+	{
+		out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+	
+	/* Read value and move p past it. @return false if data is too short */
+	static bool read(const char*& p, const char* end, T& value)
+	{
+		if (end - p < (std::ptrdiff_t)sizeof(T))
+			return false;
+		std::memcpy(&value, p, sizeof(T));
+		p += sizeof(T);
+		return true;
+	}
+};
+
+template <>
+struct serializer<std::string>
+{
+	enum { width = 0 };
+	
+	static void write(std::string& out, const std::string& value)
+	{
+		serializer<std::uint32_t>::write(out, value.size());
+		out.append(value);
+	}
+	
+	static bool read(const char*& p, const char* end, std::string& value)
+	{
+		std::uint32_t size;
+		if (!serializer<std::uint32_t>::read(p, end, size) || end - p < (std::ptrdiff_t)size)
+			return false;
+		value.assign(p, size);
+		p += size;
+		return true;
+	}
+};
+
+/*
+ * Text representation of type, used by import and export.
+ * Other types are written and read with streams.
+ */
+template <typename T>
+struct text_format
+{
+	static void format(std::string& out, const T& value)
+	{
+		std::ostringstream s;
+		s << value;
+		out += s.str();
+	}
+	
+	/* @return false if text is not a whole value */
+	static bool parse(const char* p, std::size_t n, T& value)
+	{
+		std::istringstream s(std::string(p, n));
+		return (s >> value) && s.peek() == EOF;
+	}
+};
+
+template <>
+struct text_format<int>
+{
+	static void format(std::string& out, int value)
+	{
+		char digits[16];
+		char* p = digits + sizeof(digits);
+		unsigned magnitude = value < 0 ? 0u - unsigned(value) : unsigned(value);
+		do
+		{
+			*--p = char('0' + magnitude % 10);
+			magnitude /= 10;
+		}
+		while (magnitude);
+		if (value < 0)
+			*--p = '-';
+		out.append(p, digits + sizeof(digits));
+	}
+	
+	static bool parse(const char* p, std::size_t n, int& value)
+	{
+		const char* end = p + n;
+		bool negative = p != end && *p == '-';
+		if (p != end && (*p == '-' || *p == '+'))
+			++p;
+		if (p == end)
+			return false;
+		long long result = 0;
+		for (; p != end; ++p)
+		{
+			if (*p < '0' || *p > '9')
+				return false;
+			result = result * 10 + (*p - '0');
+			if (result > (long long)INT_MAX + 1)
+				return false;
+		}
+		if (negative)
+			result = -result;
+		if (result > INT_MAX)
+			return false;
+		value = int(result);
+		return true;
+	}
+};
+
+template <>
+struct text_format<std::string>
+{
+	static void format(std::string& out, const std::string& value)
+	{
+		out += value;
+	}
+	
+	static bool parse(const char* p, std::size_t n, std::string& value)
+	{
+		value.assign(p, n);
+		return true;
+	}
+};
+
+/*
+ * Hash of value, used by unique fields. Types without std::hash
+ * hash to 0, so they are still checked, just by comparing all values.
+ */
+template <typename T>
+struct field_hash
+{
+	static std::size_t hash(const T& value)
+	{
+		return apply<T>(value, 0);
+	}
+	
+private:
+	template <typename U>
+	static std::size_t apply(const U& value, decltype(std::hash<U>()(value))*)
+	{
+		return std::hash<U>()(value);
+	}
+	
+	template <typename U>
+	static std::size_t apply(const U&, ...)
+	{
+		return 0;
+	}
+};
+
 /**
  * Field. Actually a POD variable wrapper.
  */
@@ -248,17 +803,15 @@ struct field: abstract_field
 {
 	typedef T value_type;
 	
-	field(table* parent, std::string name, const value_type& value = value_type()):
-		name_(name),
-		value_(value),
-		parent_(parent)
+	field(table* parent, const std::string& name, value_type value = value_type()):
+		value_(std::move(value))
 	{
-		parent->add_field(this);
+		constraint.schema_ = parent->add_field(this, name);
 	}
 	
 	field& operator=(T new_value)
 	{
-		value_ = new_value;
+		value_ = std::move(new_value);
 		return *this;
 	}
 
@@ -267,7 +820,7 @@ struct field: abstract_field
 		return this->value_ == dynamic_cast<field&>(other).value_;
 	}
 	
-	bool operator==(value_type value)
+	bool operator==(value_type value) const
 	{
 		return value_ == value;
 	}
@@ -283,13 +836,41 @@ struct field: abstract_field
 		return out;
 	}
 	
-	std::string name_;
 	value_type value_;
-	get_type<T> type_;
-	table* parent_;
 		
-	virtual std::string name() { return name_; }
-	virtual std::string type() { return type_.value(); }
+	virtual std::string name() { return schema()->name_; }
+	virtual std::string type() { return get_type<T>().value(); }
+	
+	virtual void write(std::string& out) const
+	{
+		serializer<T>::write(out, value_);
+	}
+	
+	virtual bool read(const char*& p, const char* end)
+	{
+		return serializer<T>::read(p, end, value_);
+	}
+	
+	/* Values which are not plain bytes are never stored in arrays */
+	virtual std::size_t width() const
+	{
+		return std::is_trivially_copyable<T>::value ? std::size_t(serializer<T>::width) : 0;
+	}
+	
+	virtual void format(std::string& out) const
+	{
+		text_format<T>::format(out, value_);
+	}
+	
+	virtual bool parse(const char* p, std::size_t n)
+	{
+		return text_format<T>::parse(p, n, value_);
+	}
+	
+	virtual std::size_t hash() const
+	{
+		return field_hash<T>::hash(value_);
+	}
 };
 
 /**
@@ -298,9 +879,22 @@ struct field: abstract_field
 template <typename T /* Container */>
 struct cursor_impl
 {
-	cursor_impl(T t):
-		container_(t),
-		it_(container_.begin())
+	/**
+	 * Iterate over existing container, without copying it.
+	 */
+	cursor_impl(T& t):
+		it_(t.begin()),
+		end_(t.end())
+	{
+	}
+	
+	/**
+	 * Take over temporary result set.
+	 */
+	cursor_impl(T&& t):
+		container_(new T(std::move(t))),
+		it_(container_->begin()),
+		end_(container_->end())
 	{
 	}
 	
@@ -309,7 +903,7 @@ struct cursor_impl
 	 */	
 	operator bool()
 	{
-		return it_ != container_.end();
+		return it_ != end_;
 	}
 	
 	cursor_impl& operator++()
@@ -318,482 +912,6901 @@ struct cursor_impl
 		return *this;
 	}
 	
-	typename std::iterator_traits<typename T::iterator>::value_type operator*()
+	typename std::iterator_traits<typename T::iterator>::reference operator*()
 	{
 		return *it_;	
 	}
 	
-	T container_;
+	std::shared_ptr<T> container_; /* Owned result set */
 	typename T::iterator it_;
 	typename T::iterator end_;
 };
 
-struct dbcontext;
-
-template <typename T>
-struct dbset: abstract_dbset
+/**
+ * Pool of worker threads running chunks of a scan.
+ * Chunks are claimed one by one from shared counter, so threads which
+ * finish early take over work left by busy ones. Calling thread takes
+ * part in the work too. Counter is tagged with generation of job, so
+ * thread which woke up late never claims chunk of the next one.
+ */
+struct worker_pool
 {
-	std::list<T> rows_;
+	explicit worker_pool(unsigned threads):
+		generation_(0), active_(0), stop_(false), task_(NULL), chunks_(0), next_(0)
+	{
+		for (unsigned i = 1; i < threads; ++i)
+			workers_.push_back(std::thread(&worker_pool::work, this));
+	}
 	
-	typedef cursor_impl<std::list<T> > cursor;
+	~worker_pool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stop_ = true;
+		}
+		wake_.notify_all();
+		for (std::vector<std::thread>::iterator it(workers_.begin()),
+			end(workers_.end()); it != end; ++it)
+		{
+			it->join();
+		}
+	}
 	
-	dbset(dbcontext* parent) : abstract_dbset(parent) {}
-		
-	void put(T t)
+	/* Number of threads, including calling one */
+	unsigned size() const { return workers_.size() + 1; }
+	
+	/**
+	 * Run task(chunk) for every chunk in [0, chunks) and wait until
+	 * all of them are done. There are fewer than 2^32 chunks.
+	 * Task can not run another job of the same pool.
+	 */
+	void run(std::size_t chunks, const std::function<void(std::size_t)>& task)
 	{
-		t.parent_ = this;
-		
-		for (typename T::fields_t::iterator it(t.fields_.begin()),
-			end(t.fields_.end()); it != end; ++it)
+		if (running() == this)
+			throw std::logic_error("worker_pool::run called from its own task");
+		std::lock_guard<std::mutex> serial(run_mutex_);
+		unsigned long generation;
 		{
-			(*it)->constraint(*it, &t, this);
+			std::lock_guard<std::mutex> lock(mutex_);
+			task_ = &task;
+			chunks_ = chunks;
+			generation = ++generation_;
+			next_ = tag(generation);
 		}
+		wake_.notify_all();
+		execute(task, chunks, generation);
 		
-		for (typename T::triggers_t::iterator it(t.triggers.begin()),
-			end(t.triggers.end()); it != end; ++it)
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (active_)
+			finished_.wait(lock);
+		task_ = NULL;
+	}
+	
+private:
+	worker_pool(const worker_pool&);
+	worker_pool& operator=(const worker_pool&);
+	
+	/* Chunk counter of job with given generation */
+	static std::uint64_t tag(unsigned long generation)
+	{
+		return std::uint64_t(generation & 0xffffffffu) << 32;
+	}
+	
+	/* Pool whose task is executed by current thread */
+	static worker_pool*& running()
+	{
+		static thread_local worker_pool* pool = NULL;
+		return pool;
+	}
+	
+	/* Claim chunks of given job until none is left or next job started */
+	void execute(const std::function<void(std::size_t)>& task, std::size_t chunks,
+		unsigned long generation)
+	{
+		struct running_guard
 		{
-			if ((*it->first)(&t))
-				((*it->second)(&t));
+			worker_pool* previous_;
+			explicit running_guard(worker_pool* pool): previous_(running()) { running() = pool; }
+			~running_guard() { running() = previous_; }
+		} guard(this);
+		const std::uint64_t job = tag(generation);
+		std::uint64_t next = next_.load();
+		while ((next & ~std::uint64_t(0xffffffffu)) == job && (next & 0xffffffffu) < chunks)
+		{
+			if (next_.compare_exchange_weak(next, next + 1))
+			{
+				task(std::size_t(next & 0xffffffffu));
+				next = next_.load();
+			}
+		}
+	}
+	
+	void work()
+	{
+		unsigned long seen = 0;
+		while (true)
+		{
+			const std::function<void(std::size_t)>* task;
+			std::size_t chunks;
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				while (!stop_ && generation_ == seen)
+					wake_.wait(lock);
+				if (stop_)
+					return;
+				seen = generation_;
+				task = task_;
+				chunks = chunks_;
+				if (!task) /* Job is done already */
+					continue;
+				++active_;
+			}
+			execute(*task, chunks, seen);
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				--active_;
+			}
+			finished_.notify_all();
+		}
+	}
+	
+	std::vector<std::thread> workers_;
+	std::mutex run_mutex_; /* One job at a time */
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::condition_variable finished_;
+	unsigned long generation_;
+	unsigned active_;
+	bool stop_;
+	
+	/* Current job, read under mutex */
+	const std::function<void(std::size_t)>* task_;
+	std::size_t chunks_;
+	std::atomic<std::uint64_t> next_; /* Generation and next chunk */
+};
+
+/**
+ * Append-only log of changes.
+ * Records are appended to memory buffer and written by background
+ * thread with single write() and fsync() per batch, so changes made
+ * while previous batch is being synced share the next fsync (group
+ * commit). Record is its size, checksum and body starting with
+ * sequence number.
+ */
+struct write_ahead_log
+{
+	/**
+	 * @param fd log file opened for appending
+	 * @param lsn sequence number of last record already in log
+	 */
+	write_ahead_log(int fd, std::uint64_t lsn):
+		fd_(fd), lsn_(lsn), durable_(lsn), failed_(false), stop_(false)
+	{
+		thread_ = std::thread(&write_ahead_log::flush, this);
+	}
+	
+	/* Buffered records are written before log is closed */
+	~write_ahead_log()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stop_ = true;
+		}
+		wake_.notify_all();
+		thread_.join();
+		::close(fd_);
+	}
+	
+	/**
+	 * Append record.
+	 * @param op kind of change
+	 * @param name name of changed set
+	 * @param payload change itself
+	 * @return sequence number of record
+	 */
+	std::uint64_t append(char op, const std::string& name, const std::string& payload)
+	{
+		std::string body;
+		body.reserve(sizeof(std::uint64_t) + 1 + sizeof(std::uint32_t) + name.size() + payload.size());
+		std::lock_guard<std::mutex> lock(mutex_);
+		std::uint64_t lsn = ++lsn_;
+		serializer<std::uint64_t>::write(body, lsn);
+		serializer<char>::write(body, op);
+		serializer<std::string>::write(body, name);
+		body.append(payload);
+		serializer<std::uint32_t>::write(buffer_, body.size());
+		serializer<std::uint32_t>::write(buffer_, checksum(body.data(), body.size()));
+		buffer_.append(body);
+		wake_.notify_one();
+		return lsn;
+	}
+	
+	/**
+	 * Wait until record with given sequence number is on disk.
+	 * @return false if writing log failed
+	 */
+	bool wait(std::uint64_t lsn)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (durable_ < lsn && !failed_)
+			synced_.wait(lock);
+		return !failed_;
+	}
+	
+	/* Wait until all appended records are on disk */
+	bool sync()
+	{
+		return wait(last());
+	}
+	
+	/**
+	 * Drop all records, after they are saved in snapshot.
+	 * Nothing may be appended meanwhile.
+	 */
+	bool truncate()
+	{
+		if (!sync())
+			return false;
+		std::lock_guard<std::mutex> lock(mutex_);
+		return ::ftruncate(fd_, 0) == 0 && ::fsync(fd_) == 0;
+	}
+	
+	/* Sequence number of last appended record */
+	std::uint64_t last()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return lsn_;
+	}
+	
+	/* FNV-1a hash of record body */
+	static std::uint32_t checksum(const char* p, std::size_t n)
+	{
+		std::uint32_t hash = 2166136261u;
+		for (std::size_t i = 0; i < n; ++i)
+			hash = (hash ^ (unsigned char)p[i]) * 16777619u;
+		return hash;
+	}
+	
+private:
+	write_ahead_log(const write_ahead_log&);
+	write_ahead_log& operator=(const write_ahead_log&);
+	
+	void flush()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (true)
+		{
+			while (!stop_ && buffer_.empty())
+				wake_.wait(lock);
+			if (buffer_.empty())
+				return;
+			std::string batch;
+			batch.swap(buffer_);
+			std::uint64_t lsn = lsn_;
+			lock.unlock();
+			bool ok = write_all(batch) && ::fsync(fd_) == 0;
+			lock.lock();
+			if (!ok)
+				failed_ = true;
+			durable_ = lsn;
+			synced_.notify_all();
+		}
+	}
+	
+	bool write_all(const std::string& data)
+	{
+		for (std::size_t done = 0; done < data.size(); )
+		{
+			ssize_t n = ::write(fd_, data.data() + done, data.size() - done);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n < 0)
+				return false;
+			done += n;
+		}
+		return true;
+	}
+	
+	int fd_;
+	std::thread thread_;
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::condition_variable synced_;
+	std::string buffer_; /* Records not written yet */
+	std::uint64_t lsn_; /* Last appended */
+	std::uint64_t durable_; /* Last synced */
+	bool failed_;
+	bool stop_;
+};
+
+/**
+ * Set saved in snapshots and write-ahead log of its context.
+ */
+struct abstract_persistent
+{
+	virtual ~abstract_persistent() {}
+	
+	/* Name of set in snapshot and log */
+	virtual const std::string& name() const = 0;
+	
+	/* Append all rows to snapshot */
+	virtual void save(std::string& out) = 0;
+	
+	/* Load rows saved by save(). @return false if data is damaged */
+	virtual bool load(const char*& p, const char* end) = 0;
+	
+	/* Apply logged change. @return false if data is damaged */
+	virtual bool replay(char op, const char*& p, const char* end) = 0;
+	
+	/* Recovery is complete */
+	virtual void recovered() = 0;
+};
+
+/* Read whole file, @return false if there is no such file */
+inline bool read_file(const std::string& path, std::string& data)
+{
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	data.clear();
+	char buffer[65536];
+	ssize_t n;
+	while ((n = ::read(fd, buffer, sizeof(buffer))) > 0)
+		data.append(buffer, n);
+	::close(fd);
+	return n == 0;
+}
+
+struct dbcontext
+{
+	/* When changes are on disk */
+	enum commit_mode
+	{
+		commit_sync, /* before put() and update() return */
+		commit_async /* soon, in background */
+	};
+	
+	dbcontext(): pool_(NULL), log_(NULL), mode_(commit_sync),
+		transaction_(false), committing_(false), batch_(NULL) {}
+	
+	~dbcontext()
+	{
+		delete pool_;
+		delete log_;
+		for (std::vector<abstract_persistent*>::iterator it(persistent_.begin()),
+			end(persistent_.end()); it != end; ++it)
+		{
+			delete *it;
 		}
+	}
+	
+	/**
+	 * Run scans of sets in this context on given number of threads.
+	 * Expressions evaluated in parallel must not change other rows
+	 * than the one they are evaluated with.
+	 * @param n number of threads, 1 runs everything on calling thread
+	 */
+	void threads(unsigned n)
+	{
+		delete pool_;
+		pool_ = n > 1 ? new worker_pool(n) : NULL;
+	}
+	
+	/**
+	 * Recover persistent sets from last snapshot and log in given
+	 * directory, then log their changes there. Sets are made
+	 * persistent with dbset::persist() before.
+	 * @param path directory, created if missing
+	 * @param mode when changes are on disk
+	 * @return false if files can not be read or written
+	 */
+	bool open(const std::string& path, commit_mode mode = commit_sync)
+	{
+		delete log_;
+		log_ = NULL;
+		path_ = path;
+		mode_ = mode;
+		if (::mkdir(path.c_str(), 0755) != 0 && errno != EEXIST)
+			return false;
 		
+		std::uint64_t lsn = 0;
+		std::string data;
+		if (read_file(path_ + "/snapshot", data) && !restore(data, lsn))
+			return false;
+		
+		std::size_t valid = 0;
+		if (read_file(path_ + "/wal", data))
+			valid = replay(data, lsn);
+		for (std::vector<abstract_persistent*>::iterator it(persistent_.begin()),
+			end(persistent_.end()); it != end; ++it)
+		{
+			(*it)->recovered();
+		}
 		
-		rows_.push_back(t);
+		int fd = ::open((path_ + "/wal").c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+		if (fd < 0)
+			return false;
+		/* Drop torn record at the end */
+		if (::ftruncate(fd, valid) != 0)
+		{
+			::close(fd);
+			return false;
+		}
+		log_ = new write_ahead_log(fd, lsn);
+		return true;
 	}
 	
 	/**
-	 * This thing simply iterates over rows,
-	 * evaluates expression with value, and if it evaluates to true
-	 * then copy it to 'result set'.
-	 * @param f operator instance with type of operator_impl.
+	 * Save snapshot of persistent sets and empty the log, so recovery
+	 * replays fewer records. Sets must not change meanwhile.
+	 * @return false if snapshot could not be written
 	 */
-	template <typename F>
-	std::list<T> filter(F f)
+	bool checkpoint()
 	{
-		std::list<T> results;
+		if (!log_ || !log_->sync())
+			return false;
 		
-		for (typename std::list<T>::iterator it = rows_.begin(),
-			end(rows_.end()); it != end; it++)
+		std::string data("MUSNAP1", 8);
+		serializer<std::uint64_t>::write(data, log_->last());
+		for (std::vector<abstract_persistent*>::iterator it(persistent_.begin()),
+			end(persistent_.end()); it != end; ++it)
 		{
-			if (f(it))
-				results.push_back(*it);
+			std::string rows;
+			(*it)->save(rows);
+			serializer<std::string>::write(data, (*it)->name());
+			serializer<std::uint64_t>::write(data, rows.size());
+			serializer<std::uint32_t>::write(data, write_ahead_log::checksum(rows.data(), rows.size()));
+			data.append(rows);
 		}
 		
-		return results;
+		/* Snapshot replaces previous one only when it is complete */
+		std::string tmp(path_ + "/snapshot.tmp");
+		int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			return false;
+		bool ok = true;
+		for (std::size_t done = 0; ok && done < data.size(); )
+		{
+			ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+			ok = n >= 0 || errno == EINTR;
+			done += n > 0 ? n : 0;
+		}
+		ok = ::fsync(fd) == 0 && ok;
+		::close(fd);
+		if (!ok || std::rename(tmp.c_str(), (path_ + "/snapshot").c_str()) != 0)
+			return false;
+		int dir = ::open(path_.c_str(), O_RDONLY);
+		if (dir >= 0)
+		{
+			::fsync(dir);
+			::close(dir);
+		}
+		/* Records older than snapshot are skipped if this fails */
+		return log_->truncate();
 	}
 	
 	/**
-	 * Update rows matching expr... If expr `where` evaluated to true
-	 * then evaluate expr `stmt`
+	 * Wait until all logged changes are on disk.
+	 * @return false if log could not be written
 	 */
-	template <typename F1, typename F2>
-	void update(F1 where, F2 stmt)
+	bool sync()
+	{
+		return !log_ || log_->sync();
+	}
+	
+	/**
+	 * Start transaction. Until commit() or rollback(), put() and
+	 * update() of sets in this context are not applied but remembered.
+	 * Reads do not see them. Transactions are not nested.
+	 */
+	void begin()
+	{
+		rollback();
+		transaction_ = true;
+	}
+	
+	/**
+	 * Apply changes of transaction in order. Constraints and triggers
+	 * are evaluated now, rows put one after another are put together
+	 * with put_range(). Observers are told about changes and log is
+	 * synced once for whole transaction, which is replayed after crash
+	 * only if it was complete.
+	 * When a change throws, changes applied before are undone, abort
+	 * is logged and exception is thrown again; no set is changed then.
+	 * @return false if log could not be written
+	 */
+	bool commit()
 	{
-		for (typename std::list<T>::iterator it(rows_.begin()),
-			end(rows_.end()); it != end; it++)
+		if (!transaction_)
+			return true;
+		std::vector<std::function<void()> > operations;
+		operations.swap(operations_);
+		std::set<abstract_dbset*> touched;
+		touched.swap(touched_);
+		rollback();
+		if (operations.empty())
+			return true;
+		
+		if (log_)
+			log_->append('B', std::string(), std::string());
+		for (std::set<abstract_dbset*>::iterator it(touched.begin()),
+			end(touched.end()); it != end; ++it)
+		{
+			(*it)->record();
+		}
+		try
+		{
+			applying guard(committing_);
+			for (std::vector<std::function<void()> >::iterator it(operations.begin()),
+				end(operations.end()); it != end; ++it)
+			{
+				(*it)();
+			}
+		}
+		catch (...)
+		{
+			for (std::set<abstract_dbset*>::iterator it(touched.begin()),
+				end(touched.end()); it != end; ++it)
+			{
+				(*it)->undo();
+			}
+			if (log_)
+				log_->append('A', std::string(), std::string());
+			for (std::set<abstract_dbset*>::iterator it(touched.begin()),
+				end(touched.end()); it != end; ++it)
+			{
+				(*it)->finish();
+			}
+			throw;
+		}
+		for (std::set<abstract_dbset*>::iterator it(touched.begin()),
+			end(touched.end()); it != end; ++it)
+		{
+			(*it)->forget();
+		}
+		if (log_)
+			log_->append('C', std::string(), std::string());
+		
+		for (std::set<abstract_dbset*>::iterator it(touched.begin()),
+			end(touched.end()); it != end; ++it)
 		{
-			if (where(it))
-				stmt(it);
+			(*it)->finish();
 		}
+		return durable();
+	}
+	
+	/* Forget changes of transaction */
+	void rollback()
+	{
+		transaction_ = false;
+		batch_ = NULL;
+		operations_.clear();
+		touched_.clear();
 	}
 	
 	/**
-	 * Update all rows... Really just evaluate stmt with every object
-	 * in set.
+	 * Remember change of set until commit().
 	 */
-	template <typename F>
-	void update(F stmt)
+	void defer(abstract_dbset* set, const std::function<void()>& operation)
+	{
+		operations_.push_back(operation);
+		touched_.insert(set);
+		batch_ = NULL;
+	}
+	
+	/**
+	 * Called by sets after every change. Waits for log when context
+	 * commits synchronously.
+	 * @return false if log failed
+	 */
+	bool durable()
+	{
+		return !log_ || mode_ != commit_sync || log_->sync();
+	}
+	
+	worker_pool* pool_;
+	std::vector<abstract_persistent*> persistent_;
+	write_ahead_log* log_;
+	commit_mode mode_;
+	std::string path_;
+	
+	/* Transaction */
+	bool transaction_; /* Changes are deferred */
+	bool committing_; /* Deferred changes are applied */
+	std::vector<std::function<void()> > operations_;
+	std::set<abstract_dbset*> touched_;
+	abstract_dbset* batch_; /* Set whose rows are put by last operation */
+	
+private:
+	dbcontext(const dbcontext&);
+	dbcontext& operator=(const dbcontext&);
+	
+	/* Deferred changes are applied while it lives, even if one throws */
+	struct applying
+	{
+		explicit applying(bool& flag): flag_(flag) { flag_ = true; }
+		~applying() { flag_ = false; }
+		
+		bool& flag_;
+	};
+	
+	abstract_persistent* find_persistent(const std::string& name)
 	{
-		for (typename std::list<T>::iterator it(rows_.begin()),
-			end(rows_.end()); it != end; it++)
+		for (std::vector<abstract_persistent*>::iterator it(persistent_.begin()),
+			end(persistent_.end()); it != end; ++it)
 		{
-			stmt(it);
+			if ((*it)->name() == name)
+				return *it;
 		}
+		return NULL;
 	}
 	
-	std::list<T>& all()
+	/* Load snapshot. Sets not persistent anymore are skipped. */
+	bool restore(const std::string& data, std::uint64_t& lsn)
 	{
-		return rows_;
+		const char* p = data.data();
+		const char* end = p + data.size();
+		if (data.size() < 8 || std::memcmp(p, "MUSNAP1", 8) != 0)
+			return false;
+		p += 8;
+		if (!serializer<std::uint64_t>::read(p, end, lsn))
+			return false;
+		while (p != end)
+		{
+			std::string name;
+			std::uint64_t size;
+			std::uint32_t sum;
+			if (!serializer<std::string>::read(p, end, name) ||
+				!serializer<std::uint64_t>::read(p, end, size) ||
+				!serializer<std::uint32_t>::read(p, end, sum) ||
+				(std::uint64_t)(end - p) < size ||
+				write_ahead_log::checksum(p, size) != sum)
+			{
+				return false;
+			}
+			const char* rows = p;
+			p += size;
+			abstract_persistent* set = find_persistent(name);
+			if (set && (!set->load(rows, p) || rows != p))
+				return false;
+		}
+		return true;
 	}
 	
-	virtual unsigned int size() const { return rows_.size(); }
+	/* Logged change kept until its transaction is complete */
+	struct logged
+	{
+		abstract_persistent* set_;
+		char op_;
+		const char* body_;
+		const char* end_;
+	};
 	
-	/* Object exists in set? */
-	virtual bool exists(table* obj)
+	/**
+	 * Apply log records newer than snapshot. Records of transaction are
+	 * applied when its end is found, and dropped when it was aborted.
+	 * @return length of valid part of log
+	 */
+	std::size_t replay(const std::string& data, std::uint64_t& lsn)
 	{
-		bool found = false;
-		T* evaluated = static_cast<T*>(obj);
-		for (typename std::list<T>::iterator it(rows_.begin()),
-			end(rows_.end()); it != end; ++it)
+		const char* begin = data.data();
+		const char* p = begin;
+		const char* end = p + data.size();
+		const char* transaction = NULL; /* Start of open transaction */
+		std::vector<logged> pending;
+		while (p != end)
 		{
-			if (*it == *evaluated)
+			const char* record = p;
+			std::uint32_t size, sum;
+			if (!serializer<std::uint32_t>::read(p, end, size) ||
+				!serializer<std::uint32_t>::read(p, end, sum) ||
+				(std::size_t)(end - p) < size ||
+				write_ahead_log::checksum(p, size) != sum)
 			{
-				found = true;
-				break;
+				return (transaction ? transaction : record) - begin;
 			}
+			const char* body = p;
+			p += size;
+			
+			std::uint64_t seq;
+			char op;
+			std::string name;
+			if (!serializer<std::uint64_t>::read(body, p, seq) ||
+				!serializer<char>::read(body, p, op) ||
+				!serializer<std::string>::read(body, p, name))
+			{
+				return (transaction ? transaction : record) - begin;
+			}
+			if (seq <= lsn)
+				continue;
+			lsn = seq;
+			
+			if (op == 'B')
+			{
+				transaction = record;
+				pending.clear();
+				continue;
+			}
+			if (op == 'C')
+			{
+				for (std::vector<logged>::iterator it(pending.begin()),
+					last(pending.end()); it != last; ++it)
+				{
+					if (!it->set_->replay(it->op_, it->body_, it->end_))
+						return transaction - begin;
+				}
+				transaction = NULL;
+				pending.clear();
+				continue;
+			}
+			if (op == 'A')
+			{
+				transaction = NULL;
+				pending.clear();
+				continue;
+			}
+			
+			abstract_persistent* set = find_persistent(name);
+			if (!set)
+				continue;
+			if (transaction)
+			{
+				logged change = { set, op, body, p };
+				pending.push_back(change);
+			}
+			else if (!set->replay(op, body, p))
+				return record - begin;
 		}
-		return found;
+		return (transaction ? transaction : p) - begin;
 	}
 };
 
-struct dbcontext
+template <typename T>
+struct dbset;
+
+/* Rows a producer collects before it hands them to set */
+enum { producer_batch = 1024 };
+
+/**
+ * Rows put by producer, waiting in lock-free stack of set until they
+ * are merged.
+ */
+template <typename T /* Table */>
+struct concurrent_batch
 {
-	/* TODO: database context here */
+	std::vector<T> rows_;
+	concurrent_batch* next_;
 };
 
-/* Useful macros 
- * @note evaluated_type is not an macro, its actual type of struct
- * with all template parameters typed in.
- * 
- * template <typename A1, typename A2, ..., typename An>
- * struct dummy_impl
- * {
- *     typedef dummy_impl<A1, A2, ..., An> evaluated_type;
- * };
- */
-#define __CAT(a, b) a##b
-#define _CAT(a, b) __CAT(a, b)
-#define IMPLEMENT_OPERATOR_UNIQ(operator_impl, canonical_name, uniq) \
-	template <typename _CAT(F, uniq)> \
-	operator_impl<evaluated_type, _CAT(F, uniq)> operator canonical_name(_CAT(F, uniq) f) \
-	{ \
-		return operator_impl<evaluated_type, _CAT(F, uniq)>(*this, f); \
-	}
-	
-/* In case of already used template names we use __COUNTER__ to
- * ensure the template name will be unique. */
-#define IMPLEMENT_OPERATOR(operator_impl, canonical_name) \
-	IMPLEMENT_OPERATOR_UNIQ(operator_impl, canonical_name, __COUNTER__)
+template <typename T>
+struct persistent_set;
 
 /**
- * Chain operator implementation
- * This is not static operator because of possible compilation failure
+ * Rows removed from set. They stay in place until set is compacted,
+ * so positions of other rows do not change.
  */
-template <typename T1, typename T2>
-struct chain_impl
+struct tombstones
+{
+	typedef std::uint64_t word_type;
+	
+	tombstones(): count_(0) {}
+	
+	bool test(std::size_t pos) const
+	{
+		return count_ && pos / 64 < words_.size() && ((words_[pos / 64] >> (pos % 64)) & 1);
+	}
+	
+	/* @return false if row was removed already */
+	bool set(std::size_t pos)
+	{
+		if (test(pos))
+			return false;
+		if (pos / 64 >= words_.size())
+			words_.resize(pos / 64 + 1, 0);
+		words_[pos / 64] |= word_type(1) << (pos % 64);
+		++count_;
+		return true;
+	}
+	
+	/* Row is not removed anymore */
+	void reset(std::size_t pos)
+	{
+		if (!test(pos))
+			return;
+		words_[pos / 64] &= ~(word_type(1) << (pos % 64));
+		--count_;
+	}
+	
+	/* Number of removed rows */
+	std::size_t count() const { return count_; }
+	
+	void clear()
+	{
+		words_.clear();
+		count_ = 0;
+	}
+	
+	std::vector<word_type> words_;
+	std::size_t count_;
+};
+
+/**
+ * Something that follows changes of rows stored in set.
+ * Columns, indexes and aggregates are kept up to date this way.
+ */
+template <typename T /* Table */>
+struct abstract_observer
+{
+	virtual ~abstract_observer() {}
+	
+	/* Rebuild from all rows of set */
+	virtual void load(const std::vector<T>& rows) = 0;
+	
+	/* Row was appended to the set at given position */
+	virtual void inserted(std::size_t pos, const T& row) = 0;
+	
+	/* Row at given position is about to change */
+	virtual void updating(std::size_t, const T&) {}
+	
+	/* Row at given position was changed */
+	virtual void updated(std::size_t pos, const T& row) = 0;
+	
+	/* Row at given position was removed, it stays there until compaction */
+	virtual void removed(std::size_t pos, const T& row) = 0;
+	
+	/* Set will soon hold given number of rows */
+	virtual void reserve(std::size_t) {}
+	
+	/* Call of put(), put_range() or update() is complete */
+	virtual void committed() {}
+};
+
+/**
+ * Column storage.
+ * Keeps values of one field<T> member of every row in a single
+ * contiguous array, so predicate scans stream through dense memory
+ * instead of touching whole rows.
+ */
+template <typename V /* Value */, typename T /* Table */>
+struct column: abstract_observer<T>
+{
+	typedef V value_type;
+	
+	field<V> T::* field_;
+	std::vector<V> values_;
+	
+	column(field<V> T::* fld): field_(fld) {}
+	
+	virtual void load(const std::vector<T>& rows)
+	{
+		values_.clear();
+		values_.reserve(rows.size());
+		for (typename std::vector<T>::const_iterator it(rows.begin()),
+			end(rows.end()); it != end; ++it)
+		{
+			values_.push_back((*it.*field_).value_);
+		}
+	}
+	
+	virtual void inserted(std::size_t, const T& row)
+	{
+		values_.push_back((row.*field_).value_);
+	}
+	
+	virtual void updated(std::size_t pos, const T& row)
+	{
+		values_[pos] = (row.*field_).value_;
+	}
+	
+	/* Value stays until compaction, scans skip removed rows */
+	virtual void removed(std::size_t, const T&) {}
+	
+	virtual void reserve(std::size_t n)
+	{
+		values_.reserve(n);
+	}
+	
+	const V& operator[](std::size_t pos) const
+	{
+		return values_[pos];
+	}
+};
+
+/**
+ * Maximum value of field. Inserts and updates are O(1). When row holding
+ * the maximum is lowered or removed, the value is recomputed lazily with
+ * single scan.
+ */
+template <typename V /* Value */, typename T /* Table */>
+struct max_aggregate: abstract_observer<T>
+{
+	field<V> T::* field_;
+	bool valid_;
+	bool empty_;
+	V value_;
+	std::vector<std::size_t> at_max_; /* Changed rows which held maximum */
+	
+	max_aggregate(field<V> T::* fld):
+		field_(fld), valid_(false), empty_(true), value_() {}
+	
+	virtual void load(const std::vector<T>&)
+	{
+		valid_ = false;
+		at_max_.clear();
+	}
+	
+	virtual void inserted(std::size_t, const T& row)
+	{
+		if (!valid_)
+			return;
+		push(row);
+	}
+	
+	/* Row holding maximum may lower it */
+	virtual void updating(std::size_t pos, const T& row)
+	{
+		if (valid_ && !empty_ && !((row.*field_).value_ < value_))
+			at_max_.push_back(pos);
+	}
+	
+	/**
+	 * Higher value raises maximum. Maximum is computed again only when
+	 * row which held it got lower value.
+	 */
+	virtual void updated(std::size_t pos, const T& row)
+	{
+		std::vector<std::size_t>::iterator it(std::find(at_max_.begin(), at_max_.end(), pos));
+		bool held = it != at_max_.end();
+		if (held)
+			at_max_.erase(it);
+		if (!valid_)
+			return;
+		push(row);
+		if (held && (row.*field_).value_ < value_)
+		{
+			valid_ = false;
+			at_max_.clear();
+		}
+	}
+	
+	/* Only removal of maximum changes it */
+	virtual void removed(std::size_t, const T& row)
+	{
+		if (valid_ && !empty_ && !((row.*field_).value_ < value_))
+			valid_ = false;
+	}
+	
+	/**
+	 * Get current maximum.
+	 * @param removed rows to skip
+	 * @return pointer to value or NULL if there are no rows.
+	 */
+	const V* get(const std::vector<T>& rows, const tombstones& removed)
+	{
+		if (!valid_)
+		{
+			valid_ = true;
+			empty_ = true;
+			for (std::size_t i = 0, n = rows.size(); i < n; ++i)
+			{
+				if (!removed.test(i))
+					push(rows[i]);
+			}
+		}
+		return empty_ ? NULL : &value_;
+	}
+	
+	/**
+	 * Set maximum computed elsewhere.
+	 * @param value maximum or NULL if there are no rows
+	 */
+	void reset(const V* value)
+	{
+		valid_ = true;
+		empty_ = !value;
+		if (value)
+			value_ = *value;
+	}
+	
+private:
+	void push(const T& row)
+	{
+		const V& v = (row.*field_).value_;
+		if (empty_ || value_ < v)
+		{
+			value_ = v;
+			empty_ = false;
+		}
+	}
+};
+
+/**
+ * Aggregate over whole set maintained with every insert and update.
+ * State of aggregate A (its state_type) gets value of every new row.
+ * Old value of changed row is kept until the row is updated, so
+ * expressions evaluated by update still see it.
+ */
+template <typename T /* Table */, typename A /* Aggregate */>
+struct materialized_aggregate: abstract_observer<T>
+{
+	typedef typename A::state_type state_type;
+	typedef typename A::result_type result_type;
+	typedef typename state_type::value_type value_type;
+	
+	A aggregate_;
+	state_type state_;
+	
+	/* Old values of rows being updated */
+	std::unordered_map<std::size_t, value_type> updating_;
+	
+	materialized_aggregate(const A& agg):
+		aggregate_(agg), state_(agg) {}
+	
+	virtual void load(const std::vector<T>& rows)
+	{
+		state_ = state_type(aggregate_);
+		for (typename std::vector<T>::const_iterator it(rows.begin()),
+			end(rows.end()); it != end; ++it)
+		{
+			state_.add(state_.value(*it));
+		}
+	}
+	
+	virtual void inserted(std::size_t, const T& row)
+	{
+		state_.add(state_.value(row));
+	}
+	
+	virtual void updating(std::size_t pos, const T& row)
+	{
+		updating_.insert(std::make_pair(pos, state_.value(row)));
+	}
+	
+	virtual void updated(std::size_t pos, const T& row)
+	{
+		typename std::unordered_map<std::size_t, value_type>::iterator it(updating_.find(pos));
+		state_.remove(it->second);
+		updating_.erase(it);
+		state_.add(state_.value(row));
+	}
+	
+	virtual void removed(std::size_t, const T& row)
+	{
+		state_.remove(state_.value(row));
+	}
+	
+	result_type result() const
+	{
+		return state_.result();
+	}
+};
+
+/**
+ * Aggregate maintained separately for every value of key field.
+ * Groups are created by first row with new key and dropped when
+ * their last row changes key.
+ */
+template <typename K /* Key */, typename T /* Table */, typename A /* Aggregate */>
+struct materialized_group: abstract_observer<T>
+{
+	typedef typename A::state_type state_type;
+	typedef typename A::result_type result_type;
+	typedef typename state_type::value_type value_type;
+	
+	/* Number of rows and state of group */
+	typedef std::unordered_map<K, std::pair<std::size_t, state_type> > groups_t;
+	
+	field<K> T::* key_;
+	A aggregate_;
+	state_type reader_; /* Reads values of rows */
+	groups_t groups_;
+	
+	/* Old keys and values of rows being updated */
+	std::unordered_map<std::size_t, std::pair<K, value_type> > updating_;
+	
+	materialized_group(field<K> T::* key, const A& agg):
+		key_(key), aggregate_(agg), reader_(agg) {}
+	
+	virtual void load(const std::vector<T>& rows)
+	{
+		groups_.clear();
+		for (typename std::vector<T>::const_iterator it(rows.begin()),
+			end(rows.end()); it != end; ++it)
+		{
+			add(*it);
+		}
+	}
+	
+	virtual void inserted(std::size_t, const T& row)
+	{
+		add(row);
+	}
+	
+	virtual void updating(std::size_t pos, const T& row)
+	{
+		updating_.insert(std::make_pair(pos,
+			std::make_pair((row.*key_).value_, reader_.value(row))));
+	}
+	
+	virtual void updated(std::size_t pos, const T& row)
+	{
+		typename std::unordered_map<std::size_t, std::pair<K, value_type> >::iterator
+			old(updating_.find(pos));
+		remove(old->second.first, old->second.second);
+		updating_.erase(old);
+		add(row);
+	}
+	
+	virtual void removed(std::size_t, const T& row)
+	{
+		remove((row.*key_).value_, reader_.value(row));
+	}
+	
+	/**
+	 * Result of aggregate for given key.
+	 * Key without rows gives result of aggregate over no rows.
+	 */
+	result_type result(const K& key) const
+	{
+		typename groups_t::const_iterator it(groups_.find(key));
+		if (it == groups_.end())
+			return state_type(aggregate_).result();
+		return it->second.second.result();
+	}
+	
+	/* Number of groups */
+	std::size_t size() const
+	{
+		return groups_.size();
+	}
+	
+private:
+	void add(const T& row)
+	{
+		const K& key = (row.*key_).value_;
+		typename groups_t::iterator it(groups_.find(key));
+		if (it == groups_.end())
+			it = groups_.insert(std::make_pair(key,
+				std::make_pair(std::size_t(0), state_type(aggregate_)))).first;
+		++it->second.first;
+		it->second.second.add(reader_.value(row));
+	}
+	
+	void remove(const K& key, const value_type& value)
+	{
+		typename groups_t::iterator it(groups_.find(key));
+		it->second.second.remove(value);
+		if (--it->second.first == 0)
+			groups_.erase(it);
+	}
+};
+
+/* Rows in one chunk of set snapshot */
+enum { snapshot_chunk_rows = 4096 };
+
+/**
+ * Chunk of rows shared by versions of set. Rows are only appended past
+ * the size seen by published versions, so readers never see them
+ * change. Changed chunk is copied instead.
+ */
+template <typename T /* Table */>
+struct snapshot_chunk
+{
+	snapshot_chunk(): size_(0) {}
+	
+	~snapshot_chunk()
+	{
+		for (std::size_t i = 0; i < size_; ++i)
+			rows()[i].~T();
+	}
+	
+	void push_back(const T& row)
+	{
+		new (&rows()[size_]) T(row);
+		++size_;
+	}
+	
+	bool full() const { return size_ == snapshot_chunk_rows; }
+	
+	const T& operator[](std::size_t pos) const
+	{
+		return reinterpret_cast<const T*>(&storage_)[pos];
+	}
+	
+private:
+	snapshot_chunk(const snapshot_chunk&);
+	snapshot_chunk& operator=(const snapshot_chunk&);
+	
+	T* rows() { return reinterpret_cast<T*>(&storage_); }
+	
+	typename std::aligned_storage<sizeof(T) * snapshot_chunk_rows, alignof(T)>::type storage_;
+	std::size_t size_; /* Written and read only by writer */
+};
+
+/**
+ * Chunks of set, shared by versions. Slots past chunks seen by published
+ * versions are filled in place, so appending rows does not copy chunks
+ * of set. Array is copied when it is full, or when chunks seen by
+ * readers are replaced.
+ */
+template <typename T /* Table */>
+struct snapshot_chunks
+{
+	typedef std::shared_ptr<snapshot_chunk<T> > chunk_ptr;
+	
+	explicit snapshot_chunks(std::size_t capacity):
+		slots_(new chunk_ptr[capacity]), capacity_(capacity) {}
+	
+	/* Copy of first count chunks, with room for given number of them */
+	snapshot_chunks(const snapshot_chunks& other, std::size_t count, std::size_t capacity):
+		slots_(new chunk_ptr[capacity]), capacity_(capacity)
+	{
+		std::copy(other.slots_.get(), other.slots_.get() + count, slots_.get());
+	}
+	
+	std::unique_ptr<chunk_ptr[]> slots_;
+	std::size_t capacity_;
+	
+private:
+	snapshot_chunks(const snapshot_chunks&);
+	snapshot_chunks& operator=(const snapshot_chunks&);
+};
+
+/* Published version of set: its chunks, number of rows and removed rows */
+template <typename T /* Table */>
+struct snapshot_version
+{
+	snapshot_version(const std::shared_ptr<const snapshot_chunks<T> >& chunks,
+		std::size_t size, const std::shared_ptr<const tombstones>& removed):
+		chunks_(chunks), size_(size), removed_(removed) {}
+	
+	std::shared_ptr<const snapshot_chunks<T> > chunks_;
+	std::size_t size_;
+	std::shared_ptr<const tombstones> removed_;
+};
+
+/**
+ * Consistent read-only version of set. It can be read on any thread
+ * without locks, while the set is changed. Version is freed when last
+ * snapshot which refers to it is gone.
+ */
+template <typename T /* Table */>
+struct set_snapshot
+{
+	typedef std::vector<T> container_type;
+	
+	struct iterator
+	{
+		typedef std::forward_iterator_tag iterator_category;
+		typedef T value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const T* pointer;
+		typedef const T& reference;
+		
+		iterator(const set_snapshot* snapshot, std::size_t pos):
+			snapshot_(snapshot), pos_(pos)
+		{
+			skip();
+		}
+		
+		const T& operator*() const { return (*snapshot_)[pos_]; }
+		const T* operator->() const { return &**this; }
+		
+		iterator& operator++()
+		{
+			++pos_;
+			skip();
+			return *this;
+		}
+		
+		bool operator==(const iterator& other) const { return pos_ == other.pos_; }
+		bool operator!=(const iterator& other) const { return pos_ != other.pos_; }
+		
+	private:
+		void skip()
+		{
+			while (pos_ < snapshot_->rows() && snapshot_->removed(pos_))
+				++pos_;
+		}
+		
+		const set_snapshot* snapshot_;
+		std::size_t pos_;
+	};
+	
+	set_snapshot() {}
+	
+	set_snapshot(const std::shared_ptr<const snapshot_version<T> >& version):
+		version_(version) {}
+	
+	/* Number of rows, without removed ones */
+	std::size_t size() const
+	{
+		return version_ ? version_->size_ - version_->removed_->count() : 0;
+	}
+	
+	/* Row at given position in set, which may be removed one */
+	const T& operator[](std::size_t pos) const
+	{
+		return (*version_->chunks_->slots_[pos / snapshot_chunk_rows])[pos % snapshot_chunk_rows];
+	}
+	
+	/* Row at given position was removed? */
+	bool removed(std::size_t pos) const
+	{
+		return version_->removed_->test(pos);
+	}
+	
+	iterator begin() const { return iterator(this, 0); }
+	iterator end() const { return iterator(this, rows()); }
+	
+	/**
+	 * Copy rows matching expression. Expression must not read other
+	 * rows of set, like MAX() does.
+	 */
+	template <typename F>
+	container_type filter(F f) const
+	{
+		container_type result;
+		typename plan<F>::type kernel(plan<F>::make(f));
+		for (std::size_t i = 0, n = rows(); i < n; ++i)
+		{
+			/* Kernels only read rows */
+			if (!removed(i) && kernel(const_cast<T*>(&(*this)[i])))
+				result.push_back((*this)[i]);
+		}
+		return result;
+	}
+	
+	/* Number of rows matching expression */
+	template <typename F>
+	std::size_t count(F f) const
+	{
+		std::size_t total = 0;
+		typename plan<F>::type kernel(plan<F>::make(f));
+		for (std::size_t i = 0, n = rows(); i < n; ++i)
+		{
+			if (!removed(i) && kernel(const_cast<T*>(&(*this)[i])))
+				++total;
+		}
+		return total;
+	}
+	
+private:
+	/* Number of rows, with removed ones */
+	std::size_t rows() const
+	{
+		return version_ ? version_->size_ : 0;
+	}
+	
+	std::shared_ptr<const snapshot_version<T> > version_;
+};
+
+/**
+ * Publishes versions of set for snapshots. New rows are appended to
+ * last chunk, changed chunks are copied when change is complete, and
+ * new version is published atomically. Loaded rows are published when
+ * change is complete too, so removed rows never show up.
+ * Versions share chunks of set, so publishing after put() costs the
+ * same for any size of set.
+ */
+template <typename T /* Table */>
+struct snapshot_publisher: abstract_observer<T>
+{
+	typedef typename snapshot_chunks<T>::chunk_ptr chunk_ptr;
+	
+	/* Chunks of empty set */
+	enum { initial_chunks = 16 };
+	
+	snapshot_publisher():
+		rows_(NULL), chunks_(new snapshot_chunks<T>(initial_chunks)), count_(0),
+		removed_(new tombstones()) {}
+	
+	virtual void load(const std::vector<T>& rows)
+	{
+		rows_ = &rows;
+		chunks_.reset(new snapshot_chunks<T>(std::max<std::size_t>(initial_chunks,
+			(rows.size() + snapshot_chunk_rows - 1) / snapshot_chunk_rows)));
+		count_ = 0;
+		dirty_.clear();
+		removed_.reset(new tombstones());
+		for (typename std::vector<T>::const_iterator it(rows.begin()),
+			end(rows.end()); it != end; ++it)
+		{
+			append(*it);
+		}
+	}
+	
+	virtual void inserted(std::size_t, const T& row)
+	{
+		append(row);
+	}
+	
+	virtual void updated(std::size_t pos, const T&)
+	{
+		dirty_.insert(pos / snapshot_chunk_rows);
+	}
+	
+	/* Removed rows are copied, published versions share them */
+	virtual void removed(std::size_t pos, const T&)
+	{
+		if (removed_.use_count() != 1)
+			removed_.reset(new tombstones(*removed_));
+		removed_->set(pos);
+	}
+	
+	virtual void committed()
+	{
+		/* Readers may see chunks which are replaced */
+		if (!dirty_.empty())
+			chunks_.reset(new snapshot_chunks<T>(*chunks_, count_, chunks_->capacity_));
+		for (std::set<std::size_t>::iterator it(dirty_.begin()),
+			end(dirty_.end()); it != end; ++it)
+		{
+			chunk_ptr copy(new snapshot_chunk<T>());
+			for (std::size_t i = *it * snapshot_chunk_rows,
+				n = std::min(rows_->size(), i + snapshot_chunk_rows); i < n; ++i)
+			{
+				copy->push_back((*rows_)[i]);
+			}
+			chunks_->slots_[*it] = copy;
+		}
+		dirty_.clear();
+		std::shared_ptr<const snapshot_version<T> > version(
+			new snapshot_version<T>(chunks_, rows_->size(), removed_));
+		std::atomic_store(&current_, version);
+	}
+	
+	/* Latest published version, safe to call on any thread */
+	set_snapshot<T> snapshot() const
+	{
+		return set_snapshot<T>(std::atomic_load(&current_));
+	}
+	
+private:
+	void append(const T& row)
+	{
+		if (!count_ || chunks_->slots_[count_ - 1]->full())
+		{
+			if (count_ == chunks_->capacity_)
+				chunks_.reset(new snapshot_chunks<T>(*chunks_, count_, 2 * count_));
+			chunks_->slots_[count_++].reset(new snapshot_chunk<T>());
+		}
+		chunks_->slots_[count_ - 1]->push_back(row);
+	}
+	
+	const std::vector<T>* rows_;
+	std::shared_ptr<snapshot_chunks<T> > chunks_; /* Chunks of writer */
+	std::size_t count_; /* Chunks in use */
+	std::set<std::size_t> dirty_; /* Chunks to copy */
+	std::shared_ptr<tombstones> removed_; /* Shared with last version */
+	std::shared_ptr<const snapshot_version<T> > current_;
+};
+
+/**
+ * Pool of small blocks of memory. Freed blocks are kept in free list
+ * of their size and reused, memory is returned only when pool is
+ * destroyed. Used for nodes of containers which allocate one node per
+ * element.
+ */
+struct slab_pool
+{
+	enum
+	{
+		granularity = 16, /* Sizes are rounded up to it */
+		max_size = 256, /* Bigger blocks are allocated with new */
+		slab_size = 64 * 1024
+	};
+	
+	slab_pool(): free_(max_size / granularity, NULL), used_(slab_size) {}
+	
+	~slab_pool()
+	{
+		for (std::vector<char*>::iterator it(slabs_.begin()), end(slabs_.end()); it != end; ++it)
+			::operator delete(*it);
+	}
+	
+	void* allocate(std::size_t size)
+	{
+		if (size > max_size)
+			return ::operator new(size);
+		std::size_t cls = (size + granularity - 1) / granularity - 1;
+		if (free_[cls])
+		{
+			node* block = free_[cls];
+			free_[cls] = block->next_;
+			return block;
+		}
+		std::size_t rounded = (cls + 1) * granularity;
+		if (used_ + rounded > slab_size)
+		{
+			slabs_.push_back(static_cast<char*>(::operator new(slab_size)));
+			used_ = 0;
+		}
+		void* block = slabs_.back() + used_;
+		used_ += rounded;
+		return block;
+	}
+	
+	void deallocate(void* p, std::size_t size)
+	{
+		if (size > max_size)
+		{
+			::operator delete(p);
+			return;
+		}
+		std::size_t cls = (size + granularity - 1) / granularity - 1;
+		node* block = static_cast<node*>(p);
+		block->next_ = free_[cls];
+		free_[cls] = block;
+	}
+	
+private:
+	slab_pool(const slab_pool&);
+	slab_pool& operator=(const slab_pool&);
+	
+	struct node
+	{
+		node* next_;
+	};
+	
+	std::vector<node*> free_; /* By size class */
+	std::vector<char*> slabs_;
+	std::size_t used_; /* Bytes used in last slab */
+};
+
+/**
+ * Allocator of single objects from slab pool. Arrays and allocators
+ * without pool use new.
+ */
+template <typename T>
+struct slab_allocator
+{
+	typedef T value_type;
+	
+	template <typename U>
+	struct rebind
+	{
+		typedef slab_allocator<U> other;
+	};
+	
+	slab_allocator(slab_pool* pool = NULL): pool_(pool) {}
+	
+	template <typename U>
+	slab_allocator(const slab_allocator<U>& other): pool_(other.pool_) {}
+	
+	T* allocate(std::size_t n)
+	{
+		if (n != 1 || !pool_)
+			return static_cast<T*>(::operator new(n * sizeof(T)));
+		return static_cast<T*>(pool_->allocate(sizeof(T)));
+	}
+	
+	void deallocate(T* p, std::size_t n)
+	{
+		if (n != 1 || !pool_)
+			::operator delete(p);
+		else
+			pool_->deallocate(p, sizeof(T));
+	}
+	
+	template <typename U>
+	bool operator==(const slab_allocator<U>& other) const { return pool_ == other.pool_; }
+	
+	template <typename U>
+	bool operator!=(const slab_allocator<U>& other) const { return pool_ != other.pool_; }
+	
+	slab_pool* pool_;
+};
+
+/**
+ * Arena for results of queries. Memory is taken from big blocks one
+ * after another and freed all at once by clear(), so results which are
+ * built and dropped together cost almost nothing to allocate.
+ * @code
+ * arena a;
+ * std::vector<person, arena_allocator<person> > result((arena_allocator<person>(&a)));
+ * persons.filter(F(&person::id) > 1, result);
+ * @endcode
+ */
+struct arena
+{
+	enum { block_size = 256 * 1024 };
+	
+	arena(): used_(block_size), size_(block_size) {}
+	
+	~arena()
+	{
+		release();
+	}
+	
+	void* allocate(std::size_t size, std::size_t align)
+	{
+		std::size_t offset = (used_ + align - 1) / align * align;
+		if (blocks_.empty() || offset + size > size_)
+		{
+			size_ = std::max<std::size_t>(block_size, size + align);
+			blocks_.push_back(static_cast<char*>(::operator new(size_)));
+			offset = 0;
+		}
+		used_ = offset + size;
+		return blocks_.back() + offset;
+	}
+	
+	/**
+	 * Free everything allocated. Containers using arena must be gone
+	 * or emptied without deallocation.
+	 */
+	void clear()
+	{
+		release();
+		used_ = size_ = block_size;
+	}
+	
+private:
+	arena(const arena&);
+	arena& operator=(const arena&);
+	
+	void release()
+	{
+		for (std::vector<char*>::iterator it(blocks_.begin()), end(blocks_.end()); it != end; ++it)
+			::operator delete(*it);
+		blocks_.clear();
+	}
+	
+	std::vector<char*> blocks_;
+	std::size_t used_; /* Bytes used in last block */
+	std::size_t size_; /* Size of last block */
+};
+
+/**
+ * Allocator from arena. Deallocation does nothing, memory is freed
+ * with arena.
+ */
+template <typename T>
+struct arena_allocator
+{
+	typedef T value_type;
+	
+	template <typename U>
+	struct rebind
+	{
+		typedef arena_allocator<U> other;
+	};
+	
+	arena_allocator(arena* a): arena_(a) {}
+	
+	template <typename U>
+	arena_allocator(const arena_allocator<U>& other): arena_(other.arena_) {}
+	
+	T* allocate(std::size_t n)
+	{
+		return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+	}
+	
+	void deallocate(T*, std::size_t) {}
+	
+	template <typename U>
+	bool operator==(const arena_allocator<U>& other) const { return arena_ == other.arena_; }
+	
+	template <typename U>
+	bool operator!=(const arena_allocator<U>& other) const { return arena_ != other.arena_; }
+	
+	arena* arena_;
+};
+
+/**
+ * Index on field. Maps field values to positions of rows in set.
+ */
+template <typename T /* Table */>
+struct abstract_index: abstract_observer<T>
+{
+	abstract_index(): identifies_(false) {}
+	
+	/* Positions of rows with the same key as given row */
+	virtual void find(const T& row, std::vector<std::size_t>& out) = 0;
+	
+	/* Rows equal by operator== have the same key, see dbset::exists() */
+	bool identifies_;
+};
+
+/* Positions of rows with the same key, nodes from slab pool of index */
+typedef std::set<std::size_t, std::less<std::size_t>, slab_allocator<std::size_t> > index_positions;
+
+/**
+ * Common part of indexes. Map is std::map or std::unordered_map with
+ * field value as a key and positions of rows with this value.
+ * Nodes of map and sets of positions are allocated from pool of index.
+ */
+template <typename V /* Value */, typename T /* Table */, typename Map>
+struct index_impl: abstract_index<T>
+{
+	typedef V value_type;
+	typedef Map map_type;
+	typedef index_positions positions_t;
+	
+	field<V> T::* field_;
+	slab_pool slabs_;
+	map_type map_;
+	
+	index_impl(field<V> T::* fld):
+		field_(fld), map_(typename map_type::allocator_type(&slabs_)) {}
+	
+	virtual void load(const std::vector<T>& rows)
+	{
+		map_.clear();
+		for (std::size_t i = 0, n = rows.size(); i < n; ++i)
+			inserted(i, rows[i]);
+	}
+	
+	virtual void inserted(std::size_t pos, const T& row)
+	{
+		const V& key = (row.*field_).value_;
+		typename map_type::iterator it(map_.find(key));
+		if (it == map_.end())
+			it = map_.insert(std::make_pair(key, positions_t(std::less<std::size_t>(),
+				slab_allocator<std::size_t>(&slabs_)))).first;
+		it->second.insert(pos);
+	}
+	
+	virtual void updating(std::size_t pos, const T& row)
+	{
+		typename map_type::iterator it(map_.find((row.*field_).value_));
+		if (it == map_.end())
+			return;
+		it->second.erase(pos);
+		if (it->second.empty())
+			map_.erase(it);
+	}
+	
+	virtual void updated(std::size_t pos, const T& row)
+	{
+		inserted(pos, row);
+	}
+	
+	virtual void removed(std::size_t pos, const T& row)
+	{
+		updating(pos, row);
+	}
+	
+	virtual void find(const T& row, std::vector<std::size_t>& out)
+	{
+		equal((row.*field_).value_, out);
+	}
+	
+	/* Rows with field equal to key */
+	void equal(const V& key, std::vector<std::size_t>& out)
+	{
+		typename map_type::iterator it(map_.find(key));
+		if (it != map_.end())
+			out.insert(out.end(), it->second.begin(), it->second.end());
+	}
+	
+protected:
+	static void copy(typename map_type::iterator first,
+		typename map_type::iterator last, std::vector<std::size_t>& out)
+	{
+		for (; first != last; ++first)
+			out.insert(out.end(), first->second.begin(), first->second.end());
+	}
+};
+
+/**
+ * Hash index. Equality lookups in O(1).
+ */
+template <typename V /* Value */, typename T /* Table */>
+struct hash_index: index_impl<V, T, std::unordered_map<V, index_positions, std::hash<V>,
+	std::equal_to<V>, slab_allocator<std::pair<const V, index_positions> > > >
+{
+	typedef index_impl<V, T, std::unordered_map<V, index_positions, std::hash<V>,
+		std::equal_to<V>, slab_allocator<std::pair<const V, index_positions> > > > base_type;
+	
+	hash_index(field<V> T::* fld): base_type(fld) {}
+};
+
+/**
+ * Ordered index. Equality and range lookups in O(log n).
+ */
+template <typename V /* Value */, typename T /* Table */>
+struct ordered_index: index_impl<V, T, std::map<V, index_positions, std::less<V>,
+	slab_allocator<std::pair<const V, index_positions> > > >
+{
+	typedef index_impl<V, T, std::map<V, index_positions, std::less<V>,
+		slab_allocator<std::pair<const V, index_positions> > > > base_type;
+	
+	ordered_index(field<V> T::* fld): base_type(fld) {}
+	
+	/* Rows with field lower than key */
+	void less(const V& key, std::vector<std::size_t>& out)
+	{
+		base_type::copy(this->map_.begin(), this->map_.lower_bound(key), out);
+	}
+	
+	/* Rows with field greater than key */
+	void greater(const V& key, std::vector<std::size_t>& out)
+	{
+		base_type::copy(this->map_.upper_bound(key), this->map_.end(), out);
+	}
+};
+
+/**
+ * Index of field with unique or primary key constraint. Field is known
+ * only by its schema, so values are hashed and compared through
+ * abstract_field, and one index serves fields of any type.
+ */
+template <typename T>
+struct unique_index: abstract_index<T>
+{
+	typedef std::unordered_multimap<std::size_t, std::size_t> map_type;
+	
+	field_schema* schema_;
+	bool primary_; /* Field is primary key */
+	const std::vector<T>* rows_;
+	map_type map_; /* Hash of value to position of row */
+	
+	unique_index(field_schema* fs, bool primary):
+		schema_(fs), primary_(primary), rows_(NULL)
+	{
+		this->identifies_ = true;
+	}
+	
+	virtual void load(const std::vector<T>& rows)
+	{
+		rows_ = &rows;
+		map_.clear();
+		map_.reserve(rows.size());
+		for (std::size_t i = 0, n = rows.size(); i < n; ++i)
+			inserted(i, rows[i]);
+	}
+	
+	virtual void inserted(std::size_t pos, const T& row)
+	{
+		map_.insert(std::make_pair(value(row)->hash(), pos));
+	}
+	
+	virtual void updating(std::size_t pos, const T& row)
+	{
+		std::pair<map_type::iterator, map_type::iterator> range(
+			map_.equal_range(value(row)->hash()));
+		for (map_type::iterator it(range.first); it != range.second; ++it)
+		{
+			if (it->second == pos)
+			{
+				map_.erase(it);
+				return;
+			}
+		}
+	}
+	
+	virtual void updated(std::size_t pos, const T& row)
+	{
+		inserted(pos, row);
+	}
+	
+	virtual void removed(std::size_t pos, const T& row)
+	{
+		updating(pos, row);
+	}
+	
+	virtual void reserve(std::size_t n)
+	{
+		map_.reserve(n);
+	}
+	
+	virtual void find(const T& row, std::vector<std::size_t>& out)
+	{
+		abstract_field* v = value(row);
+		std::pair<map_type::iterator, map_type::iterator> range(map_.equal_range(v->hash()));
+		for (map_type::iterator it(range.first); it != range.second; ++it)
+		{
+			if (*value((*rows_)[it->second]) == *v)
+				out.push_back(it->second);
+		}
+	}
+	
+	/**
+	 * Position of row with given value of field.
+	 * @return false if there is no such row
+	 */
+	template <typename V>
+	bool find(const V& key, std::size_t& pos)
+	{
+		std::pair<map_type::iterator, map_type::iterator> range(
+			map_.equal_range(field_hash<V>::hash(key)));
+		for (map_type::iterator it(range.first); it != range.second; ++it)
+		{
+			field<V>* f = dynamic_cast<field<V>*>(value((*rows_)[it->second]));
+			if (f && f->value_ == key)
+			{
+				pos = it->second;
+				return true;
+			}
+		}
+		return false;
+	}
+	
+	/* Throw if value of row is in set already */
+	void check(const T& row)
+	{
+		std::vector<std::size_t> found;
+		find(row, found);
+		if (!found.empty())
+			violation(row);
+	}
+	
+	/* Throw if value of row at any of given positions is repeated */
+	void check(const std::vector<std::size_t>& positions)
+	{
+		for (std::vector<std::size_t>::const_iterator pos(positions.begin()),
+			last(positions.end()); pos != last; ++pos)
+		{
+			std::vector<std::size_t> found;
+			find((*rows_)[*pos], found);
+			if (found.size() > 1)
+				violation((*rows_)[*pos]);
+		}
+	}
+	
+	/**
+	 * Throw if rows changed at given positions would repeat value of
+	 * other row, or of each other.
+	 * @param positions sorted positions of changed rows
+	 */
+	void check(const std::vector<T>& changed, const std::vector<std::size_t>& positions)
+	{
+		std::unordered_multimap<std::size_t, const T*> seen;
+		for (typename std::vector<T>::const_iterator row(changed.begin()),
+			last(changed.end()); row != last; ++row)
+		{
+			abstract_field* v = value(*row);
+			std::size_t h = v->hash();
+			std::pair<map_type::iterator, map_type::iterator> range(map_.equal_range(h));
+			for (map_type::iterator it(range.first); it != range.second; ++it)
+			{
+				if (!std::binary_search(positions.begin(), positions.end(), it->second) &&
+					*value((*rows_)[it->second]) == *v)
+				{
+					violation(*row);
+				}
+			}
+			typedef typename std::unordered_multimap<std::size_t, const T*>::iterator seen_iterator;
+			std::pair<seen_iterator, seen_iterator> same(seen.equal_range(h));
+			for (seen_iterator it(same.first); it != same.second; ++it)
+			{
+				if (*value(*it->second) == *v)
+					violation(*row);
+			}
+			seen.insert(std::make_pair(h, &*row));
+		}
+	}
+	
+private:
+	abstract_field* value(const T& row) const
+	{
+		return schema_->get(const_cast<T*>(&row));
+	}
+	
+	void violation(const T& row) const
+	{
+		std::string text;
+		value(row)->format(text);
+		throw constraint_violation("duplicate value of " + row.tablename() + "." +
+			schema_->name_ + ": " + text);
+	}
+};
+
+template <typename V, typename T>
+std::ptrdiff_t field_id(field<V> T::* fld)
+{
+	std::ptrdiff_t id = 0;
+	std::memcpy(&id, &fld, std::min(sizeof(id), sizeof(fld)));
+	return id;
+}
+
+/**
+ * Canonical key of query expression. Bound values and fields are
+ * appended by every node, type of whole expression is added by cache.
+ * Specialized for expressions which can be cached, everything else
+ * (like aggregates, which read other rows) is never cached.
+ */
+template <typename E, typename = void>
+struct query_key
+{
+	/**
+	 * @param fields fields read by expression
+	 * @return false if expression can not be cached
+	 */
+	static bool append(const E&, std::string&, field_ids&)
+	{
+		return false;
+	}
+};
+
+/**
+ * Expression which reads only the row it is evaluated with, so chunks
+ * of set can be evaluated by worker pool. Specialized for fields, values
+ * and operators, everything else (like aggregates, which read the whole
+ * set and see changes of rows evaluated before) runs on calling thread.
+ */
+template <typename E, typename>
+struct row_local { enum { value = 0 }; };
+
+/**
+ * Fields changed by update statement. Specialized for assignments,
+ * statements it does not know may change any field.
+ */
+template <typename E>
+struct assigned_fields
+{
+	/* @return false if any field may change */
+	static bool collect(const E&, field_ids&)
+	{
+		return false;
+	}
+};
+
+/**
+ * Results of filter() kept up to date with changes of set. Row put into
+ * set is appended to results it matches, changed row is added, copied
+ * again or dropped, removed row is dropped. Changed rows are matched
+ * only against queries reading fields changed by update.
+ */
+template <typename T /* Table */>
+struct query_cache: abstract_observer<T>
+{
+	struct entry
+	{
+		field_ids fields_; /* Read by query */
+		std::function<bool(T*)> match_;
+		std::vector<std::size_t> positions_; /* Ascending */
+		std::vector<T> rows_;
+	};
+	
+	typedef std::unordered_map<std::string, entry> entries_t;
+	
+	std::size_t capacity_; /* Maximum number of results */
+	entries_t entries_;
+	field_ids written_; /* Fields changed by update in progress */
+	bool any_written_; /* Update may change any field */
+	
+	query_cache(std::size_t capacity):
+		capacity_(capacity), any_written_(true) {}
+	
+	/* Positions of rows may change, results are dropped */
+	virtual void load(const std::vector<T>&)
+	{
+		entries_.clear();
+	}
+	
+	virtual void inserted(std::size_t pos, const T& row)
+	{
+		for (typename entries_t::iterator it(entries_.begin()),
+			end(entries_.end()); it != end; ++it)
+		{
+			if (it->second.match_(const_cast<T*>(&row)))
+			{
+				it->second.positions_.push_back(pos);
+				it->second.rows_.push_back(row);
+			}
+		}
+	}
+	
+	virtual void updated(std::size_t pos, const T& row)
+	{
+		for (typename entries_t::iterator it(entries_.begin()),
+			end(entries_.end()); it != end; ++it)
+		{
+			entry& e(it->second);
+			std::vector<std::size_t>::iterator found(
+				std::lower_bound(e.positions_.begin(), e.positions_.end(), pos));
+			bool cached = found != e.positions_.end() && *found == pos;
+			bool matches = reads_written(e) ? e.match_(const_cast<T*>(&row)) : cached;
+			std::size_t i = found - e.positions_.begin();
+			if (cached && matches)
+				e.rows_[i] = row;
+			else if (cached)
+			{
+				e.positions_.erase(found);
+				e.rows_.erase(e.rows_.begin() + i);
+			}
+			else if (matches)
+			{
+				e.positions_.insert(found, pos);
+				e.rows_.insert(e.rows_.begin() + i, row);
+			}
+		}
+	}
+	
+	virtual void removed(std::size_t pos, const T&)
+	{
+		for (typename entries_t::iterator it(entries_.begin()),
+			end(entries_.end()); it != end; ++it)
+		{
+			entry& e(it->second);
+			std::vector<std::size_t>::iterator found(
+				std::lower_bound(e.positions_.begin(), e.positions_.end(), pos));
+			if (found != e.positions_.end() && *found == pos)
+			{
+				e.rows_.erase(e.rows_.begin() + (found - e.positions_.begin()));
+				e.positions_.erase(found);
+			}
+		}
+	}
+	
+	/* Next updates change only fields assigned by stmt */
+	template <typename F>
+	void writing(const F& stmt)
+	{
+		written_.clear();
+		any_written_ = !assigned_fields<F>::collect(stmt, written_);
+	}
+	
+	/* Update is complete, any field may change again */
+	void written()
+	{
+		written_.clear();
+		any_written_ = true;
+	}
+	
+	/**
+	 * Copy cached rows matching expression.
+	 * @param key set to key of expression, empty if it can not be cached
+	 * @return false if rows are not cached
+	 */
+	template <typename F>
+	bool find(const F& f, std::string& key, std::vector<T>& out)
+	{
+		field_ids fields;
+		key = typeid(F).name();
+		if (!query_key<F>::append(f, key, fields))
+		{
+			key.clear();
+			return false;
+		}
+		typename entries_t::iterator it(entries_.find(key));
+		if (it == entries_.end())
+			return false;
+		out.insert(out.end(), it->second.rows_.begin(), it->second.rows_.end());
+		return true;
+	}
+	
+	/**
+	 * Remember rows matching expression with key given by find().
+	 * @param positions ascending positions of rows
+	 */
+	template <typename F>
+	void store(const F& f, const std::string& key,
+		const std::vector<std::size_t>& positions, const std::vector<T>& rows)
+	{
+		if (entries_.size() >= capacity_)
+			entries_.clear();
+		entry& e(entries_[key]);
+		std::string ignored;
+		e.fields_.clear();
+		query_key<F>::append(f, ignored, e.fields_);
+		typename plan<F>::type kernel(plan<F>::make(f));
+		e.match_ = [kernel](T* row) mutable { return bool(kernel(row)); };
+		e.positions_ = positions;
+		e.rows_ = rows;
+	}
+	
+private:
+	bool reads_written(const entry& e) const
+	{
+		if (any_written_)
+			return true;
+		for (field_ids::const_iterator it(e.fields_.begin()), end(e.fields_.end()); it != end; ++it)
+		{
+			if (std::find(written_.begin(), written_.end(), *it) != written_.end())
+				return true;
+		}
+		return false;
+	}
+};
+
+/**
+ * Find rows which may match expression using indexes of set.
+ * Specialized for expressions which can use an index, everything
+ * else falls back to full scan.
+ */
+template <typename F /* Expression */, typename T /* Table */>
+struct index_lookup
+{
+	/**
+	 * @return false if no index could be used, otherwise true and
+	 * superset of matching positions in `out`.
+	 */
+	static bool find(dbset<T>&, F&, std::vector<std::size_t>&)
+	{
+		return false;
+	}
+};
+
+/**
+ * Selection bitmap. Bit is set for every selected row of set.
+ */
+struct selection
+{
+	typedef std::uint64_t word_type;
+	
+	explicit selection(std::size_t size = 0):
+		words_((size + 63) / 64, 0), size_(size) {}
+	
+	bool test(std::size_t pos) const
+	{
+		return (words_[pos / 64] >> (pos % 64)) & 1;
+	}
+	
+	void set(std::size_t pos)
+	{
+		words_[pos / 64] |= word_type(1) << (pos % 64);
+	}
+	
+	selection& operator&=(const selection& other)
+	{
+		for (std::size_t i = 0, n = words_.size(); i < n; ++i)
+			words_[i] &= other.words_[i];
+		return *this;
+	}
+	
+	selection& operator|=(const selection& other)
+	{
+		for (std::size_t i = 0, n = words_.size(); i < n; ++i)
+			words_[i] |= other.words_[i];
+		return *this;
+	}
+	
+	/* Unselect removed rows */
+	selection& operator-=(const tombstones& removed)
+	{
+		for (std::size_t i = 0, n = std::min(words_.size(), removed.words_.size()); i < n; ++i)
+			words_[i] &= ~removed.words_[i];
+		return *this;
+	}
+	
+	/* Number of selected rows */
+	std::size_t count() const
+	{
+		std::size_t total = 0;
+		for (std::size_t i = 0, n = words_.size(); i < n; ++i)
+			total += __builtin_popcountll(words_[i]);
+		return total;
+	}
+	
+	/* Append positions of selected rows in ascending order */
+	void positions(std::vector<std::size_t>& out) const
+	{
+		for (std::size_t i = 0, n = words_.size(); i < n; ++i)
+		{
+			for (word_type word = words_[i]; word; word &= word - 1)
+				out.push_back(i * 64 + __builtin_ctzll(word));
+		}
+	}
+	
+	std::vector<word_type> words_;
+	std::size_t size_;
+};
+
+/**
+ * SIMD comparison of integers, specialized for every operator.
+ */
+template <typename Op>
+struct compare_ints;
+
+template <>
+struct compare_ints<std::equal_to<int> >
+{
+#if defined(__AVX2__)
+	static __m256i apply(__m256i v, __m256i k) { return _mm256_cmpeq_epi32(v, k); }
+#elif defined(__SSE2__)
+	static __m128i apply(__m128i v, __m128i k) { return _mm_cmpeq_epi32(v, k); }
+#endif
+};
+
+template <>
+struct compare_ints<std::not_equal_to<int> >
+{
+#if defined(__AVX2__)
+	static __m256i apply(__m256i v, __m256i k)
+	{
+		return _mm256_xor_si256(_mm256_cmpeq_epi32(v, k), _mm256_set1_epi32(-1));
+	}
+#elif defined(__SSE2__)
+	static __m128i apply(__m128i v, __m128i k)
+	{
+		return _mm_xor_si128(_mm_cmpeq_epi32(v, k), _mm_set1_epi32(-1));
+	}
+#endif
+};
+
+template <>
+struct compare_ints<std::less<int> >
+{
+#if defined(__AVX2__)
+	static __m256i apply(__m256i v, __m256i k) { return _mm256_cmpgt_epi32(k, v); }
+#elif defined(__SSE2__)
+	static __m128i apply(__m128i v, __m128i k) { return _mm_cmplt_epi32(v, k); }
+#endif
+};
+
+template <>
+struct compare_ints<std::greater<int> >
+{
+#if defined(__AVX2__)
+	static __m256i apply(__m256i v, __m256i k) { return _mm256_cmpgt_epi32(v, k); }
+#elif defined(__SSE2__)
+	static __m128i apply(__m128i v, __m128i k) { return _mm_cmpgt_epi32(v, k); }
+#endif
+};
+
+/**
+ * Select values which compare with key. Uses AVX2 or SSE2 when compiler
+ * targets them and scalar loop for the rest.
+ * @param out selection with at least n bits, all cleared
+ */
+template <typename Op>
+void select_ints(const int* values, std::size_t n, int key, selection& out)
+{
+	std::size_t i = 0;
+#if defined(__AVX2__)
+	__m256i k = _mm256_set1_epi32(key);
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256i m = compare_ints<Op>::apply(
+			_mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i)), k);
+		selection::word_type bits = unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(m)));
+		out.words_[i / 64] |= bits << (i % 64);
+	}
+#elif defined(__SSE2__)
+	__m128i k = _mm_set1_epi32(key);
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128i m = compare_ints<Op>::apply(
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i)), k);
+		selection::word_type bits = unsigned(_mm_movemask_ps(_mm_castsi128_ps(m)));
+		out.words_[i / 64] |= bits << (i % 64);
+	}
+#endif
+	Op op;
+	for (; i < n; ++i)
+	{
+		if (op(values[i], key))
+			out.set(i);
+	}
+}
+
+/**
+ * Evaluate kernel over columns of set at once, instead of row by row.
+ * Specialized for kernels which can be vectorized. Set is dbset or
+ * mapped_set, see int_column().
+ */
+template <typename K /* Kernel */, typename T /* Table */>
+struct vector_scan
+{
+	/**
+	 * @return false if kernel can not be evaluated on columns of set,
+	 * otherwise true and rows matching kernel in `out`.
+	 */
+	template <typename S>
+	static bool select(S&, K&, selection&)
+	{
+		return false;
+	}
+};
+
+template <typename T, typename F>
+struct query_view;
+
+template <typename T, typename F, typename K>
+struct ordered_view;
+
+template <typename T1>
+struct value_impl;
+
+template <typename A, typename B, typename V>
+struct join_view;
+
+template <typename T1, typename T2>
+struct eq_impl;
+
+template <typename... A>
+struct aggregate_list;
+
+template <typename T1, typename V = int>
+struct max_impl;
+
+template <typename T, typename F>
+struct field_impl;
+
+/**
+ * Reference to a row stored in set. Expressions evaluated with it
+ * read values from columns when the set has them.
+ */
+template <typename T>
+struct row_ref
+{
+	dbset<T>* set_;
+	std::size_t pos_;
+	
+	row_ref(dbset<T>* set, std::size_t pos): set_(set), pos_(pos) {}
+	
+	T& operator*() const { return set_->rows_[pos_]; }
+	T* operator->() const { return &set_->rows_[pos_]; }
+};
+
+template <typename T>
+struct dbset: abstract_dbset
+{
+	/**
+	 * Rows are stored contiguously. Result sets are vectors too, they
+	 * used to be std::list. References to rows of set are valid only
+	 * until the next change of set.
+	 */
+	typedef std::vector<T> container_type;
+	container_type rows_;
+	
+	typedef cursor_impl<container_type> cursor;
+	
+	typedef std::vector<abstract_observer<T>*> observers_t;
+	observers_t observers_;
+	
+	/* Set in persistent_ of context, or NULL */
+	persistent_set<T>* journal_;
+	
+	/* Observer publishing versions for snapshots, or NULL */
+	snapshot_publisher<T>* publisher_;
+	
+	/* Rows put by last operation of transaction */
+	std::shared_ptr<std::vector<T> > batch_;
+	
+	/* Batches of producers, last pushed first */
+	std::atomic<concurrent_batch<T>*> incoming_;
+	
+	/* Indexes of unique fields, created from schema of table */
+	std::vector<unique_index<T>*> uniques_;
+	table_schema* unique_schema_;
+	
+	/* Rows removed since last compaction */
+	tombstones removed_;
+	
+	/* Live rows returned by all() while some are removed */
+	container_type live_;
+	
+	/* Results of filter(), or NULL */
+	query_cache<T>* cache_;
+	
+	/* Changes remembered to be undone, see record() */
+	struct undo_log
+	{
+		std::size_t size_; /* Rows before changes */
+		std::vector<std::pair<std::size_t, T> > updated_; /* Previous rows */
+		std::vector<std::size_t> removed_;
+		bool compact_; /* Compaction is postponed */
+	};
+	std::unique_ptr<undo_log> undo_;
+	
+	dbset(dbcontext* parent) : abstract_dbset(parent), journal_(NULL), publisher_(NULL),
+		incoming_(NULL), unique_schema_(NULL), cache_(NULL) {}
+	
+	~dbset()
+	{
+		for (concurrent_batch<T>* batch = incoming_; batch; )
+		{
+			concurrent_batch<T>* next = batch->next_;
+			delete batch;
+			batch = next;
+		}
+		for (typename observers_t::iterator it(observers_.begin()),
+			end(observers_.end()); it != end; ++it)
+		{
+			delete *it;
+		}
+	}
+	
+	/**
+	 * Put row into set. Constraints and triggers are evaluated with the
+	 * row, which is then moved into set, so temporary or moved row is
+	 * never copied.
+	 * @throw constraint_violation if unique field repeats, set is not changed
+	 * @throw std::runtime_error if log failed with commit_sync, set is changed
+	 */
+	void put(T t)
+	{
+		if (deferred())
+		{
+			pending().push_back(std::move(t));
+			return;
+		}
+		
+		t.parent_ = this;
+		table_schema* schema = t.schema_;
+		schema->typed(typeid(T));
+		
+		for (table_schema::fields_t::iterator it(schema->fields_.begin()),
+			end(schema->fields_.end()); it != end; ++it)
+		{
+			if (!(*it)->constraint.empty())
+				(*it)->constraint((*it)->get(&t), &t, this);
+		}
+		
+		insert(t);
+		log('I', rows_.size() - 1);
+		finish();
+		sync();
+	}
+	
+	/**
+	 * Construct row from given arguments and put it.
+	 * @code persons.emplace("John", "Smith"); @endcode
+	 */
+	template <typename... Args>
+	void emplace(Args&&... args)
+	{
+		put(T(std::forward<Args>(args)...));
+	}
+	
+	/**
+	 * Put many rows at once. Storage is reserved once and constraints
+	 * are evaluated one field at a time over whole batch. Unique fields
+	 * are then checked for whole batch, against set and each other,
+	 * before any row is inserted. Triggers are evaluated row by row, in
+	 * order, because they may depend on rows inserted before (like MAX),
+	 * so unique fields they write are checked row by row. When any row
+	 * fails, rows inserted before it are taken out again.
+	 * @param first, last range of rows to copy
+	 * @throw constraint_violation if unique field repeats, set is not changed
+	 * @throw std::runtime_error if log failed with commit_sync, set is changed
+	 */
+	template <typename It>
+	void put_range(It first, It last)
+	{
+		put_range(std::vector<T>(first, last));
+	}
+	
+	/**
+	 * Put many rows at once, taking them over without copying.
+	 */
+	void put_range(std::vector<T>&& batch)
+	{
+		if (batch.empty())
+			return;
+		
+		if (deferred())
+		{
+			std::vector<T>& rows = pending();
+			rows.reserve(rows.size() + batch.size());
+			std::move(batch.begin(), batch.end(), std::back_inserter(rows));
+			return;
+		}
+		
+		reserve(rows_.size() + batch.size());
+		
+		for (typename std::vector<T>::iterator row(batch.begin()),
+			last(batch.end()); row != last; ++row)
+		{
+			row->parent_ = this;
+		}
+		
+		table_schema* schema = batch.front().schema_;
+		schema->typed(typeid(T));
+		for (table_schema::fields_t::iterator it(schema->fields_.begin()),
+			end(schema->fields_.end()); it != end; ++it)
+		{
+			if ((*it)->constraint.empty())
+				continue;
+			for (typename std::vector<T>::iterator row(batch.begin()),
+				last(batch.end()); row != last; ++row)
+			{
+				(*it)->constraint((*it)->get(&*row), &*row, this);
+			}
+		}
+		
+		prepare_uniques(schema);
+		const std::vector<std::size_t> none;
+		for (typename std::vector<unique_index<T>*>::iterator it(uniques_.begin()),
+			end(uniques_.end()); it != end; ++it)
+		{
+			if (!(*it)->schema_->triggered_)
+				(*it)->check(batch, none);
+		}
+		
+		finish_guard guard(this);
+		std::size_t first = rows_.size();
+		bool own = !undo_; /* Otherwise transaction undoes whole commit */
+		if (own)
+			record();
+		try
+		{
+			for (typename std::vector<T>::iterator row(batch.begin()),
+				last(batch.end()); row != last; ++row)
+			{
+				insert(*row, true);
+			}
+		}
+		catch (...)
+		{
+			if (own)
+				undo();
+			throw;
+		}
+		if (own)
+			forget();
+		for (std::size_t pos = first, n = rows_.size(); pos < n; ++pos)
+			log('I', pos);
+		sync();
+	}
+	
+	/**
+	 * Publish versions of set for snapshot() after every put(),
+	 * put_range() and update(). Must be called before snapshots are
+	 * taken on other threads.
+	 */
+	void enable_snapshots()
+	{
+		if (publisher_)
+			return;
+		publisher_ = add_observer(new snapshot_publisher<T>());
+		publisher_->committed();
+	}
+	
+	/**
+	 * Keep results of filter() and update them with every change of
+	 * set. Queries comparing fields with values are cached, keyed by
+	 * type of expression and its values.
+	 * @param capacity maximum number of cached queries
+	 */
+	void enable_cache(std::size_t capacity = 1024)
+	{
+		if (!cache_)
+			cache_ = add_observer(new query_cache<T>(capacity));
+	}
+	
+	/**
+	 * Latest complete version of set. Safe to call on any thread while
+	 * set is changed, snapshot itself does not change.
+	 * @return snapshot or empty one if snapshots are not enabled
+	 */
+	set_snapshot<T> snapshot() const
+	{
+		return publisher_ ? publisher_->snapshot() : set_snapshot<T>();
+	}
+	
+	/**
+	 * Save this set in snapshots and write-ahead log of context.
+	 * Must be called before dbcontext::open(). Table must have default
+	 * constructor, rows are read into default constructed ones.
+	 * @param name name of set in files, name of table by default
+	 */
+	void persist(const std::string& name = std::string())
+	{
+		if (journal_)
+			return;
+		journal_ = new persistent_set<T>(this, name.empty() ? T().tablename() : name);
+		parent_->persistent_.push_back(journal_);
+	}
+	
+	/**
+	 * Hand over rows collected by producer. Safe to call on any thread
+	 * without lock, rows are put by next merge().
+	 */
+	void push(std::vector<T>&& rows)
+	{
+		if (rows.empty())
+			return;
+		concurrent_batch<T>* batch = new concurrent_batch<T>();
+		batch->rows_.swap(rows);
+		batch->next_ = incoming_.load(std::memory_order_relaxed);
+		while (!incoming_.compare_exchange_weak(batch->next_, batch,
+			std::memory_order_release, std::memory_order_relaxed));
+	}
+	
+	/**
+	 * Put rows handed over by producers, in order they were pushed.
+	 * Constraints and triggers are evaluated here, on one thread, so
+	 * ids generated by triggers stay unique.
+	 * @return number of merged rows
+	 */
+	std::size_t merge()
+	{
+		concurrent_batch<T>* batch = incoming_.exchange(NULL, std::memory_order_acquire);
+		std::vector<concurrent_batch<T>*> batches;
+		for (; batch; batch = batch->next_)
+			batches.push_back(batch);
+		
+		std::vector<T> rows;
+		for (typename std::vector<concurrent_batch<T>*>::reverse_iterator it(batches.rbegin()),
+			end(batches.rend()); it != end; ++it)
+		{
+			if (rows.empty())
+				rows.swap((*it)->rows_);
+			else
+				std::move((*it)->rows_.begin(), (*it)->rows_.end(), std::back_inserter(rows));
+			delete *it;
+		}
+		std::size_t count = rows.size();
+		put_range(std::move(rows));
+		return count;
+	}
+	
+	/**
+	 * Make room for given number of rows.
+	 */
+	void reserve(std::size_t n)
+	{
+		rows_.reserve(n);
+		for (typename observers_t::iterator it(observers_.begin()),
+			end(observers_.end()); it != end; ++it)
+		{
+			(*it)->reserve(n);
+		}
+	}
+	
+	/**
+	 * Store values of given field in contiguous column.
+	 * Scans will read this field from column instead of rows.
+	 * @param fld pointer to member field
+	 */
+	template <typename V>
+	column<V, T>& add_column(field<V> T::* fld)
+	{
+		column<V, T>* col = find_column(fld);
+		if (!col)
+			col = add_observer(new column<V, T>(fld));
+		return *col;
+	}
+	
+	/**
+	 * Find column of given field.
+	 * @return column or NULL if field is stored only in rows.
+	 */
+	template <typename V>
+	column<V, T>* find_column(field<V> T::* fld)
+	{
+		return find_observer<column<V, T> >(fld);
+	}
+	
+	/**
+	 * Index given field. Index is used by filter(), update() and
+	 * exists() when expression compares this field with a value.
+	 * @code persons.add_index<hash_index>(&person::id, true); @endcode
+	 * @param fld pointer to member field
+	 * @param identifies operator== of rows compares this field, so
+	 * exists() does not look further when index has no equal row
+	 */
+	template <template <typename, typename> class Index, typename V>
+	Index<V, T>& add_index(field<V> T::* fld, bool identifies = false)
+	{
+		Index<V, T>* idx = find_index<Index>(fld);
+		if (!idx)
+			idx = add_observer(new Index<V, T>(fld));
+		idx->identifies_ = idx->identifies_ || identifies;
+		return *idx;
+	}
+	
+	/**
+	 * Find index of given field.
+	 * @return index or NULL if field is not indexed.
+	 */
+	template <template <typename, typename> class Index, typename V>
+	Index<V, T>* find_index(field<V> T::* fld)
+	{
+		return find_observer<Index<V, T> >(fld);
+	}
+	
+	/**
+	 * Maximum value of field in set.
+	 * First call scans the set, then maximum is maintained by put().
+	 * @param fld pointer to member field
+	 * @param empty value returned when set has no rows
+	 */
+	template <typename V>
+	V max_of(field<V> T::* fld, const V& empty = V())
+	{
+		max_aggregate<V, T>* agg = find_observer<max_aggregate<V, T> >(fld);
+		if (!agg)
+			agg = add_observer(new max_aggregate<V, T>(fld));
+		if (!agg->valid_ && pool())
+		{
+			V best;
+			agg->reset(parallel_max(fld, best) ? &best : NULL);
+		}
+		const V* value = agg->get(rows_, removed_);
+		return value ? *value : empty;
+	}
+	
+	/**
+	 * Maintain aggregate over all rows with every put() and update().
+	 * Aggregate expressions evaluated by triggers and updates read
+	 * materialized result instead of scanning the set.
+	 * @code persons.materialize(SUM(F(&person::id))).result() @endcode
+	 * @return materialized aggregate, valid as long as the set
+	 */
+	template <typename A>
+	materialized_aggregate<T, A>& materialize(A agg)
+	{
+		materialized_aggregate<T, A>* m = find_materialized(agg);
+		if (!m)
+			m = add_observer(new materialized_aggregate<T, A>(agg));
+		return *m;
+	}
+	
+	/**
+	 * Maintain aggregate for every value of key field.
+	 * @code persons.materialize(F(&person::second_name), COUNT()).result("Smith") @endcode
+	 * @return materialized groups, valid as long as the set
+	 */
+	template <typename K, typename A>
+	materialized_group<K, T, A>& materialize(field_impl<K, T> key, A agg)
+	{
+		for (typename observers_t::iterator it(observers_.begin()),
+			end(observers_.end()); it != end; ++it)
+		{
+			materialized_group<K, T, A>* m = dynamic_cast<materialized_group<K, T, A>*>(*it);
+			if (m && m->key_ == key.field_ && m->aggregate_.same(agg))
+				return *m;
+		}
+		return *add_observer(new materialized_group<K, T, A>(key.field_, agg));
+	}
+	
+	/**
+	 * Value of aggregate over all rows. Materialized result is used
+	 * when there is one, otherwise rows are scanned.
+	 */
+	template <typename A>
+	typename A::result_type aggregate_of(A agg)
+	{
+		materialized_aggregate<T, A>* m = find_materialized(agg);
+		if (m)
+			return m->result();
+		return compute(agg);
+	}
+	
+	/**
+	 * Compute aggregates over all rows in single pass.
+	 * @code persons.aggregate(COUNT(), SUM(F(&person::id)), AVG(F(&person::id))) @endcode
+	 * @return tuple with result of every aggregate
+	 */
+	template <typename... A>
+	typename aggregate_list<A...>::result_type aggregate(A... aggs)
+	{
+		aggregate_list<A...> list(aggs...);
+		for (std::size_t i = 0, n = rows_.size(); i < n; ++i)
+		{
+			if (!removed_.test(i))
+				list.add(row_ref<T>(this, i));
+		}
+		return list.result();
+	}
+	
+	/**
+	 * Compute aggregates for every value of key field in single pass.
+	 * @code persons.group_by(F(&person::second_name), COUNT()) @endcode
+	 * @return map from key to tuple with result of every aggregate
+	 */
+	template <typename K, typename... A>
+	std::map<K, typename aggregate_list<A...>::result_type> group_by(
+		field_impl<K, T> key, A... aggs)
+	{
+		std::map<K, aggregate_list<A...> > groups;
+		for (std::size_t i = 0, n = rows_.size(); i < n; ++i)
+		{
+			if (!removed_.test(i))
+				group(groups, key, row_ref<T>(this, i), aggs...);
+		}
+		return results(groups);
+	}
+	
+	/**
+	 * This thing simply iterates over rows,
+	 * evaluates expression with value, and if it evaluates to true
+	 * then copy it to 'result set'.
+	 * Indexed fields are looked up instead of scanning all rows.
+	 * @param f operator instance with type of operator_impl.
+	 */
+	template <typename F>
+	container_type filter(F f)
+	{
+		container_type results;
+		std::string key;
+		if (cache_ && cache_->find(f, key, results))
+			return results;
+		if (key.empty())
+		{
+			filter(f, results);
+			return results;
+		}
+		
+		/* Cache positions of rows too, so changes can be followed */
+		std::vector<std::size_t> positions;
+		select(f, positions);
+		results.reserve(positions.size());
+		for (std::vector<std::size_t>::iterator it(positions.begin()),
+			end(positions.end()); it != end; ++it)
+		{
+			results.push_back(rows_[*it]);
+		}
+		cache_->store(f, key, positions, results);
+		return results;
+	}
+	
+	/**
+	 * Append rows matching expression to given container, which may
+	 * be reused or use other allocator, like arena_allocator.
+	 * @return out
+	 */
+	template <typename F, typename C>
+	C& filter(F f, C& out)
+	{
+		std::vector<std::size_t> positions;
+		typename plan<F>::type kernel(plan<F>::make(f));
+		bool exact;
+		
+		if (lookup(f, kernel, positions, exact))
+		{
+			if (exact)
+				out.reserve(out.size() + positions.size());
+			for (std::vector<std::size_t>::iterator it(positions.begin()),
+				end(positions.end()); it != end; ++it)
+			{
+				if (exact || kernel(row_ref<T>(this, *it)))
+					out.push_back(rows_[*it]);
+			}
+			return out;
+		}
+		
+		for (std::size_t i = 0, n = rows_.size(); i < n; ++i)
+		{
+			if (kernel(row_ref<T>(this, i)))
+				out.push_back(rows_[i]);
+		}
+		return out;
+	}
+	
+	/**
+	 * Lazy version of filter(). Returned view evaluates expression
+	 * while iterating and yields references to rows in set, so nothing
+	 * is copied and consumer may stop at any time.
+	 * @code for (person& p : persons.where(F(&person::id) > 1)) ... @endcode
+	 */
+	template <typename F>
+	query_view<T, F> where(F f)
+	{
+		return query_view<T, F>(this, f);
+	}
+	
+	/**
+	 * All rows ordered by field, see query_view::order_by().
+	 * @code for (person& p : persons.order_by(F(&person::id)).offset(20).limit(10)) ... @endcode
+	 */
+	template <typename K>
+	ordered_view<T, value_impl<bool>, K> order_by(field_impl<K, T> key, bool descending = false)
+	{
+		return where(value_impl<bool>(true)).order_by(key, descending);
+	}
+	
+	/**
+	 * Pairs of rows of this set and other one with equal keys.
+	 * Smaller set is hashed, or its hash index is used, and rows of
+	 * the other one are looked up while iterating.
+	 * @code for (auto p : persons.join(events, F(&person::id) == F(&event::person_id))) ... @endcode
+	 */
+	template <typename B, typename V>
+	join_view<T, B, V> join(dbset<B>& other, eq_impl<field_impl<V, T>, field_impl<V, B> > on)
+	{
+		return join_view<T, B, V>(this, on.expr_, &other, on.value_);
+	}
+	
+	/**
+	 * Update rows matching expr... If expr `where` evaluated to true
+	 * then evaluate expr `stmt`
+	 * @throw constraint_violation if unique field would repeat, no row
+	 * is changed then
+	 * @throw std::runtime_error if log failed with commit_sync
+	 */
+	template <typename F1, typename F2>
+	void update(F1 where, F2 stmt)
+	{
+		if (deferred())
+		{
+			parent_->defer(this, [this, where, stmt]() { update(where, stmt); });
+			return;
+		}
+		if (cache_)
+			cache_->writing(stmt);
+		finish_guard guard(this);
+		
+		std::vector<std::size_t> positions;
+		typename plan<F1>::type kernel(plan<F1>::make(where));
+		bool exact;
+		
+		if (lookup(where, kernel, positions, exact))
+		{
+			if (!exact)
+			{
+				std::vector<std::size_t> matched;
+				for (std::vector<std::size_t>::iterator it(positions.begin()),
+					end(positions.end()); it != end; ++it)
+				{
+					if (kernel(row_ref<T>(this, *it)))
+						matched.push_back(*it);
+				}
+				positions.swap(matched);
+			}
+			change(positions, stmt);
+		}
+		else if (has_unique())
+		{
+			for (std::size_t i = 0, n = rows_.size(); i < n; ++i)
+			{
+				if (kernel(row_ref<T>(this, i)))
+					positions.push_back(i);
+			}
+			change(positions, stmt);
+		}
+		else
+		{
+			for (std::size_t i = 0, n = rows_.size(); i < n; ++i)
+			{
+				if (kernel(row_ref<T>(this, i)))
+					change(i, stmt);
+			}
+		}
+		sync();
+	}
+	
+	/**
+	 * Update all rows... Really just evaluate stmt with every object
+	 * in set.
+	 */
+	template <typename F>
+	void update(F stmt)
+	{
+		if (deferred())
+		{
+			parent_->defer(this, [this, stmt]() { update(stmt); });
+			return;
+		}
+		if (cache_)
+			cache_->writing(stmt);
+		finish_guard guard(this);
+		
+		if (pool() || has_unique())
+		{
+			std::vector<std::size_t> positions;
+			positions.reserve(rows_.size() - removed_.count());
+			for (std::size_t i = 0, n = rows_.size(); i < n; ++i)
+			{
+				if (!removed_.test(i))
+					positions.push_back(i);
+			}
+			change(positions, stmt);
+		}
+		else
+		{
+			for (std::size_t i = 0, n = rows_.size(); i < n; ++i)
+			{
+				if (!removed_.test(i))
+					change(i, stmt);
+			}
+		}
+		sync();
+	}
+	
+	/**
+	 * Remove rows matching expression. Rows are only marked as removed
+	 * and dropped from indexes, columns keep them until compaction, so
+	 * positions of other rows do not change. Set is compacted when half
+	 * of its rows are removed.
+	 * @code persons.remove(F(&person::id) < 100); @endcode
+	 * @return number of removed rows, 0 when deferred by transaction
+	 * @throw std::runtime_error if log failed with commit_sync
+	 */
+	template <typename F>
+	std::size_t remove(F where)
+	{
+		if (deferred())
+		{
+			parent_->defer(this, [this, where]() { remove(where); });
+			return 0;
+		}
+		
+		finish_guard guard(this);
+		std::vector<std::size_t> positions;
+		typename plan<F>::type kernel(plan<F>::make(where));
+		bool exact;
+		std::size_t count = 0;
+		
+		if (lookup(where, kernel, positions, exact))
+		{
+			for (std::vector<std::size_t>::iterator it(positions.begin()),
+				end(positions.end()); it != end; ++it)
+			{
+				if ((exact || kernel(row_ref<T>(this, *it))) && discard(*it))
+					++count;
+			}
+		}
+		else
+		{
+			for (std::size_t i = 0, n = rows_.size(); i < n; ++i)
+			{
+				if (kernel(row_ref<T>(this, i)) && discard(i))
+					++count;
+			}
+		}
+		sync();
+		return count;
+	}
+	
+	/**
+	 * Drop removed rows and rebuild columns, indexes and aggregates, so
+	 * scans read dense rows again. With worker pool observers are
+	 * rebuilt in parallel.
+	 */
+	void compact()
+	{
+		if (deferred())
+		{
+			parent_->defer(this, [this]() { compact(); });
+			return;
+		}
+		reclaim();
+		finish();
+	}
+	
+	/**
+	 * All rows of set. When some rows are removed but not compacted yet,
+	 * live rows are copied, and the copy is valid until next call. Rows
+	 * should be changed by update(), not through this container.
+	 */
+	container_type& all()
+	{
+		if (!removed_.count())
+			return rows_;
+		live_.clear();
+		live_.reserve(size());
+		for (std::size_t i = 0, n = rows_.size(); i < n; ++i)
+		{
+			if (!removed_.test(i))
+				live_.push_back(rows_[i]);
+		}
+		return live_;
+	}
+	
+	/**
+	 * Row with given value of primary key, found in its unique index.
+	 * @code persons.get(1) @endcode
+	 * @return row or NULL if there is none, or table has no primary key
+	 */
+	template <typename V>
+	T* get(const V& key)
+	{
+		if (!has_unique())
+			return NULL;
+		for (typename std::vector<unique_index<T>*>::iterator it(uniques_.begin()),
+			end(uniques_.end()); it != end; ++it)
+		{
+			std::size_t pos;
+			if ((*it)->primary_)
+				return (*it)->find(key, pos) ? &rows_[pos] : NULL;
+		}
+		return NULL;
+	}
+	
+	/* Row with given text of primary key */
+	T* get(const char* key)
+	{
+		return get(std::string(key));
+	}
+	
+	virtual unsigned int size() const { return rows_.size() - removed_.count(); }
+	
+	/**
+	 * Object exists in set? Index which identifies rows, like index of
+	 * primary key, answers alone. Otherwise rows with the same key in
+	 * other index are compared first, and as equal rows may still differ
+	 * in its field, all rows are compared when none of them is equal.
+	 */
+	virtual bool exists(table* obj)
+	{
+		T* evaluated = static_cast<T*>(obj);
+		has_unique();
+		
+		abstract_index<T>* other = NULL;
+		for (typename observers_t::iterator it(observers_.begin()),
+			end(observers_.end()); it != end; ++it)
+		{
+			abstract_index<T>* idx = dynamic_cast<abstract_index<T>*>(*it);
+			if (!idx)
+				continue;
+			if (idx->identifies_)
+				return indexed(idx, *evaluated);
+			if (!other)
+				other = idx;
+		}
+		if (other && indexed(other, *evaluated))
+			return true;
+		
+		bool found = false;
+		for (std::size_t i = 0, n = rows_.size(); i < n; ++i)
+		{
+			if (!removed_.test(i) && rows_[i] == *evaluated)
+			{
+				found = true;
+				break;
+			}
+		}
+		return found;
+	}
+	
+private:
+	template <typename, typename>
+	friend struct query_view;
+	
+	/* Row with the same key in index is equal to given one? */
+	bool indexed(abstract_index<T>* idx, T& row)
+	{
+		std::vector<std::size_t> positions;
+		idx->find(row, positions);
+		for (std::vector<std::size_t>::iterator pos(positions.begin()),
+			last(positions.end()); pos != last; ++pos)
+		{
+			if (rows_[*pos] == row)
+				return true;
+		}
+		return false;
+	}
+	
+	friend struct persistent_set<T>;
+	
+	template <typename A>
+	materialized_aggregate<T, A>* find_materialized(const A& agg)
+	{
+		for (typename observers_t::iterator it(observers_.begin()),
+			end(observers_.end()); it != end; ++it)
+		{
+			materialized_aggregate<T, A>* m = dynamic_cast<materialized_aggregate<T, A>*>(*it);
+			if (m && m->aggregate_.same(agg))
+				return m;
+		}
+		return NULL;
+	}
+	
+	template <typename A>
+	typename A::result_type compute(A agg)
+	{
+		return std::get<0>(aggregate(agg));
+	}
+	
+	/* Maximum is tracked by max_of() */
+	template <typename V>
+	V compute(max_impl<T, V> agg)
+	{
+		return max_of(agg.field_.field_);
+	}
+	
+	/* Accumulate row into group of its key */
+	template <typename K, typename... A>
+	static void group(std::map<K, aggregate_list<A...> >& groups,
+		field_impl<K, T>& key, row_ref<T> row, A&... aggs)
+	{
+		const K& k = key(row);
+		typename std::map<K, aggregate_list<A...> >::iterator it(groups.find(k));
+		if (it == groups.end())
+			it = groups.insert(std::make_pair(k, aggregate_list<A...>(aggs...))).first;
+		it->second.add(row);
+	}
+	
+	template <typename K, typename... A>
+	static std::map<K, typename aggregate_list<A...>::result_type> results(
+		const std::map<K, aggregate_list<A...> >& groups)
+	{
+		std::map<K, typename aggregate_list<A...>::result_type> out;
+		for (typename std::map<K, aggregate_list<A...> >::const_iterator it(groups.begin()),
+			end(groups.end()); it != end; ++it)
+		{
+			out.insert(out.end(), std::make_pair(it->first, it->second.result()));
+		}
+		return out;
+	}
+	
+	/**
+	 * Evaluate triggers and move checked row into set. Change is not
+	 * logged yet.
+	 * @param checked unique fields not written by triggers were checked
+	 */
+	void insert(T& t, bool checked = false)
+	{
+		table_schema* schema = t.schema_;
+		
+		for (table_schema::triggers_t::iterator it(schema->triggers.begin()),
+			end(schema->triggers.end()); it != end; ++it)
+		{
+			if ((*it->first)(&t))
+				((*it->second)(&t));
+		}
+		
+		prepare_uniques(schema);
+		for (typename std::vector<unique_index<T>*>::iterator it(uniques_.begin()),
+			end(uniques_.end()); it != end; ++it)
+		{
+			if (!checked || (*it)->schema_->triggered_)
+				(*it)->check(t);
+		}
+		
+		rows_.push_back(std::move(t));
+		
+		for (typename observers_t::iterator it(observers_.begin()),
+			end(observers_.end()); it != end; ++it)
+		{
+			(*it)->inserted(rows_.size() - 1, rows_.back());
+		}
+	}
+	
+	/* Create indexes of fields with unique constraints, once */
+	void prepare_uniques(table_schema* schema)
+	{
+		if (unique_schema_ == schema)
+			return;
+		unique_schema_ = schema;
+		for (table_schema::fields_t::iterator it(schema->fields_.begin()),
+			end(schema->fields_.end()); it != end; ++it)
+		{
+			constraint_expr& expr((*it)->constraint);
+			bool primary = false, plain = false;
+			for (constraint_expr::iterator c(expr.begin()), last(expr.end()); c != last; ++c)
+			{
+				primary = primary || dynamic_cast<constraint<primary_key_impl>*>(*c);
+				plain = plain || dynamic_cast<constraint<unique_impl>*>(*c);
+			}
+			if (primary || plain)
+				uniques_.push_back(add_observer(new unique_index<T>(it->get(), primary)));
+		}
+	}
+	
+	/* Set has fields with unique constraints? */
+	bool has_unique()
+	{
+		if (!rows_.empty())
+			prepare_uniques(rows_.front().schema_);
+		return !uniques_.empty();
+	}
+	
+	/* Changes are deferred by transaction of context? */
+	bool deferred() const
+	{
+		return parent_ && parent_->transaction_;
+	}
+	
+	/* Rows put in transaction since last other change */
+	std::vector<T>& pending()
+	{
+		if (parent_->batch_ != this)
+		{
+			std::shared_ptr<std::vector<T> > batch(new std::vector<T>());
+			parent_->defer(this, [this, batch]() { put_range(std::move(*batch)); });
+			parent_->batch_ = this;
+			batch_ = batch;
+		}
+		return *batch_;
+	}
+	
+	/**
+	 * Write change of row at given position to log of context.
+	 * Removal ('R') logs only position, compaction ('K') nothing.
+	 */
+	void log(char op, std::size_t pos = 0)
+	{
+		if (!journal_ || !parent_->log_)
+			return;
+		std::string payload;
+		if (op == 'U' || op == 'R')
+			serializer<std::uint64_t>::write(payload, pos);
+		if (op == 'U' || op == 'I')
+			persistent_set<T>::write_row(rows_[pos], payload);
+		parent_->log_->append(op, journal_->name(), payload);
+	}
+	
+	/**
+	 * Mark row at given position removed and notify observers.
+	 * @return false if it was removed already
+	 */
+	bool discard(std::size_t pos)
+	{
+		if (!removed_.set(pos))
+			return false;
+		if (undo_)
+			undo_->removed_.push_back(pos);
+		for (typename observers_t::iterator it(observers_.begin()),
+			end(observers_.end()); it != end; ++it)
+		{
+			(*it)->removed(pos, rows_[pos]);
+		}
+		log('R', pos);
+		return true;
+	}
+	
+	/**
+	 * Move live rows over removed ones, keeping their order, and
+	 * rebuild observers from dense rows. While changes are remembered,
+	 * positions must not change, so compaction waits for forget().
+	 */
+	void reclaim()
+	{
+		if (!removed_.count())
+			return;
+		if (undo_)
+		{
+			undo_->compact_ = true;
+			return;
+		}
+		std::size_t live = 0;
+		for (std::size_t i = 0, n = rows_.size(); i < n; ++i)
+		{
+			if (removed_.test(i))
+				continue;
+			if (live != i)
+				rows_[live] = std::move(rows_[i]);
+			++live;
+		}
+		rows_.erase(rows_.begin() + live, rows_.end());
+		removed_.clear();
+		load_observers();
+		log('K');
+	}
+	
+	/* Rebuild observers from rows, in parallel with worker pool */
+	void load_observers()
+	{
+		if (pool() && observers_.size() > 1)
+		{
+			pool()->run(observers_.size(), [this](std::size_t i)
+			{
+				observers_[i]->load(rows_);
+			});
+		}
+		else
+		{
+			for (typename observers_t::iterator it(observers_.begin()),
+				end(observers_.end()); it != end; ++it)
+			{
+				(*it)->load(rows_);
+			}
+		}
+	}
+	
+	/**
+	 * Remember rows before they change and size of set, until undo()
+	 * or forget(). Used by put_range() and transactions, which must
+	 * change nothing when they fail half way.
+	 */
+	virtual void record()
+	{
+		if (undo_)
+			return;
+		undo_.reset(new undo_log());
+		undo_->size_ = rows_.size();
+		undo_->compact_ = false;
+	}
+	
+	/**
+	 * Take out inserted rows, bring back changed and removed ones, and
+	 * rebuild observers. Changes are not logged, log of transaction is
+	 * aborted instead.
+	 */
+	virtual void undo()
+	{
+		if (!undo_)
+			return;
+		std::unique_ptr<undo_log> changes(std::move(undo_));
+		for (typename std::vector<std::pair<std::size_t, T> >::reverse_iterator
+			it(changes->updated_.rbegin()), end(changes->updated_.rend()); it != end; ++it)
+		{
+			rows_[it->first] = std::move(it->second);
+		}
+		for (std::vector<std::size_t>::iterator it(changes->removed_.begin()),
+			end(changes->removed_.end()); it != end; ++it)
+		{
+			removed_.reset(*it);
+		}
+		rows_.erase(rows_.begin() + changes->size_, rows_.end());
+		
+		load_observers();
+		for (typename observers_t::iterator it(observers_.begin()),
+			end(observers_.end()); it != end; ++it)
+		{
+			replay_removed(*it);
+		}
+	}
+	
+	/* Tell observer loaded from rows which of them are removed */
+	void replay_removed(abstract_observer<T>* observer)
+	{
+		for (std::size_t pos = 0, n = rows_.size(); removed_.count() && pos < n; ++pos)
+		{
+			if (removed_.test(pos))
+				observer->removed(pos, rows_[pos]);
+		}
+	}
+	
+	/* Changes stay, compaction postponed meanwhile is done now */
+	virtual void forget()
+	{
+		bool compact = undo_ && undo_->compact_;
+		undo_.reset();
+		if (compact)
+			reclaim();
+	}
+	
+	/* Remember row at given position before it changes */
+	void remember(std::size_t pos)
+	{
+		if (undo_ && pos < undo_->size_)
+			undo_->updated_.push_back(std::make_pair(pos, rows_[pos]));
+	}
+	
+	/* Change is complete: tell observers and wait for log */
+	virtual void finish()
+	{
+		if (cache_)
+			cache_->written();
+		if (parent_ && parent_->committing_)
+			return;
+		if (removed_.count() > rows_.size() / 2)
+			reclaim();
+		for (typename observers_t::iterator it(observers_.begin()),
+			end(observers_.end()); it != end; ++it)
+		{
+			(*it)->committed();
+		}
+	}
+	
+	/**
+	 * Wait for log of change when context commits synchronously.
+	 * Commit of transaction waits once for all its changes instead.
+	 * @throw std::runtime_error if log could not be written
+	 */
+	void sync()
+	{
+		if (journal_ && !parent_->committing_ && !parent_->durable())
+			throw std::runtime_error("write-ahead log failed");
+	}
+	
+	/* Append row read from snapshot or log. Triggers were evaluated already. */
+	void restore(T& row)
+	{
+		row.parent_ = this;
+		rows_.push_back(std::move(row));
+		for (typename observers_t::iterator it(observers_.begin()),
+			end(observers_.end()); it != end; ++it)
+		{
+			(*it)->inserted(rows_.size() - 1, rows_.back());
+		}
+	}
+	
+	/* Replace row with one read from log, or with one it was changed from */
+	void restore(std::size_t pos, T& row)
+	{
+		row.parent_ = this;
+		for (typename observers_t::iterator it(observers_.begin()),
+			end(observers_.end()); it != end; ++it)
+		{
+			(*it)->updating(pos, rows_[pos]);
+		}
+		rows_[pos] = std::move(row);
+		for (typename observers_t::iterator it(observers_.begin()),
+			end(observers_.end()); it != end; ++it)
+		{
+			(*it)->updated(pos, rows_[pos]);
+		}
+	}
+	
+	/* Observers hold copies of values, so they can not be shared */
+	dbset(const dbset&);
+	dbset& operator=(const dbset&);
+	
+	template <typename O>
+	O* add_observer(O* observer)
+	{
+		observer->load(rows_);
+		replay_removed(observer);
+		observers_.push_back(observer);
+		return observer;
+	}
+	
+	/* Find observer of type O attached to given field */
+	template <typename O, typename V>
+	O* find_observer(field<V> T::* fld)
+	{
+		for (typename observers_t::iterator it(observers_.begin()),
+			end(observers_.end()); it != end; ++it)
+		{
+			O* observer = dynamic_cast<O*>(*it);
+			if (observer && observer->field_ == fld)
+				return observer;
+		}
+		return NULL;
+	}
+	
+	/* Positions of rows matching expression in ascending order */
+	template <typename F>
+	void select(F& f, std::vector<std::size_t>& positions)
+	{
+		typename plan<F>::type kernel(plan<F>::make(f));
+		bool exact;
+		
+		if (lookup(f, kernel, positions, exact))
+		{
+			if (!exact)
+			{
+				std::vector<std::size_t> matched;
+				for (std::vector<std::size_t>::iterator it(positions.begin()),
+					end(positions.end()); it != end; ++it)
+				{
+					if (kernel(row_ref<T>(this, *it)))
+						matched.push_back(*it);
+				}
+				positions.swap(matched);
+			}
+			return;
+		}
+		
+		for (std::size_t i = 0, n = rows_.size(); i < n; ++i)
+		{
+			if (kernel(row_ref<T>(this, i)))
+				positions.push_back(i);
+		}
+	}
+	
+	/**
+	 * Positions of candidate rows in ascending order. Rows are looked up
+	 * in indexes, or selected by vectorized scan of columns.
+	 * @param exact set to true when every candidate matches
+	 */
+	template <typename F>
+	bool lookup(F& f, typename plan<F>::type& kernel,
+		std::vector<std::size_t>& positions, bool& exact)
+	{
+		if (index_lookup<F, T>::find(*this, f, positions))
+		{
+			std::sort(positions.begin(), positions.end());
+			exact = false;
+			return true;
+		}
+		
+		selection selected;
+		if (vector_scan<typename plan<F>::type, T>::select(*this, kernel, selected))
+		{
+			selected -= removed_;
+			selected.positions(positions);
+			exact = true;
+			return true;
+		}
+		
+		if (pool() && row_local<F>::value)
+		{
+			parallel_select(kernel, positions);
+			exact = true;
+			return true;
+		}
+		
+		/* Plain scan which skips removed rows */
+		if (removed_.count())
+		{
+			for (std::size_t i = 0, n = rows_.size(); i < n; ++i)
+			{
+				if (!removed_.test(i) && kernel(row_ref<T>(this, i)))
+					positions.push_back(i);
+			}
+			exact = true;
+			return true;
+		}
+		return false;
+	}
+	
+	/* Rows scanned by one task of worker pool */
+	enum { parallel_chunk = 4096 };
+	
+	/**
+	 * Worker pool of context, when set is big enough to be scanned
+	 * in parallel.
+	 */
+	worker_pool* pool() const
+	{
+		if (!parent_ || !parent_->pool_ || rows_.size() < 2 * parallel_chunk)
+			return NULL;
+		return parent_->pool_;
+	}
+	
+	std::size_t chunks() const
+	{
+		return (rows_.size() + parallel_chunk - 1) / parallel_chunk;
+	}
+	
+	/**
+	 * Positions of rows matching kernel, evaluated in parallel.
+	 * Every chunk collects its matches and they are merged in order of
+	 * chunks, so result is the same as of sequential scan.
+	 */
+	template <typename K>
+	void parallel_select(const K& kernel, std::vector<std::size_t>& positions)
+	{
+		std::vector<std::vector<std::size_t> > found(chunks());
+		pool()->run(found.size(), [this, &kernel, &found](std::size_t chunk)
+		{
+			K local(kernel);
+			for (std::size_t i = chunk * parallel_chunk,
+				n = std::min(rows_.size(), i + parallel_chunk); i < n; ++i)
+			{
+				if (!removed_.test(i) && local(row_ref<T>(this, i)))
+					found[chunk].push_back(i);
+			}
+		});
+		for (std::size_t chunk = 0; chunk < found.size(); ++chunk)
+			positions.insert(positions.end(), found[chunk].begin(), found[chunk].end());
+	}
+	
+	/**
+	 * Maximum of field computed in parallel.
+	 * @return false if there are no rows
+	 */
+	template <typename V>
+	bool parallel_max(field<V> T::* fld, V& result)
+	{
+		std::vector<std::pair<bool, V> > found(chunks(), std::make_pair(false, V()));
+		pool()->run(found.size(), [this, fld, &found](std::size_t chunk)
+		{
+			std::pair<bool, V>& best = found[chunk];
+			for (std::size_t i = chunk * parallel_chunk,
+				n = std::min(rows_.size(), i + parallel_chunk); i < n; ++i)
+			{
+				if (removed_.test(i))
+					continue;
+				const V& v = (rows_[i].*fld).value_;
+				if (!best.first || best.second < v)
+					best = std::make_pair(true, v);
+			}
+		});
+		bool empty = true;
+		for (std::size_t chunk = 0; chunk < found.size(); ++chunk)
+		{
+			if (found[chunk].first && (empty || result < found[chunk].second))
+			{
+				result = found[chunk].second;
+				empty = false;
+			}
+		}
+		return !empty;
+	}
+	
+	/**
+	 * Evaluate stmt with rows at given positions. With worker pool
+	 * observers are notified on calling thread, before and after stmt is
+	 * evaluated in parallel. Statement which reads other rows is
+	 * evaluated row by row.
+	 */
+	template <typename F>
+	void change(const std::vector<std::size_t>& positions, F& stmt)
+	{
+		if (has_unique())
+		{
+			change_unique(positions, stmt);
+			return;
+		}
+		
+		if (!pool() || !row_local<F>::value || positions.size() < parallel_chunk)
+		{
+			for (std::vector<std::size_t>::const_iterator it(positions.begin()),
+				end(positions.end()); it != end; ++it)
+			{
+				change(*it, stmt);
+			}
+			return;
+		}
+		
+		for (std::size_t i = 0, n = positions.size(); i < n; ++i)
+			remember(positions[i]);
+		for (typename observers_t::iterator it(observers_.begin()),
+			end(observers_.end()); it != end; ++it)
+		{
+			for (std::size_t i = 0, n = positions.size(); i < n; ++i)
+				(*it)->updating(positions[i], rows_[positions[i]]);
+		}
+		pool()->run((positions.size() + parallel_chunk - 1) / parallel_chunk,
+			[this, &positions, &stmt](std::size_t chunk)
+		{
+			F local(stmt);
+			for (std::size_t i = chunk * parallel_chunk,
+				n = std::min(positions.size(), i + parallel_chunk); i < n; ++i)
+			{
+				local(&rows_[positions[i]]);
+			}
+		});
+		for (typename observers_t::iterator it(observers_.begin()),
+			end(observers_.end()); it != end; ++it)
+		{
+			for (std::size_t i = 0, n = positions.size(); i < n; ++i)
+				(*it)->updated(positions[i], rows_[positions[i]]);
+		}
+		for (std::size_t i = 0, n = positions.size(); i < n; ++i)
+			log('U', positions[i]);
+	}
+	
+	/**
+	 * Evaluate stmt with rows at given positions one by one, like
+	 * change() does, so aggregates see rows changed before. Unique fields
+	 * are checked when all rows are changed, so rows may swap values.
+	 * When a value repeats, rows are changed back and nothing is logged.
+	 */
+	template <typename F>
+	void change_unique(const std::vector<std::size_t>& positions, F& stmt)
+	{
+		std::vector<T> before;
+		before.reserve(positions.size());
+		try
+		{
+			for (std::vector<std::size_t>::const_iterator pos(positions.begin()),
+				last(positions.end()); pos != last; ++pos)
+			{
+				T row(rows_[*pos]);
+				stmt(&row);
+				remember(*pos);
+				for (typename observers_t::iterator it(observers_.begin()),
+					end(observers_.end()); it != end; ++it)
+				{
+					(*it)->updating(*pos, rows_[*pos]);
+				}
+				before.push_back(std::move(rows_[*pos]));
+				rows_[*pos] = std::move(row);
+				for (typename observers_t::iterator it(observers_.begin()),
+					end(observers_.end()); it != end; ++it)
+				{
+					(*it)->updated(*pos, rows_[*pos]);
+				}
+			}
+			for (typename std::vector<unique_index<T>*>::iterator it(uniques_.begin()),
+				end(uniques_.end()); it != end; ++it)
+			{
+				(*it)->check(positions);
+			}
+		}
+		catch (...)
+		{
+			for (std::size_t i = before.size(); i-- > 0; )
+				restore(positions[i], before[i]);
+			throw;
+		}
+		for (std::size_t i = 0, n = positions.size(); i < n; ++i)
+			log('U', positions[i]);
+	}
+	
+	/* Evaluate stmt with row and notify observers */
+	template <typename F>
+	void change(std::size_t pos, F& stmt)
+	{
+		remember(pos);
+		for (typename observers_t::iterator it(observers_.begin()),
+			end(observers_.end()); it != end; ++it)
+		{
+			(*it)->updating(pos, rows_[pos]);
+		}
+		stmt(&rows_[pos]);
+		for (typename observers_t::iterator it(observers_.begin()),
+			end(observers_.end()); it != end; ++it)
+		{
+			(*it)->updated(pos, rows_[pos]);
+		}
+		log('U', pos);
+	}
+};
+
+/**
+ * Persistent set, saved in snapshots and write-ahead log.
+ * Row is stored as values of its fields in schema order.
+ */
+template <typename T /* Table */>
+struct persistent_set: abstract_persistent
+{
+	dbset<T>* set_;
+	std::string name_;
+	
+	persistent_set(dbset<T>* set, const std::string& name):
+		set_(set), name_(name) {}
+	
+	virtual const std::string& name() const { return name_; }
+	
+	/* Set is compacted first, positions in later log records are dense */
+	virtual void save(std::string& out)
+	{
+		set_->reclaim();
+		serializer<std::uint64_t>::write(out, set_->rows_.size());
+		for (typename std::vector<T>::iterator it(set_->rows_.begin()),
+			end(set_->rows_.end()); it != end; ++it)
+		{
+			write_row(*it, out);
+		}
+	}
+	
+	virtual bool load(const char*& p, const char* end)
+	{
+		std::uint64_t count;
+		if (!serializer<std::uint64_t>::read(p, end, count))
+			return false;
+		set_->reserve(set_->rows_.size() + count);
+		for (std::uint64_t i = 0; i < count; ++i)
+		{
+			T row;
+			if (!read_row(p, end, row))
+				return false;
+			set_->restore(row);
+		}
+		return true;
+	}
+	
+	virtual bool replay(char op, const char*& p, const char* end)
+	{
+		std::uint64_t pos = 0;
+		if ((op == 'U' || op == 'R') && (!serializer<std::uint64_t>::read(p, end, pos) ||
+			pos >= set_->rows_.size()))
+		{
+			return false;
+		}
+		if (op == 'R')
+		{
+			set_->discard(pos);
+			return true;
+		}
+		if (op == 'K')
+		{
+			set_->reclaim();
+			return true;
+		}
+		T row;
+		if (!read_row(p, end, row))
+			return false;
+		if (op == 'I')
+			set_->restore(row);
+		else if (op == 'U')
+			set_->restore(pos, row);
+		else
+			return false;
+		return true;
+	}
+	
+	virtual void recovered()
+	{
+		set_->finish();
+	}
+	
+	static void write_row(T& row, std::string& out)
+	{
+		table_schema* schema = row.schema_;
+		for (table_schema::fields_t::iterator it(schema->fields_.begin()),
+			end(schema->fields_.end()); it != end; ++it)
+		{
+			(*it)->get(&row)->write(out);
+		}
+	}
+	
+	static bool read_row(const char*& p, const char* end, T& row)
+	{
+		table_schema* schema = row.schema_;
+		for (table_schema::fields_t::iterator it(schema->fields_.begin()),
+			end_(schema->fields_.end()); it != end_; ++it)
+		{
+			if (!(*it)->get(&row)->read(p, end))
+				return false;
+		}
+		return true;
+	}
+};
+
+/**
+ * Header of mapped snapshot file. File is header, column directory,
+ * names of columns and column blocks aligned to mapped_align bytes.
+ * Fixed width plain values are stored as array, others (strings and
+ * types with their own serializer) as array of offsets into heap of
+ * serialized values which follows the array.
+ */
+struct mapped_header
+{
+	char magic_[8];
+	std::uint32_t version_;
+	std::uint32_t columns_;
+	std::uint64_t rows_;
+};
+
+struct mapped_column
+{
+	std::uint64_t name_; /* Offset of name */
+	std::uint32_t name_size_;
+	std::uint32_t width_; /* Size of value, 0 when stored in heap */
+	std::uint64_t offset_; /* Offset of block */
+	std::uint64_t size_; /* Size of block */
+	char type_[16];
+};
+
+enum { mapped_version = 1, mapped_align = 64 };
+
+/**
+ * Read-only set mapped from snapshot file. Rows are not loaded, values
+ * are read from mapped columns when they are needed, so sets bigger
+ * than memory can be opened and queried at once. Integer columns are
+ * scanned in place by vectorized kernels.
+ * @code
+ * mapped_set<person>::write(ctx.persons.all(), "persons.map");
+ * mapped_set<person> persons;
+ * persons.open("persons.map");
+ * persons.filter(F(&person::id) > 10);
+ * @endcode
+ * Table must have default constructor, rows are read into default
+ * constructed ones.
+ */
+template <typename T /* Table */>
+struct mapped_set
+{
+	typedef std::vector<T> container_type;
+	
+	mapped_set(): data_(NULL), size_(0), rows_(0) {}
+	
+	~mapped_set()
+	{
+		close();
+	}
+	
+	/**
+	 * Write rows into file which can be mapped.
+	 * @return false if file could not be written
+	 */
+	static bool write(std::vector<T>& rows, const std::string& path)
+	{
+		T prototype;
+		table_schema* schema = prototype.schema_;
+		std::vector<mapped_column> columns(schema->fields_.size());
+		std::string names;
+		for (std::size_t i = 0; i < columns.size(); ++i)
+		{
+			field_schema* fs = schema->fields_[i].get();
+			std::memset(&columns[i], 0, sizeof(mapped_column));
+			columns[i].name_ = names.size();
+			columns[i].name_size_ = fs->name_.size();
+			columns[i].width_ = fs->get(&prototype)->width();
+			std::strncpy(columns[i].type_, fs->type_.c_str(), sizeof(columns[i].type_) - 1);
+			names.append(fs->name_);
+		}
+		
+		int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			return false;
+		
+		std::uint64_t names_offset = sizeof(mapped_header) + columns.size() * sizeof(mapped_column);
+		std::uint64_t offset = align(names_offset + names.size());
+		bool ok = true;
+		
+		/* Blocks are written one by one, so only one column is in memory */
+		for (std::size_t i = 0; ok && i < columns.size(); ++i)
+		{
+			field_schema* fs = schema->fields_[i].get();
+			std::string block;
+			if (columns[i].width_)
+			{
+				block.reserve(rows.size() * columns[i].width_);
+				for (typename std::vector<T>::iterator it(rows.begin()), end(rows.end()); it != end; ++it)
+					fs->get(&*it)->write(block);
+			}
+			else
+			{
+				std::string heap;
+				for (typename std::vector<T>::iterator it(rows.begin()), end(rows.end()); it != end; ++it)
+				{
+					serializer<std::uint64_t>::write(block, heap.size());
+					fs->get(&*it)->write(heap);
+				}
+				serializer<std::uint64_t>::write(block, heap.size());
+				block.append(heap);
+			}
+			columns[i].offset_ = offset;
+			columns[i].size_ = block.size();
+			block.resize(align(block.size()), '\0');
+			ok = write_at(fd, block.data(), block.size(), offset);
+			offset += block.size();
+		}
+		
+		mapped_header header;
+		std::memcpy(header.magic_, "MUMAP\0\0\0", 8);
+		header.version_ = mapped_version;
+		header.columns_ = columns.size();
+		header.rows_ = rows.size();
+		std::string head(reinterpret_cast<const char*>(&header), sizeof(header));
+		head.append(reinterpret_cast<const char*>(columns.data()), columns.size() * sizeof(mapped_column));
+		head.append(names);
+		ok = ok && write_at(fd, head.data(), head.size(), 0) &&
+			::ftruncate(fd, offset) == 0 && ::fsync(fd) == 0;
+		::close(fd);
+		return ok;
+	}
+	
+	/**
+	 * Map file written by write(). Columns are matched with fields by
+	 * name, fields missing in file keep default values.
+	 * @return false if file can not be mapped or is not valid
+	 */
+	bool open(const std::string& path)
+	{
+		close();
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (::fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(mapped_header))
+		{
+			::close(fd);
+			return false;
+		}
+		void* data = ::mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (data == MAP_FAILED)
+			return false;
+		data_ = static_cast<const char*>(data);
+		size_ = st.st_size;
+		if (!attach())
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+	
+	void close()
+	{
+		if (data_)
+			::munmap(const_cast<char*>(data_), size_);
+		data_ = NULL;
+		size_ = 0;
+		rows_ = 0;
+		columns_.clear();
+	}
+	
+	std::size_t size() const { return rows_; }
+	
+	/**
+	 * Values of fixed width field, in place.
+	 * @return array of size() values or NULL if field is not stored so,
+	 * or its values are not plain bytes
+	 */
+	template <typename V>
+	const V* values(field<V> T::* fld)
+	{
+		const mapped_column* col = find(fld);
+		if (!std::is_trivially_copyable<V>::value || !col || col->width_ != sizeof(V))
+			return NULL;
+		return reinterpret_cast<const V*>(data_ + col->offset_);
+	}
+	
+	/**
+	 * Read value of one field. Other fields of row are not read.
+	 */
+	template <typename V>
+	V get(field<V> T::* fld, std::size_t pos)
+	{
+		T& row = prototype();
+		const mapped_column* col = find(fld);
+		if (col)
+			read(col, pos, &(row.*fld));
+		else
+			(row.*fld).value_ = V();
+		return (row.*fld).value_;
+	}
+	
+	/**
+	 * Read whole row.
+	 */
+	T row(std::size_t pos)
+	{
+		T result;
+		read(pos, result);
+		return result;
+	}
+	
+	/**
+	 * Read rows matching expression. Integer comparisons are evaluated
+	 * over mapped columns, other expressions with every row.
+	 */
+	template <typename F>
+	container_type filter(F f)
+	{
+		container_type result;
+		std::vector<std::size_t> positions;
+		select(f, positions);
+		result.reserve(positions.size());
+		for (std::vector<std::size_t>::iterator it(positions.begin()),
+			end(positions.end()); it != end; ++it)
+		{
+			result.push_back(row(*it));
+		}
+		return result;
+	}
+	
+	/* Number of rows matching expression */
+	template <typename F>
+	std::size_t count(F f)
+	{
+		std::vector<std::size_t> positions;
+		select(f, positions);
+		return positions.size();
+	}
+	
+private:
+	mapped_set(const mapped_set&);
+	mapped_set& operator=(const mapped_set&);
+	
+	static std::uint64_t align(std::uint64_t n)
+	{
+		return (n + mapped_align - 1) / mapped_align * mapped_align;
+	}
+	
+	static bool write_at(int fd, const char* p, std::size_t n, std::uint64_t offset)
+	{
+		while (n)
+		{
+			ssize_t done = ::pwrite(fd, p, n, offset);
+			if (done < 0)
+				return false;
+			p += done;
+			n -= done;
+			offset += done;
+		}
+		return true;
+	}
+	
+	/* Validate mapped file and match its columns with fields */
+	bool attach()
+	{
+		const mapped_header* header = reinterpret_cast<const mapped_header*>(data_);
+		if (std::memcmp(header->magic_, "MUMAP\0\0\0", 8) != 0 ||
+			header->version_ != mapped_version ||
+			(size_ - sizeof(mapped_header)) / sizeof(mapped_column) < header->columns_)
+		{
+			return false;
+		}
+		rows_ = header->rows_;
+		const mapped_column* columns = reinterpret_cast<const mapped_column*>(header + 1);
+		const char* names = reinterpret_cast<const char*>(columns + header->columns_);
+		
+		table_schema* schema = prototype().schema_;
+		columns_.assign(schema->fields_.size(), NULL);
+		for (std::uint32_t i = 0; i < header->columns_; ++i)
+		{
+			const mapped_column& col = columns[i];
+			if (col.offset_ % mapped_align || col.offset_ > size_ || size_ - col.offset_ < col.size_ ||
+				(std::uint64_t)(data_ + size_ - names) < col.name_ + col.name_size_)
+			{
+				return false;
+			}
+			if (col.width_ ? col.size_ / col.width_ < rows_ :
+				col.size_ / sizeof(std::uint64_t) <= rows_)
+			{
+				return false;
+			}
+			std::string name(names + col.name_, col.name_size_);
+			for (std::size_t f = 0; f < schema->fields_.size(); ++f)
+			{
+				field_schema* fs = schema->fields_[f].get();
+				if (fs->name_ != name)
+					continue;
+				if (fs->type_ != std::string(col.type_, strnlen(col.type_, sizeof(col.type_))) ||
+					fs->get(&prototype())->width() != col.width_)
+				{
+					return false;
+				}
+				columns_[f] = &col;
+			}
+		}
+		return true;
+	}
+	
+	/* Row used to find fields and read single values */
+	T& prototype()
+	{
+		if (!prototype_.get())
+			prototype_.reset(new T());
+		return *prototype_;
+	}
+	
+	template <typename V>
+	const mapped_column* find(field<V> T::* fld)
+	{
+		T& row = prototype();
+		std::ptrdiff_t offset = reinterpret_cast<char*>(&(row.*fld)) - reinterpret_cast<char*>(&row);
+		table_schema* schema = row.schema_;
+		for (std::size_t i = 0; i < schema->fields_.size(); ++i)
+		{
+			if (schema->fields_[i]->offset_ == offset)
+				return columns_[i];
+		}
+		return NULL;
+	}
+	
+	bool read(const mapped_column* col, std::size_t pos, abstract_field* fld)
+	{
+		const char* block = data_ + col->offset_;
+		if (col->width_)
+		{
+			const char* p = block + pos * col->width_;
+			return fld->read(p, p + col->width_);
+		}
+		std::uint64_t first, last;
+		std::memcpy(&first, block + pos * sizeof(std::uint64_t), sizeof(first));
+		std::memcpy(&last, block + (pos + 1) * sizeof(std::uint64_t), sizeof(last));
+		const char* heap = block + (rows_ + 1) * sizeof(std::uint64_t);
+		const char* end = block + col->size_;
+		if (first > last || last > (std::uint64_t)(end - heap))
+			return false;
+		const char* p = heap + first;
+		return fld->read(p, heap + last);
+	}
+	
+	bool read(std::size_t pos, T& row)
+	{
+		table_schema* schema = row.schema_;
+		for (std::size_t i = 0; i < columns_.size(); ++i)
+		{
+			if (columns_[i] && !read(columns_[i], pos, schema->fields_[i]->get(&row)))
+				return false;
+		}
+		return true;
+	}
+	
+	template <typename F>
+	void select(F& f, std::vector<std::size_t>& positions)
+	{
+		typename plan<F>::type kernel(plan<F>::make(f));
+		selection selected;
+		if (vector_scan<typename plan<F>::type, T>::select(*this, kernel, selected))
+		{
+			selected.positions(positions);
+			return;
+		}
+		T row;
+		for (std::size_t i = 0; i < rows_; ++i)
+		{
+			read(i, row);
+			if (kernel(&row))
+				positions.push_back(i);
+		}
+	}
+	
+	const char* data_;
+	std::size_t size_;
+	std::size_t rows_;
+	std::vector<const mapped_column*> columns_; /* By field of schema */
+	std::unique_ptr<T> prototype_;
+};
+
+/**
+ * Integer column of set, for vectorized scans.
+ * @return false if values are not stored in column
+ */
+template <typename T>
+bool int_column(dbset<T>& set, field<int> T::* fld, const int*& values, std::size_t& n)
+{
+	column<int, T>* col = set.find_column(fld);
+	if (!col)
+		return false;
+	values = col->values_.data();
+	n = col->values_.size();
+	return true;
+}
+
+template <typename T>
+bool int_column(mapped_set<T>& set, field<int> T::* fld, const int*& values, std::size_t& n)
+{
+	values = set.values(fld);
+	n = set.size();
+	return values != NULL;
+}
+
+/* Import and export */
+
+/* Rows parsed before they are put into set */
+enum { import_batch = 65536 };
+
+/**
+ * Buffered reader of text stream, refilled in big chunks.
+ */
+struct text_source
+{
+	enum { chunk = 1 << 20 };
+	
+	text_source(std::istream& in):
+		in_(in), buffer_(chunk), pos_(0), end_(0) {}
+	
+	int peek()
+	{
+		if (pos_ == end_ && !fill())
+			return EOF;
+		return (unsigned char)buffer_[pos_];
+	}
+	
+	int get()
+	{
+		int c = peek();
+		if (c != EOF)
+			++pos_;
+		return c;
+	}
+	
+private:
+	bool fill()
+	{
+		in_.read(&buffer_[0], buffer_.size());
+		end_ = in_.gcount();
+		pos_ = 0;
+		return end_ > 0;
+	}
+	
+	std::istream& in_;
+	std::vector<char> buffer_;
+	std::size_t pos_;
+	std::size_t end_;
+};
+
+/**
+ * Buffered writer of text stream.
+ */
+struct text_sink
+{
+	enum { chunk = 1 << 20 };
+	
+	text_sink(std::ostream& out): out_(out)
+	{
+		buffer_.reserve(chunk + 4096);
+	}
+	
+	~text_sink()
+	{
+		flush();
+	}
+	
+	std::string& buffer()
+	{
+		return buffer_;
+	}
+	
+	/* Write buffer when it is full */
+	void next()
+	{
+		if (buffer_.size() >= chunk)
+			flush();
+	}
+	
+	void flush()
+	{
+		out_.write(buffer_.data(), buffer_.size());
+		buffer_.clear();
+	}
+	
+private:
+	std::ostream& out_;
+	std::string buffer_;
+};
+
+/**
+ * Parse rows in batches. Rows which can not be parsed are skipped.
+ * @param more set to false at end of input
+ */
+template <typename T, typename Parser>
+std::vector<T> parse_batch(Parser& parser, const T& prototype, bool& more)
+{
+	std::vector<T> batch;
+	batch.reserve(import_batch);
+	while (batch.size() < import_batch)
+	{
+		T row(prototype);
+		bool valid = true;
+		if (!parser.next(row, valid))
+		{
+			more = false;
+			break;
+		}
+		if (valid)
+			batch.push_back(std::move(row));
+	}
+	return batch;
+}
+
+/**
+ * Put rows of parser into set. Batches are put with put_range(), so
+ * constraints and triggers are evaluated.
+ * @param pipelined parse next batch on another thread while current
+ * one is put
+ * @return number of rows put
+ */
+template <typename T, typename Parser>
+std::size_t import_rows(dbset<T>& set, Parser& parser, const T& prototype, bool pipelined)
+{
+	std::size_t count = 0;
+	bool more = true;
+	if (!pipelined)
+	{
+		while (more)
+		{
+			std::vector<T> batch(parse_batch(parser, prototype, more));
+			count += batch.size();
+			set.put_range(std::move(batch));
+		}
+		return count;
+	}
+	
+	std::future<std::vector<T> > next(std::async(std::launch::async,
+		[&parser, &prototype, &more]() { return parse_batch(parser, prototype, more); }));
+	while (true)
+	{
+		std::vector<T> batch(next.get());
+		bool last = !more;
+		if (!last)
+		{
+			next = std::async(std::launch::async,
+				[&parser, &prototype, &more]() { return parse_batch(parser, prototype, more); });
+		}
+		count += batch.size();
+		set.put_range(std::move(batch));
+		if (last)
+			break;
+	}
+	return count;
+}
+
+/**
+ * Reader of CSV records. First record names columns, which are matched
+ * with fields of table by name. Other columns are ignored.
+ */
+template <typename T /* Table */>
+struct csv_parser
+{
+	csv_parser(std::istream& in, table_schema* schema): in_(in)
+	{
+		std::size_t count;
+		if (!record(count))
+			return;
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			field_schema* found = NULL;
+			for (table_schema::fields_t::iterator it(schema->fields_.begin()),
+				end(schema->fields_.end()); it != end; ++it)
+			{
+				if ((*it)->name_ == values_[i])
+					found = it->get();
+			}
+			columns_.push_back(found);
+		}
+	}
+	
+	/**
+	 * Read next row.
+	 * @param valid set to false if value of field can not be parsed
+	 * @return false at end of input
+	 */
+	bool next(T& row, bool& valid)
+	{
+		std::size_t count;
+		do
+		{
+			if (!record(count))
+				return false;
+		}
+		while (count == 1 && values_[0].empty()); /* Blank line */
+		
+		for (std::size_t i = 0, n = std::min(count, columns_.size()); i < n; ++i)
+		{
+			if (columns_[i] && !columns_[i]->get(&row)->parse(values_[i].data(), values_[i].size()))
+				valid = false;
+		}
+		return true;
+	}
+	
+private:
+	/* Read values of one record, quoted as in RFC 4180 */
+	bool record(std::size_t& count)
+	{
+		if (in_.peek() == EOF)
+			return false;
+		count = 0;
+		while (true)
+		{
+			if (count == values_.size())
+				values_.push_back(std::string());
+			std::string& value = values_[count++];
+			value.clear();
+			int c = in_.get();
+			if (c == '"')
+			{
+				while ((c = in_.get()) != EOF)
+				{
+					if (c != '"')
+						value += char(c);
+					else if (in_.peek() == '"')
+						value += char(in_.get());
+					else
+					{
+						c = in_.get();
+						break;
+					}
+				}
+			}
+			else
+			{
+				while (c != ',' && c != '\n' && c != '\r' && c != EOF)
+				{
+					value += char(c);
+					c = in_.get();
+				}
+			}
+			if (c == ',')
+				continue;
+			if (c == '\r' && in_.peek() == '\n')
+				in_.get();
+			return true;
+		}
+	}
+	
+	text_source in_;
+	std::vector<field_schema*> columns_; /* Field of every column or NULL */
+	std::vector<std::string> values_; /* Reused for every record */
+};
+
+/**
+ * Reader of JSON objects, either in array or one after another.
+ * Members are matched with fields of table by name, others and null
+ * values are ignored.
+ */
+template <typename T /* Table */>
+struct json_parser
+{
+	json_parser(std::istream& in, table_schema* schema): in_(in)
+	{
+		for (table_schema::fields_t::iterator it(schema->fields_.begin()),
+			end(schema->fields_.end()); it != end; ++it)
+		{
+			fields_.insert(std::make_pair((*it)->name_, it->get()));
+		}
+	}
+	
+	/**
+	 * Read next object.
+	 * @param valid set to false if object is malformed or value of
+	 * field can not be parsed
+	 * @return false at end of input
+	 */
+	bool next(T& row, bool& valid)
+	{
+		int c;
+		while ((c = in_.peek()) != EOF && c != '{')
+			in_.get(); /* Whitespace, brackets and commas of array */
+		if (c == EOF)
+			return false;
+		in_.get();
+		
+		while (true)
+		{
+			c = skip();
+			if (c == '}')
+			{
+				in_.get();
+				return true;
+			}
+			if (c == ',')
+			{
+				in_.get();
+				continue;
+			}
+			if (c != '"' || !quoted(key_))
+				break;
+			if (skip() != ':')
+				break;
+			in_.get();
+			
+			c = skip();
+			bool null = false;
+			if (c == '"')
+			{
+				if (!quoted(value_))
+					break;
+			}
+			else if (c == '{' || c == '[')
+			{
+				nested();
+				if (fields_.count(key_))
+					valid = false;
+				continue;
+			}
+			else
+			{
+				value_.clear();
+				while ((c = in_.peek()) != EOF && c != ',' && c != '}' && !std::isspace(c))
+					value_ += char(in_.get());
+				null = value_ == "null";
+			}
+			
+			std::map<std::string, field_schema*>::iterator it(fields_.find(key_));
+			if (it != fields_.end() && !null &&
+				!it->second->get(&row)->parse(value_.data(), value_.size()))
+			{
+				valid = false;
+			}
+		}
+		
+		/* Malformed object, skip rest of it */
+		valid = false;
+		while ((c = in_.get()) != EOF && c != '}');
+		return true;
+	}
+	
+private:
+	/* Skip whitespace, @return next character */
+	int skip()
+	{
+		int c;
+		while ((c = in_.peek()) != EOF && std::isspace(c))
+			in_.get();
+		return c;
+	}
+	
+	/* Read quoted string with escapes */
+	bool quoted(std::string& out)
+	{
+		out.clear();
+		in_.get();
+		int c;
+		while ((c = in_.get()) != EOF && c != '"')
+		{
+			if (c != '\\')
+			{
+				out += char(c);
+				continue;
+			}
+			switch (c = in_.get())
+			{
+			case 'b': out += '\b'; break;
+			case 'f': out += '\f'; break;
+			case 'n': out += '\n'; break;
+			case 'r': out += '\r'; break;
+			case 't': out += '\t'; break;
+			case 'u':
+			{
+				unsigned code = hex();
+				if (code >= 0xD800 && code < 0xDC00 && in_.peek() == '\\')
+				{
+					in_.get();
+					if (in_.get() != 'u')
+						return false;
+					code = 0x10000 + ((code - 0xD800) << 10) + (hex() - 0xDC00);
+				}
+				utf8(code, out);
+				break;
+			}
+			case EOF: return false;
+			default: out += char(c); /* " \ / */
+			}
+		}
+		return c == '"';
+	}
+	
+	unsigned hex()
+	{
+		unsigned code = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			int c = in_.get();
+			code = code * 16 + (std::isdigit(c) ? c - '0' : (std::tolower(c) - 'a' + 10) & 15);
+		}
+		return code;
+	}
+	
+	static void utf8(unsigned code, std::string& out)
+	{
+		if (code < 0x80)
+			out += char(code);
+		else if (code < 0x800)
+		{
+			out += char(0xC0 | (code >> 6));
+			out += char(0x80 | (code & 0x3F));
+		}
+		else if (code < 0x10000)
+		{
+			out += char(0xE0 | (code >> 12));
+			out += char(0x80 | ((code >> 6) & 0x3F));
+			out += char(0x80 | (code & 0x3F));
+		}
+		else
+		{
+			out += char(0xF0 | (code >> 18));
+			out += char(0x80 | ((code >> 12) & 0x3F));
+			out += char(0x80 | ((code >> 6) & 0x3F));
+			out += char(0x80 | (code & 0x3F));
+		}
+	}
+	
+	/* Skip nested object or array */
+	void nested()
+	{
+		int depth = 0;
+		int c;
+		while ((c = in_.peek()) != EOF)
+		{
+			if (c == '"')
+			{
+				quoted(value_);
+				continue;
+			}
+			in_.get();
+			if (c == '{' || c == '[')
+				++depth;
+			else if ((c == '}' || c == ']') && --depth == 0)
+				return;
+		}
+	}
+	
+	text_source in_;
+	std::map<std::string, field_schema*> fields_;
+	std::string key_;
+	std::string value_;
+};
+
+/**
+ * Import rows from CSV stream. First line names columns, which are
+ * matched with fields by name. Rows with values which can not be parsed
+ * are skipped. Table must have default constructor.
+ * @param pipelined parse on another thread while rows are put
+ * @return number of imported rows
+ */
+template <typename T>
+std::size_t read_csv(dbset<T>& set, std::istream& in, bool pipelined = false)
+{
+	T prototype;
+	csv_parser<T> parser(in, prototype.schema_);
+	return import_rows(set, parser, prototype, pipelined);
+}
+
+/**
+ * Import rows from JSON stream, array of objects or objects one after
+ * another. Members are matched with fields by name.
+ * @see read_csv
+ */
+template <typename T>
+std::size_t read_json(dbset<T>& set, std::istream& in, bool pipelined = false)
+{
+	T prototype;
+	json_parser<T> parser(in, prototype.schema_);
+	return import_rows(set, parser, prototype, pipelined);
+}
+
+/* Append CSV value, quoted when needed */
+inline void csv_value(const std::string& value, std::string& out)
+{
+	if (value.find_first_of(",\"\r\n") == std::string::npos)
+	{
+		out += value;
+		return;
+	}
+	out += '"';
+	for (std::string::const_iterator it(value.begin()), end(value.end()); it != end; ++it)
+	{
+		if (*it == '"')
+			out += '"';
+		out += *it;
+	}
+	out += '"';
+}
+
+/* Append JSON string */
+inline void json_string(const std::string& value, std::string& out)
+{
+	out += '"';
+	for (std::string::const_iterator it(value.begin()), end(value.end()); it != end; ++it)
+	{
+		unsigned char c = *it;
+		switch (c)
+		{
+		case '"': out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\n': out += "\\n"; break;
+		case '\r': out += "\\r"; break;
+		case '\t': out += "\\t"; break;
+		default:
+			if (c < 0x20)
+			{
+				char escaped[8];
+				std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+				out += escaped;
+			}
+			else
+				out += char(c);
+		}
+	}
+	out += '"';
+}
+
+/**
+ * Write rows as CSV, with header naming fields. Rows are read straight
+ * from any range, like query_view or result of filter().
+ * Nothing is written for empty range.
+ */
+template <typename R>
+void write_csv(std::ostream& out, R& rows)
+{
+	text_sink sink(out);
+	std::string& buffer = sink.buffer();
+	std::string value;
+	bool header = true;
+	for (typename R::iterator it(rows.begin()), last(rows.end()); it != last; ++it)
+	{
+		table_schema* schema = it->schema_;
+		if (header)
+		{
+			for (std::size_t i = 0; i < schema->fields_.size(); ++i)
+			{
+				if (i)
+					buffer += ',';
+				csv_value(schema->fields_[i]->name_, buffer);
+			}
+			buffer += '\n';
+			header = false;
+		}
+		for (std::size_t i = 0; i < schema->fields_.size(); ++i)
+		{
+			if (i)
+				buffer += ',';
+			value.clear();
+			schema->fields_[i]->get(&*it)->format(value);
+			csv_value(value, buffer);
+		}
+		buffer += '\n';
+		sink.next();
+	}
+}
+
+/**
+ * Write rows as JSON array of objects. TEXT fields are written as
+ * strings, others as they are formatted.
+ * @see write_csv
+ */
+template <typename R>
+void write_json(std::ostream& out, R& rows)
+{
+	text_sink sink(out);
+	std::string& buffer = sink.buffer();
+	std::string value;
+	buffer += '[';
+	bool first = true;
+	for (typename R::iterator it(rows.begin()), last(rows.end()); it != last; ++it)
+	{
+		table_schema* schema = it->schema_;
+		buffer += first ? "\n{" : ",\n{";
+		first = false;
+		for (std::size_t i = 0; i < schema->fields_.size(); ++i)
+		{
+			field_schema* fs = schema->fields_[i].get();
+			if (i)
+				buffer += ',';
+			json_string(fs->name_, buffer);
+			buffer += ':';
+			value.clear();
+			fs->get(&*it)->format(value);
+			if (fs->type_ == "TEXT")
+				json_string(value, buffer);
+			else
+				buffer += value;
+		}
+		buffer += '}';
+		sink.next();
+	}
+	buffer += "\n]\n";
+}
+
+/**
+ * Puts rows into set from another thread. Every thread uses its own
+ * producer, which collects rows and hands them over to the set in
+ * batches without locking. Rows are put when set is merged.
+ * @code
+ * producer<person> p(ctx.persons);
+ * p.put(person("John", "Smith"));
+ * ...
+ * ctx.persons.merge();
+ * @endcode
+ */
+template <typename T /* Table */>
+struct producer
+{
+	producer(dbset<T>& set): set_(set)
+	{
+		rows_.reserve(producer_batch);
+	}
+	
+	~producer()
+	{
+		flush();
+	}
+	
+	void put(T t)
+	{
+		rows_.push_back(std::move(t));
+		if (rows_.size() >= producer_batch)
+			flush();
+	}
+	
+	/* Hand over collected rows now */
+	void flush()
+	{
+		set_.push(std::move(rows_));
+		rows_.clear();
+		rows_.reserve(producer_batch);
+	}
+	
+private:
+	producer(const producer&);
+	producer& operator=(const producer&);
+	
+	dbset<T>& set_;
+	std::vector<T> rows_;
+};
+
+/**
+ * Rows of set matching expression, evaluated lazily.
+ * View is valid as long as rows are not inserted into set.
+ */
+template <typename T /* Table */, typename F /* Expression */>
+struct query_view
+{
+	typedef T value_type;
+	
+	struct iterator
+	{
+		typedef std::forward_iterator_tag iterator_category;
+		typedef T value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef T* pointer;
+		typedef T& reference;
+		
+		iterator(): view_(NULL), slot_(0) {}
+		
+		iterator(query_view* view, std::size_t slot):
+			view_(view), slot_(slot)
+		{
+			skip();
+		}
+		
+		T& operator*() const { return view_->set_->rows_[view_->position(slot_)]; }
+		T* operator->() const { return &**this; }
+		
+		iterator& operator++()
+		{
+			++slot_;
+			skip();
+			return *this;
+		}
+		
+		iterator operator++(int)
+		{
+			iterator tmp(*this);
+			++*this;
+			return tmp;
+		}
+		
+		/* Position of current row in set */
+		std::size_t position() const { return view_->position(slot_); }
+		
+		bool operator==(const iterator& other) const { return slot_ == other.slot_; }
+		bool operator!=(const iterator& other) const { return slot_ != other.slot_; }
+		
+	private:
+		/* Advance to first matching row */
+		void skip()
+		{
+			while (slot_ < view_->slots_ && !view_->exact_ && !view_->kernel_(
+				row_ref<T>(view_->set_, view_->position(slot_))))
+			{
+				++slot_;
+			}
+		}
+		
+		query_view* view_;
+		std::size_t slot_;
+	};
+	
+	query_view(dbset<T>* set, F f):
+		set_(set), f_(f), kernel_(plan<F>::make(f)), slots_(0),
+		indexed_(false), exact_(false) {}
+	
+	/**
+	 * Start iterating. Rows are looked up in index or selected by
+	 * vectorized scan when possible.
+	 */
+	iterator begin()
+	{
+		positions_.clear();
+		exact_ = false;
+		indexed_ = set_->lookup(f_, kernel_, positions_, exact_);
+		slots_ = indexed_ ? positions_.size() : set_->rows_.size();
+		return iterator(this, 0);
+	}
+	
+	iterator end()
+	{
+		return iterator(this, slots_);
+	}
+	
+	/* Count matching rows */
+	std::size_t count()
+	{
+		iterator first(begin());
+		return std::distance(first, end());
+	}
+	
+	bool empty()
+	{
+		iterator first(begin());
+		return first == end();
+	}
+	
+	/**
+	 * Compute aggregates over matching rows in single pass.
+	 * @see dbset::aggregate
+	 */
+	template <typename... A>
+	typename aggregate_list<A...>::result_type aggregate(A... aggs)
+	{
+		aggregate_list<A...> list(aggs...);
+		for (iterator it(begin()), last(end()); it != last; ++it)
+			list.add(row_ref<T>(set_, it.position()));
+		return list.result();
+	}
+	
+	/**
+	 * Compute aggregates of matching rows for every value of key field.
+	 * @see dbset::group_by
+	 */
+	template <typename K, typename... A>
+	std::map<K, typename aggregate_list<A...>::result_type> group_by(
+		field_impl<K, T> key, A... aggs)
+	{
+		std::map<K, aggregate_list<A...> > groups;
+		for (iterator it(begin()), last(end()); it != last; ++it)
+			dbset<T>::group(groups, key, row_ref<T>(set_, it.position()), aggs...);
+		return dbset<T>::results(groups);
+	}
+	
+	/**
+	 * Matching rows ordered by field, rows with equal keys in order of
+	 * set. Use limit() and offset() to take a page of them.
+	 * @code persons.where(F(&person::second_name) == "Smith").order_by(F(&person::id), true).limit(10) @endcode
+	 */
+	template <typename K>
+	ordered_view<T, F, K> order_by(field_impl<K, T> key, bool descending = false)
+	{
+		return ordered_view<T, F, K>(*this, key, descending);
+	}
+	
+	dbset<T>* set_;
+	F f_;
+	typename plan<F>::type kernel_;
+	
+private:
+	std::size_t position(std::size_t slot) const
+	{
+		return indexed_ ? positions_[slot] : slot;
+	}
+	
+	/* Candidates from index or vectorized scan */
+	std::vector<std::size_t> positions_;
+	std::size_t slots_;
+	bool indexed_;
+	bool exact_; /* All candidates match */
+};
+
+/**
+ * Rows of query view ordered by key field, from offset() to limit().
+ * With limit only best offset + limit rows are kept in a bounded heap
+ * while scanning, or ordered index of key is walked until enough rows
+ * match. Rows are never copied, only keys and positions are sorted.
+ * View is valid as long as set is not changed.
+ */
+template <typename T /* Table */, typename F /* Expression */, typename K /* Key */>
+struct ordered_view
+{
+	typedef T value_type;
+	
+	/* Key of row and its position in set */
+	typedef std::pair<K, std::size_t> entry;
+	
+	struct iterator
+	{
+		typedef std::forward_iterator_tag iterator_category;
+		typedef T value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef T* pointer;
+		typedef T& reference;
+		
+		iterator(): view_(NULL), slot_(0) {}
+		
+		iterator(ordered_view* view, std::size_t slot):
+			view_(view), slot_(slot) {}
+		
+		T& operator*() const { return view_->query_.set_->rows_[position()]; }
+		T* operator->() const { return &**this; }
+		
+		iterator& operator++()
+		{
+			++slot_;
+			return *this;
+		}
+		
+		iterator operator++(int)
+		{
+			iterator tmp(*this);
+			++*this;
+			return tmp;
+		}
+		
+		/* Position of current row in set */
+		std::size_t position() const { return view_->entries_[slot_].second; }
+		
+		bool operator==(const iterator& other) const { return slot_ == other.slot_; }
+		bool operator!=(const iterator& other) const { return slot_ != other.slot_; }
+		
+	private:
+		ordered_view* view_;
+		std::size_t slot_;
+	};
+	
+	ordered_view(const query_view<T, F>& query, field_impl<K, T> key, bool descending):
+		query_(query), key_(key), descending_(descending),
+		offset_(0), limit_(std::size_t(-1)) {}
+	
+	/* Skip first n rows */
+	ordered_view& offset(std::size_t n)
+	{
+		offset_ = n;
+		return *this;
+	}
+	
+	/* Yield at most n rows */
+	ordered_view& limit(std::size_t n)
+	{
+		limit_ = n;
+		return *this;
+	}
+	
+	/**
+	 * Select and order rows.
+	 */
+	iterator begin()
+	{
+		entries_.clear();
+		std::size_t wanted = limit_ == std::size_t(-1) || offset_ > std::size_t(-1) - limit_ ?
+			std::size_t(-1) : offset_ + limit_;
+		if (wanted != 0 && !walk(wanted))
+		{
+			if (wanted == std::size_t(-1))
+				sort();
+			else
+				top(wanted);
+		}
+		entries_.erase(entries_.begin(), entries_.begin() + std::min(offset_, entries_.size()));
+		return iterator(this, 0);
+	}
+	
+	iterator end()
+	{
+		return iterator(this, entries_.size());
+	}
+	
+private:
+	/* Order of entries, ties broken by position */
+	bool before(const entry& a, const entry& b) const
+	{
+		if (descending_ ? b.first < a.first : a.first < b.first)
+			return true;
+		if (descending_ ? a.first < b.first : b.first < a.first)
+			return false;
+		return a.second < b.second;
+	}
+	
+	entry make_entry(std::size_t pos)
+	{
+		return entry(key_(row_ref<T>(query_.set_, pos)), pos);
+	}
+	
+	/* Order all matching rows */
+	void sort()
+	{
+		for (typename query_view<T, F>::iterator it(query_.begin()), last(query_.end());
+			it != last; ++it)
+		{
+			entries_.push_back(make_entry(it.position()));
+		}
+		std::sort(entries_.begin(), entries_.end(),
+			[this](const entry& a, const entry& b) { return before(a, b); });
+	}
+	
+	/* Keep best n matching rows in heap with the worst one on top */
+	void top(std::size_t n)
+	{
+		auto worse = [this](const entry& a, const entry& b) { return before(a, b); };
+		for (typename query_view<T, F>::iterator it(query_.begin()), last(query_.end());
+			it != last; ++it)
+		{
+			entry e(make_entry(it.position()));
+			if (entries_.size() < n)
+			{
+				entries_.push_back(std::move(e));
+				std::push_heap(entries_.begin(), entries_.end(), worse);
+			}
+			else if (before(e, entries_.front()))
+			{
+				std::pop_heap(entries_.begin(), entries_.end(), worse);
+				entries_.back() = std::move(e);
+				std::push_heap(entries_.begin(), entries_.end(), worse);
+			}
+		}
+		std::sort_heap(entries_.begin(), entries_.end(), worse);
+	}
+	
+	/**
+	 * Walk ordered index of key until n rows match.
+	 * @return false if key has no ordered index
+	 */
+	bool walk(std::size_t n)
+	{
+		if (n == std::size_t(-1))
+			return false;
+		ordered_index<K, T>* idx = query_.set_->template find_index<ordered_index>(key_.field_);
+		if (!idx)
+			return false;
+		if (descending_)
+			walk(idx->map_.rbegin(), idx->map_.rend(), n);
+		else
+			walk(idx->map_.begin(), idx->map_.end(), n);
+		return true;
+	}
+	
+	template <typename It>
+	void walk(It first, It last, std::size_t n)
+	{
+		for (; first != last && entries_.size() < n; ++first)
+		{
+			for (index_positions::const_iterator pos(first->second.begin()),
+				end(first->second.end()); pos != end && entries_.size() < n; ++pos)
+			{
+				if (query_.kernel_(row_ref<T>(query_.set_, *pos)))
+					entries_.push_back(entry(first->first, *pos));
+			}
+		}
+	}
+	
+	query_view<T, F> query_;
+	field_impl<K, T> key_;
+	bool descending_;
+	std::size_t offset_;
+	std::size_t limit_;
+	std::vector<entry> entries_; /* Selected rows in order */
+};
+
+/**
+ * Equi-join of two sets, evaluated lazily. Rows of smaller (build) set
+ * are hashed by key once, when iteration starts, unless its key has
+ * hash index already. Rows of the other (probe) set are then looked up
+ * one by one, so pairs come in order of probe set.
+ * View is valid as long as sets are not changed, and only one iterator
+ * of view is in use at a time.
+ */
+template <typename A /* Left table */, typename B /* Right table */, typename V /* Key */>
+struct join_view
+{
+	typedef std::pair<A&, B&> value_type;
+	
+	struct iterator
+	{
+		typedef std::forward_iterator_tag iterator_category;
+		typedef std::pair<A&, B&> value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef void pointer;
+		typedef value_type reference;
+		
+		iterator(): view_(NULL), probe_(0), slot_(0) {}
+		
+		iterator(join_view* view, std::size_t probe):
+			view_(view), probe_(probe), slot_(0)
+		{
+			seek();
+		}
+		
+		value_type operator*() const { return view_->pair(probe_, slot_); }
+		
+		iterator& operator++()
+		{
+			if (++slot_ == view_->current_->size())
+			{
+				++probe_;
+				slot_ = 0;
+				seek();
+			}
+			return *this;
+		}
+		
+		iterator operator++(int)
+		{
+			iterator tmp(*this);
+			++*this;
+			return tmp;
+		}
+		
+		bool operator==(const iterator& other) const
+		{
+			return probe_ == other.probe_ && slot_ == other.slot_;
+		}
+		
+		bool operator!=(const iterator& other) const { return !(*this == other); }
+		
+	private:
+		/* Advance to first probe row with matches */
+		void seek()
+		{
+			for (; probe_ < view_->probe_rows(); ++probe_)
+			{
+				if (view_->probe(probe_))
+					return;
+			}
+		}
+		
+		join_view* view_;
+		std::size_t probe_; /* Position in probe set */
+		std::size_t slot_; /* Match of probe row */
+	};
+	
+	join_view(dbset<A>* left, field_impl<V, A> left_key,
+		dbset<B>* right, field_impl<V, B> right_key):
+		left_(left), left_key_(left_key), right_(right), right_key_(right_key),
+		build_left_(true), left_index_(NULL), right_index_(NULL), current_(NULL) {}
+	
+	/**
+	 * Hash build set and start iterating.
+	 */
+	iterator begin()
+	{
+		table_.clear();
+		build_left_ = left_->size() <= right_->size();
+		if (build_left_)
+			build(left_, left_key_, left_index_);
+		else
+			build(right_, right_key_, right_index_);
+		return iterator(this, 0);
+	}
+	
+	iterator end()
+	{
+		return iterator(this, probe_rows());
+	}
+	
+private:
+	typedef std::unordered_map<V, std::vector<std::size_t> > table_type;
+	
+	template <typename T>
+	void build(dbset<T>* set, field_impl<V, T>& key, hash_index<V, T>*& index)
+	{
+		index = set->template find_index<hash_index>(key.field_);
+		if (index)
+			return;
+		for (std::size_t i = 0, n = set->rows_.size(); i < n; ++i)
+		{
+			if (!set->removed_.test(i))
+				table_[key(row_ref<T>(set, i))].push_back(i);
+		}
+	}
+	
+	std::size_t probe_rows() const
+	{
+		return build_left_ ? right_->rows_.size() : left_->rows_.size();
+	}
+	
+	/**
+	 * Find rows of build set matching probe row at given position.
+	 * @return false if there are none
+	 */
+	bool probe(std::size_t pos)
+	{
+		return build_left_ ? probe(right_, right_key_, left_index_, pos) :
+			probe(left_, left_key_, right_index_, pos);
+	}
+	
+	template <typename T, typename I>
+	bool probe(dbset<T>* set, field_impl<V, T>& key, I* index, std::size_t pos)
+	{
+		if (set->removed_.test(pos))
+			return false;
+		const V& k = key(row_ref<T>(set, pos));
+		if (index)
+		{
+			matches_.clear();
+			index->equal(k, matches_);
+			current_ = &matches_;
+			return !matches_.empty();
+		}
+		typename table_type::const_iterator it(table_.find(k));
+		if (it == table_.end())
+			return false;
+		current_ = &it->second;
+		return true;
+	}
+	
+	value_type pair(std::size_t probe, std::size_t slot) const
+	{
+		std::size_t match = (*current_)[slot];
+		return build_left_ ? value_type(left_->rows_[match], right_->rows_[probe]) :
+			value_type(left_->rows_[probe], right_->rows_[match]);
+	}
+	
+	dbset<A>* left_;
+	field_impl<V, A> left_key_;
+	dbset<B>* right_;
+	field_impl<V, B> right_key_;
+	
+	bool build_left_;
+	hash_index<V, A>* left_index_; /* Used instead of table when set */
+	hash_index<V, B>* right_index_;
+	table_type table_; /* Key to positions of rows of build set */
+	std::vector<std::size_t> matches_; /* Matches found in index */
+	const std::vector<std::size_t>* current_; /* Matches of current probe row */
+};
+
+/* Useful macros 
+ * @note evaluated_type is not an macro, its actual type of struct
+ * with all template parameters typed in.
+ * 
+ * template <typename A1, typename A2, ..., typename An>
+ * struct dummy_impl
+ * {
+ *     typedef dummy_impl<A1, A2, ..., An> evaluated_type;
+ * };
+ */
+#define __CAT(a, b) a##b
+#define _CAT(a, b) __CAT(a, b)
+#define IMPLEMENT_OPERATOR_UNIQ(operator_impl, canonical_name, uniq) \
+	template <typename _CAT(F, uniq)> \
+	operator_impl<evaluated_type, _CAT(F, uniq)> operator canonical_name(_CAT(F, uniq) f) \
+	{ \
+		return operator_impl<evaluated_type, _CAT(F, uniq)>(*this, f); \
+	}
+	
+/* In case of already used template names we use __COUNTER__ to
+ * ensure the template name will be unique. */
+#define IMPLEMENT_OPERATOR(operator_impl, canonical_name) \
+	IMPLEMENT_OPERATOR_UNIQ(operator_impl, canonical_name, __COUNTER__)
+
+/**
+ * Chain operator implementation
+ * This is not static operator because of possible compilation failure
+ */
+template <typename T1, typename T2>
+struct chain_impl
 {
 	typedef chain_impl<T1, T2> evaluated_type;
 	typedef typename T1::object_type object_type;
 	
-	chain_impl(T1 t1, T2 t2): t1_(t1), t2_(t2) {}
-	T1 t1_;
-	T2 t2_;
+	chain_impl(T1 t1, T2 t2): t1_(t1), t2_(t2) {}
+	T1 t1_;
+	T2 t2_;
+	template <typename F1>
+	bool operator()(F1 f1)
+	{
+		t1_(f1);
+		t2_(f1);
+		return true;
+	}
+};
+
+template <typename T1, typename T2>
+struct or_impl;
+
+/**
+ * Implementation of operator& (logical AND)
+ */
+template <typename T1, typename T2>
+struct and_impl
+{
+	typedef and_impl<T1, T2> evaluated_type;
+	typedef typename T1::object_type object_type;
+	
+	T1 expr_;
+	T2 value_;
+	
+	and_impl(T1 t, T2 value): expr_(t), value_(value) {}
+	
+	template <typename T>
+	bool operator()(T obj)
+	{
+		return expr_(obj) && value_(obj);
+	}
+	
+	/* Ops */
+	IMPLEMENT_OPERATOR(and_impl, &)
+	IMPLEMENT_OPERATOR(or_impl, |)
+};
+
+/**
+ * Implementation of operator| (logical OR)
+ */
+template <typename T1, typename T2>
+struct or_impl
+{
+	typedef or_impl<T1, T2> evaluated_type;
+	typedef typename T1::object_type object_type;
+	
+	T1 expr_;
+	T2 value_;
+	
+	or_impl(T1 t, T2 value): expr_(t), value_(value) {}
+	
+	template <typename T>
+	bool operator()(T obj)
+	{
+		return expr_(obj) || value_(obj);
+	}
+	
+	/* Ops */
+	IMPLEMENT_OPERATOR(and_impl, &)
+	IMPLEMENT_OPERATOR(or_impl, |)
+};
+
+/**
+ * Assignment operator implementation
+ * Can not be static
+ */
+template <typename T1, typename T2>
+struct assign_impl
+{
+	typedef assign_impl<T1, T2> evaluated_type;
+	typedef typename T1::object_type object_type;
+	
+	assign_impl(T1 t1, T2 t2): t1_(t1), t2_(t2) {}
+	T1 t1_;
+	T2 t2_;
+	
+	template <typename F1>
+	bool operator()(F1 f1)
+	{
+		t1_(f1) = t2_(f1);
+		return true;
+	}
+	
+	template <typename A1, typename A2>
+	chain_impl<assign_impl<T1, T2>, assign_impl<A1, A2> > operator,(assign_impl<A1, A2> f)
+	{
+		return chain_impl<assign_impl<T1, T2>, assign_impl<A1, A2> >(*this, f);
+	}
+};
+
+/**
+ * Implementation of operator== (logical AND)
+ */
+template <typename T1, typename T2>
+struct eq_impl
+{
+	typedef eq_impl<T1, T2> evaluated_type;
+	typedef typename T1::object_type object_type;
+	
+	T1 expr_;
+	T2 value_;
+	
+	eq_impl(T1 t, T2 value):
+		expr_(t), value_(value) {}
+	
+	template <typename F1>
+	bool operator()(F1 obj)
+	{
+		return expr_(obj) == value_;
+	}
+	
+	template <typename F1, typename F2>
+	F1 operator()(F1 obj, F2 val)
+	{
+		return expr_(obj, val) == value_;
+	}
+	
+	/* Ops */
+	IMPLEMENT_OPERATOR(and_impl, &)
+	IMPLEMENT_OPERATOR(or_impl, |)
+};
+
+/**
+ * Implementation of operator!= (logical NOT EQUAL)
+ */
+template <typename T1, typename T2>
+struct neq_impl
+{
+	typedef neq_impl<T1, T2> evaluated_type;
+	typedef typename T1::object_type object_type;
+	
+	T1 expr_;
+	T2 value_;
+	
+	neq_impl(T1 t, T2 value): expr_(t), value_(value) {}
+	
+	template <typename F1>
+	bool operator()(F1 obj)
+	{
+		return expr_(obj) != value_;
+	}
+	
+	template <typename F1, typename F2>
+	F1 operator()(F1 obj, F2 val)
+	{
+		return expr_(obj, val) != value_;
+	}
+	
+	/* Ops */
+	IMPLEMENT_OPERATOR(and_impl, &)
+	IMPLEMENT_OPERATOR(or_impl, |)
+};
+
+/**
+ * Implementation of operator> (logical GREATER THAN)
+ */
+template <typename T1, typename T2>
+struct gt_impl
+{
+	typedef gt_impl<T1, T2> evaluated_type;
+	
+	typedef typename T1::object_type object_type;
+	
+	T1 expr_;
+	T2 value_;
+	
+	gt_impl(T1 t, T2 value): expr_(t), value_(value) {}
+	
+	template <typename F1>
+	bool operator()(F1 obj)
+	{
+		return expr_(obj) > value_;
+	}
+	
+	template <typename F1, typename F2>
+	F1 operator()(F1 obj, F2 val)
+	{
+		return expr_(obj, val) > value_;
+	}
+	
+	/* Ops */
+	IMPLEMENT_OPERATOR(and_impl, &)
+	IMPLEMENT_OPERATOR(or_impl, |)
+};
+
+/**
+ * Implementation of operator< (logical LOWER THAN)
+ */
+template <typename T1, typename T2>
+struct lt_impl
+{
+	typedef lt_impl<T1, T2> evaluated_type;
+	typedef typename T1::object_type object_type;
+	
+	T1 expr_;
+	T2 value_;
+	
+	lt_impl(T1 t, T2 value): expr_(t), value_(value) {}
+	
+	template <typename F1>
+	bool operator()(F1 obj)
+	{
+		return expr_(obj) < value_;
+	}
+	
+	template <typename F1, typename F2>
+	F1 operator()(F1 obj, F2 val)
+	{
+		return expr_(obj, val) < value_;
+	}
+	
+	/* Ops */
+	IMPLEMENT_OPERATOR(and_impl, &)
+	IMPLEMENT_OPERATOR(or_impl, |)
+};
+
+template <typename T1>
+struct value_impl
+{
+	/**
+	 * Ugly hack to know the type of trapped value
+	 */
+	typedef T1 value_type;
+	typedef value_impl<T1> evaluated_type;
+	
+	value_impl(T1 t1): t1_(t1) {}
+	T1 t1_;
+	
+	/**
+	 * Return trapped value
+	 */
+	T1 operator()() { return t1_; }
+	
+	/**
+	 * Return trapped value and act as field_impl.
+	 */
+	template <typename F>
+	T1 operator()(F) { return t1_; }
+	
+	/**
+	 * If accidental implicit conversion happens...
+	 */
+	operator value_type() { return t1_; }
+};
+
+/**
+ * Implementation of operator+ (A + B)
+ */
+template <typename T1, typename T2>
+struct plus_impl
+{
+	typedef T1 value_type; /* plus_impl acts as value_impl too... */
+	
+	T1 expr_;
+	T2 value_;
+	
+	plus_impl(T1 t, T2 value): expr_(t), value_(value) {}
+	
+	template <typename F>
+	value_impl<typename T1::value_type> operator()(F obj)
+	{
+		return value_impl<typename T1::value_type>(expr_(obj) + value_(obj));
+	}
+};
+
+/**
+ * Value holder
+ */
+template <typename T1>
+value_impl<T1> val(T1 t1)
+{
+	return value_impl<T1>(t1);
+}
+
+/**
+ * This class will be evaluated later to value from member class field.
+ */
+template <typename T1, typename T2>
+struct field_impl
+{
+	typedef field_impl<T1, T2> evaluated_type;
+	typedef T2 object_type;
+	
+	typedef T1 value_type;
+	field<T1> T2::* field_;
+	
+	/* Column lookup cache */
+	dbset<T2>* set_;
+	column<T1, T2>* column_;
+	
+	field_impl(field<T1> T2::* t): field_(t), set_(NULL), column_(NULL) {}
+	
+	template <typename F>
+	assign_impl<field_impl<T1, T2>, F> operator=(F f)
+	{
+		return assign_impl<field_impl<T1, T2>, F>(*this, f);
+	}
+	
+	template <typename F1>
+	T1& operator()(F1 obj)
+	{
+		return (*obj.*field_).value_;
+	}
+	
+	/**
+	 * Read value of stored row. Column is used when set has one.
+	 */
+	const T1& operator()(row_ref<T2> ref)
+	{
+		if (ref.set_ != set_)
+		{
+			set_ = ref.set_;
+			column_ = set_->find_column(field_);
+		}
+		if (column_)
+			return (*column_)[ref.pos_];
+		return ((*ref).*field_).value_;
+	}
+	
+	/* Ops */
+	IMPLEMENT_OPERATOR(eq_impl, ==)
+	IMPLEMENT_OPERATOR(and_impl, &)
+	IMPLEMENT_OPERATOR(lt_impl, <)
+	IMPLEMENT_OPERATOR(gt_impl, >)
+	IMPLEMENT_OPERATOR(plus_impl, +)
+};
+
+/* Aggregates
+ * Every aggregate is an expression which evaluates to its value over
+ * whole set of the evaluated row, like MAX() in triggers. Aggregates
+ * are also accumulated row by row by dbset::aggregate() and
+ * dbset::group_by(), which compute many of them in a single pass.
+ * Their state_type is maintained incrementally by dbset::materialize().
+ */
+
+/**
+ * Incremental state of COUNT aggregate.
+ * Every state reads value_type of row with value(), then the value
+ * is added or removed, so old value of changed row can be kept
+ * until row is updated.
+ */
+struct count_state
+{
+	typedef bool value_type;
+	
+	std::size_t count_;
+	
+	template <typename A>
+	count_state(const A&): count_(0) {}
+	
+	template <typename R>
+	bool value(const R&) const { return true; }
+	
+	void add(bool) { ++count_; }
+	void remove(bool) { --count_; }
+	
+	std::size_t result() const { return count_; }
+};
+
+/**
+ * Incremental state of SUM aggregate.
+ */
+template <typename T1 /* Table */, typename V>
+struct sum_state
+{
+	typedef V value_type;
+	
+	field<V> T1::* field_;
+	V value_;
+	
+	template <typename A>
+	sum_state(const A& agg): field_(agg.field_.field_), value_() {}
+	
+	const V& value(const T1& row) const { return (row.*field_).value_; }
+	
+	void add(const V& v) { value_ += v; }
+	void remove(const V& v) { value_ -= v; }
+	
+	V result() const { return value_; }
+};
+
+/**
+ * Incremental state of AVG aggregate.
+ */
+template <typename T1 /* Table */, typename V>
+struct avg_state
+{
+	typedef V value_type;
+	
+	field<V> T1::* field_;
+	double sum_;
+	std::size_t count_;
+	
+	template <typename A>
+	avg_state(const A& agg): field_(agg.field_.field_), sum_(0), count_(0) {}
+	
+	const V& value(const T1& row) const { return (row.*field_).value_; }
+	
+	void add(const V& v) { sum_ += v; ++count_; }
+	void remove(const V& v) { sum_ -= v; --count_; }
+	
+	double result() const { return count_ ? sum_ / count_ : 0; }
+};
+
+/**
+ * Incremental state of MIN and MAX aggregates.
+ * Values are counted in ordered map, so removing current extreme
+ * does not need a scan.
+ */
+template <typename T1 /* Table */, typename V, bool Max>
+struct extreme_state
+{
+	typedef V value_type;
+	
+	field<V> T1::* field_;
+	std::map<V, std::size_t> values_;
+	
+	template <typename A>
+	extreme_state(const A& agg): field_(agg.field_.field_) {}
+	
+	const V& value(const T1& row) const { return (row.*field_).value_; }
+	
+	void add(const V& v) { ++values_[v]; }
+	
+	void remove(const V& v)
+	{
+		typename std::map<V, std::size_t>::iterator it(values_.find(v));
+		if (--it->second == 0)
+			values_.erase(it);
+	}
+	
+	/* Extreme value or V() if there are no rows */
+	V result() const
+	{
+		if (values_.empty())
+			return V();
+		return Max ? values_.rbegin()->first : values_.begin()->first;
+	}
+};
+
+/**
+ * Implementation of MAX aggregate.
+ */
+template <typename T1 /* Table */, typename V>
+struct max_impl
+{
+	typedef max_impl<T1, V> evaluated_type;
+	typedef V value_type;
+	typedef V result_type;
+	typedef extreme_state<T1, V, true> state_type;
+	
+	field_impl<V, T1> field_;
+	bool empty_;
+	V value_;
+	
+	max_impl(field_impl<V, T1> fld) :
+		field_(fld), empty_(true), value_() {}
+	
+	template <typename F1>
+	V operator()(F1 f)
+	{
+		dbset<T1>* set = static_cast<dbset<T1>*>(f->parent_);
+		return set->aggregate_of(*this);
+	}
+	
+	template <typename F1>
+	void add(F1 obj)
+	{
+		const V& v = field_(obj);
+		if (empty_ || value_ < v)
+		{
+			value_ = v;
+			empty_ = false;
+		}
+	}
+	
+	V result() const { return value_; }
+	
+	/* Aggregates the same field */
+	bool same(const max_impl& other) const { return field_.field_ == other.field_.field_; }
+	
+	IMPLEMENT_OPERATOR(plus_impl, +)
+};
+
+/**
+ * Implementation of MIN aggregate.
+ */
+template <typename T1 /* Table */, typename V>
+struct min_impl
+{
+	typedef min_impl<T1, V> evaluated_type;
+	typedef V value_type;
+	typedef V result_type;
+	typedef extreme_state<T1, V, false> state_type;
+	
+	field_impl<V, T1> field_;
+	bool empty_;
+	V value_;
+	
+	min_impl(field_impl<V, T1> fld) :
+		field_(fld), empty_(true), value_() {}
+	
 	template <typename F1>
-	bool operator()(F1 f1)
+	V operator()(F1 f)
 	{
-		t1_(f1);
-		t2_(f1);
+		dbset<T1>* set = static_cast<dbset<T1>*>(f->parent_);
+		return set->aggregate_of(*this);
+	}
+	
+	template <typename F1>
+	void add(F1 obj)
+	{
+		const V& v = field_(obj);
+		if (empty_ || v < value_)
+		{
+			value_ = v;
+			empty_ = false;
+		}
+	}
+	
+	V result() const { return value_; }
+	
+	/* Aggregates the same field */
+	bool same(const min_impl& other) const { return field_.field_ == other.field_.field_; }
+	
+	IMPLEMENT_OPERATOR(plus_impl, +)
+};
+
+/**
+ * Implementation of SUM aggregate.
+ */
+template <typename T1 /* Table */, typename V>
+struct sum_impl
+{
+	typedef sum_impl<T1, V> evaluated_type;
+	typedef V value_type;
+	typedef V result_type;
+	typedef sum_state<T1, V> state_type;
+	
+	field_impl<V, T1> field_;
+	V value_;
+	
+	sum_impl(field_impl<V, T1> fld) :
+		field_(fld), value_() {}
+	
+	template <typename F1>
+	V operator()(F1 f)
+	{
+		dbset<T1>* set = static_cast<dbset<T1>*>(f->parent_);
+		return set->aggregate_of(*this);
+	}
+	
+	template <typename F1>
+	void add(F1 obj)
+	{
+		value_ += field_(obj);
+	}
+	
+	V result() const { return value_; }
+	
+	/* Aggregates the same field */
+	bool same(const sum_impl& other) const { return field_.field_ == other.field_.field_; }
+	
+	IMPLEMENT_OPERATOR(plus_impl, +)
+};
+
+/**
+ * Implementation of AVG aggregate.
+ */
+template <typename T1 /* Table */, typename V>
+struct avg_impl
+{
+	typedef avg_impl<T1, V> evaluated_type;
+	typedef double value_type;
+	typedef double result_type;
+	typedef avg_state<T1, V> state_type;
+	
+	field_impl<V, T1> field_;
+	double sum_;
+	std::size_t count_;
+	
+	avg_impl(field_impl<V, T1> fld) :
+		field_(fld), sum_(0), count_(0) {}
+	
+	template <typename F1>
+	double operator()(F1 f)
+	{
+		dbset<T1>* set = static_cast<dbset<T1>*>(f->parent_);
+		return set->aggregate_of(*this);
+	}
+	
+	template <typename F1>
+	void add(F1 obj)
+	{
+		sum_ += field_(obj);
+		++count_;
+	}
+	
+	/* Average or 0 if there are no rows */
+	double result() const { return count_ ? sum_ / count_ : 0; }
+	
+	/* Aggregates the same field */
+	bool same(const avg_impl& other) const { return field_.field_ == other.field_.field_; }
+	
+	IMPLEMENT_OPERATOR(plus_impl, +)
+};
+
+/**
+ * Implementation of COUNT aggregate.
+ */
+struct count_impl
+{
+	typedef count_impl evaluated_type;
+	typedef std::size_t value_type;
+	typedef std::size_t result_type;
+	typedef count_state state_type;
+	
+	std::size_t count_;
+	
+	count_impl(): count_(0) {}
+	
+	template <typename F1>
+	std::size_t operator()(F1 f)
+	{
+		return f->parent_->size();
+	}
+	
+	template <typename F1>
+	void add(F1)
+	{
+		++count_;
+	}
+	
+	std::size_t result() const { return count_; }
+	
+	bool same(const count_impl&) const { return true; }
+	
+	IMPLEMENT_OPERATOR(plus_impl, +)
+};
+
+/**
+ * Get max value aggregate.
+ */
+template <typename T1, typename V>
+max_impl<T1, V> MAX(field_impl<V, T1> fld)
+{
+	return max_impl<T1, V>(fld);
+}
+
+/**
+ * Get min value aggregate.
+ */
+template <typename T1, typename V>
+min_impl<T1, V> MIN(field_impl<V, T1> fld)
+{
+	return min_impl<T1, V>(fld);
+}
+
+/**
+ * Get sum of values aggregate.
+ */
+template <typename T1, typename V>
+sum_impl<T1, V> SUM(field_impl<V, T1> fld)
+{
+	return sum_impl<T1, V>(fld);
+}
+
+/**
+ * Get average value aggregate.
+ */
+template <typename T1, typename V>
+avg_impl<T1, V> AVG(field_impl<V, T1> fld)
+{
+	return avg_impl<T1, V>(fld);
+}
+
+/**
+ * Get number of rows aggregate.
+ */
+inline count_impl COUNT()
+{
+	return count_impl();
+}
+
+/**
+ * Many aggregates accumulated together.
+ * Result is a tuple with results of every aggregate.
+ */
+template <>
+struct aggregate_list<>
+{
+	typedef std::tuple<> result_type;
+	
+	template <typename R>
+	void add(R) {}
+	
+	result_type result() const { return result_type(); }
+};
+
+template <typename A, typename... Rest>
+struct aggregate_list<A, Rest...>
+{
+	typedef std::tuple<typename A::result_type, typename Rest::result_type...> result_type;
+	
+	A head_;
+	aggregate_list<Rest...> tail_;
+	
+	aggregate_list(A head, Rest... rest): head_(head), tail_(rest...) {}
+	
+	template <typename R>
+	void add(R row)
+	{
+		head_.add(row);
+		tail_.add(row);
+	}
+	
+	result_type result() const
+	{
+		return std::tuple_cat(std::make_tuple(head_.result()), tail_.result());
+	}
+};
+
+/**
+ * As I can not force static operator to accept type of field<T1> T2::*
+ * I had to do this.
+ * This thing actually spawns new instance of field_impl which just
+ * holds fld value.
+ */
+template <typename T1, typename T2>
+field_impl<T1, T2> F(field<T1> T2::* fld)
+{
+	return field_impl<T1, T2>(fld);
+}
+
+/* Index lookups */
+
+/**
+ * Can value of type X be used as a key of field with type V?
+ * Only comparisons of field with plain values can use an index.
+ */
+template <typename V, typename X>
+struct is_key { enum { value = 0 }; };
+
+template <typename V>
+struct is_key<V, V> { enum { value = 1 }; };
+
+template <typename V>
+struct is_key<V, value_impl<V> > { enum { value = 1 }; };
+
+template <>
+struct is_key<std::string, const char*> { enum { value = 1 }; };
+
+template <>
+struct is_key<std::string, char*> { enum { value = 1 }; };
+
+template <>
+struct is_key<std::string, value_impl<const char*> > { enum { value = 1 }; };
+
+/* Convert compared value to index key */
+template <typename V, typename X>
+V index_key(const X& x)
+{
+	return V(x);
+}
+
+template <typename V, typename X>
+V index_key(const value_impl<X>& x)
+{
+	return V(x.t1_);
+}
+
+template <typename V, typename T, typename X, bool = is_key<V, X>::value>
+struct field_lookup
+{
+	static bool equal(dbset<T>& set, field<V> T::* fld, const X& x,
+		std::vector<std::size_t>& out)
+	{
+		if (hash_index<V, T>* idx = set.template find_index<hash_index>(fld))
+		{
+			idx->equal(index_key<V>(x), out);
+			return true;
+		}
+		if (ordered_index<V, T>* idx = set.template find_index<ordered_index>(fld))
+		{
+			idx->equal(index_key<V>(x), out);
+			return true;
+		}
+		return false;
+	}
+	
+	static bool less(dbset<T>& set, field<V> T::* fld, const X& x,
+		std::vector<std::size_t>& out)
+	{
+		if (ordered_index<V, T>* idx = set.template find_index<ordered_index>(fld))
+		{
+			idx->less(index_key<V>(x), out);
+			return true;
+		}
+		return false;
+	}
+	
+	static bool greater(dbset<T>& set, field<V> T::* fld, const X& x,
+		std::vector<std::size_t>& out)
+	{
+		if (ordered_index<V, T>* idx = set.template find_index<ordered_index>(fld))
+		{
+			idx->greater(index_key<V>(x), out);
+			return true;
+		}
+		return false;
+	}
+};
+
+/* Field compared with other expression. No index can help. */
+template <typename V, typename T, typename X>
+struct field_lookup<V, T, X, false>
+{
+	static bool equal(dbset<T>&, field<V> T::*, const X&, std::vector<std::size_t>&) { return false; }
+	static bool less(dbset<T>&, field<V> T::*, const X&, std::vector<std::size_t>&) { return false; }
+	static bool greater(dbset<T>&, field<V> T::*, const X&, std::vector<std::size_t>&) { return false; }
+};
+
+/* F(&T::member) == value */
+template <typename V, typename T, typename X>
+struct index_lookup<eq_impl<field_impl<V, T>, X>, T>
+{
+	static bool find(dbset<T>& set, eq_impl<field_impl<V, T>, X>& e,
+		std::vector<std::size_t>& out)
+	{
+		return field_lookup<V, T, X>::equal(set, e.expr_.field_, e.value_, out);
+	}
+};
+
+/* F(&T::member) < value */
+template <typename V, typename T, typename X>
+struct index_lookup<lt_impl<field_impl<V, T>, X>, T>
+{
+	static bool find(dbset<T>& set, lt_impl<field_impl<V, T>, X>& e,
+		std::vector<std::size_t>& out)
+	{
+		return field_lookup<V, T, X>::less(set, e.expr_.field_, e.value_, out);
+	}
+};
+
+/* F(&T::member) > value */
+template <typename V, typename T, typename X>
+struct index_lookup<gt_impl<field_impl<V, T>, X>, T>
+{
+	static bool find(dbset<T>& set, gt_impl<field_impl<V, T>, X>& e,
+		std::vector<std::size_t>& out)
+	{
+		return field_lookup<V, T, X>::greater(set, e.expr_.field_, e.value_, out);
+	}
+};
+
+/* expr1 & expr2. Intersection when both sides are indexed. */
+template <typename T1, typename T2, typename T>
+struct index_lookup<and_impl<T1, T2>, T>
+{
+	static bool find(dbset<T>& set, and_impl<T1, T2>& e,
+		std::vector<std::size_t>& out)
+	{
+		std::vector<std::size_t> left, right;
+		bool has_left = index_lookup<T1, T>::find(set, e.expr_, left);
+		bool has_right = index_lookup<T2, T>::find(set, e.value_, right);
+		if (has_left && has_right)
+		{
+			std::sort(left.begin(), left.end());
+			std::sort(right.begin(), right.end());
+			std::set_intersection(left.begin(), left.end(),
+				right.begin(), right.end(), std::back_inserter(out));
+		}
+		else if (has_left)
+			out.swap(left);
+		else if (has_right)
+			out.swap(right);
+		return has_left || has_right;
+	}
+};
+
+/* expr1 | expr2. Union when both sides are indexed. */
+template <typename T1, typename T2, typename T>
+struct index_lookup<or_impl<T1, T2>, T>
+{
+	static bool find(dbset<T>& set, or_impl<T1, T2>& e,
+		std::vector<std::size_t>& out)
+	{
+		std::vector<std::size_t> left, right;
+		if (!index_lookup<T1, T>::find(set, e.expr_, left) ||
+			!index_lookup<T2, T>::find(set, e.value_, right))
+		{
+			return false;
+		}
+		std::sort(left.begin(), left.end());
+		std::sort(right.begin(), right.end());
+		std::set_union(left.begin(), left.end(),
+			right.begin(), right.end(), std::back_inserter(out));
+		return true;
+	}
+};
+
+/* Query cache keys */
+
+/* Numbers and other plain values */
+template <typename V>
+struct query_key<V, typename std::enable_if<std::is_arithmetic<V>::value>::type>
+{
+	static bool append(const V& v, std::string& key, field_ids&)
+	{
+		key.append(reinterpret_cast<const char*>(&v), sizeof(v));
+		return true;
+	}
+};
+
+template <>
+struct query_key<std::string>
+{
+	static bool append(const std::string& v, std::string& key, field_ids&)
+	{
+		serializer<std::string>::write(key, v);
+		return true;
+	}
+};
+
+template <>
+struct query_key<const char*>
+{
+	static bool append(const char* v, std::string& key, field_ids& fields)
+	{
+		return query_key<std::string>::append(v, key, fields);
+	}
+};
+
+template <typename V>
+struct query_key<value_impl<V> >
+{
+	static bool append(const value_impl<V>& v, std::string& key, field_ids& fields)
+	{
+		return query_key<V>::append(v.t1_, key, fields);
+	}
+};
+
+/* Field is told apart from other fields of the same type by its offset */
+template <typename V, typename T>
+struct query_key<field_impl<V, T> >
+{
+	static bool append(const field_impl<V, T>& f, std::string& key, field_ids& fields)
+	{
+		std::ptrdiff_t id = field_id(f.field_);
+		key.append(reinterpret_cast<const char*>(&id), sizeof(id));
+		fields.push_back(id);
+		return true;
+	}
+};
+
+/* Operator with both operands */
+template <typename E, typename T1, typename T2>
+struct operands_key
+{
+	static bool append(const E& e, std::string& key, field_ids& fields)
+	{
+		return query_key<T1>::append(e.expr_, key, fields) &&
+			query_key<T2>::append(e.value_, key, fields);
+	}
+};
+
+template <typename T1, typename T2>
+struct query_key<eq_impl<T1, T2> >: operands_key<eq_impl<T1, T2>, T1, T2> {};
+
+template <typename T1, typename T2>
+struct query_key<neq_impl<T1, T2> >: operands_key<neq_impl<T1, T2>, T1, T2> {};
+
+template <typename T1, typename T2>
+struct query_key<lt_impl<T1, T2> >: operands_key<lt_impl<T1, T2>, T1, T2> {};
+
+template <typename T1, typename T2>
+struct query_key<gt_impl<T1, T2> >: operands_key<gt_impl<T1, T2>, T1, T2> {};
+
+template <typename T1, typename T2>
+struct query_key<and_impl<T1, T2> >: operands_key<and_impl<T1, T2>, T1, T2> {};
+
+template <typename T1, typename T2>
+struct query_key<or_impl<T1, T2> >: operands_key<or_impl<T1, T2>, T1, T2> {};
+
+template <typename T1, typename T2>
+struct query_key<plus_impl<T1, T2> >: operands_key<plus_impl<T1, T2>, T1, T2> {};
+
+/* F(&T::member) = expression */
+template <typename V, typename T, typename X>
+struct assigned_fields<assign_impl<field_impl<V, T>, X> >
+{
+	static bool collect(const assign_impl<field_impl<V, T>, X>& e, field_ids& out)
+	{
+		out.push_back(field_id(e.t1_.field_));
 		return true;
 	}
 };
 
-/**
- * Implementation of operator& (logical AND)
- */
+/* Assignments separated by comma */
 template <typename T1, typename T2>
-struct and_impl
+struct assigned_fields<chain_impl<T1, T2> >
 {
-	typedef and_impl<T1, T2> evaluated_type;
-	
-	T1 expr_;
-	T2 value_;
-	
-	and_impl(T1 t, T2 value): expr_(t), value_(value) {}
-	
-	template <typename T>
-	bool operator()(T obj)
+	static bool collect(const chain_impl<T1, T2>& e, field_ids& out)
 	{
-		return expr_(obj) && value_(obj);
+		return assigned_fields<T1>::collect(e.t1_, out) &&
+			assigned_fields<T2>::collect(e.t2_, out);
 	}
-	
-	/* Ops */
-	IMPLEMENT_OPERATOR(and_impl, &)
 };
 
+/* Expressions evaluated by worker pool */
+
+template <typename V>
+struct row_local<V, typename std::enable_if<std::is_arithmetic<V>::value>::type>
+{
+	enum { value = 1 };
+};
+
+template <>
+struct row_local<std::string> { enum { value = 1 }; };
+
+template <>
+struct row_local<const char*> { enum { value = 1 }; };
+
+template <typename V>
+struct row_local<value_impl<V> >: row_local<V> {};
+
+template <typename V, typename T>
+struct row_local<field_impl<V, T> > { enum { value = 1 }; };
+
+/* Operator with both operands */
+template <typename T1, typename T2>
+struct operands_local
+{
+	enum { value = row_local<T1>::value && row_local<T2>::value };
+};
+
+template <typename T1, typename T2>
+struct row_local<eq_impl<T1, T2> >: operands_local<T1, T2> {};
+
+template <typename T1, typename T2>
+struct row_local<neq_impl<T1, T2> >: operands_local<T1, T2> {};
+
+template <typename T1, typename T2>
+struct row_local<lt_impl<T1, T2> >: operands_local<T1, T2> {};
+
+template <typename T1, typename T2>
+struct row_local<gt_impl<T1, T2> >: operands_local<T1, T2> {};
+
+template <typename T1, typename T2>
+struct row_local<and_impl<T1, T2> >: operands_local<T1, T2> {};
+
+template <typename T1, typename T2>
+struct row_local<or_impl<T1, T2> >: operands_local<T1, T2> {};
+
+template <typename T1, typename T2>
+struct row_local<plus_impl<T1, T2> >: operands_local<T1, T2> {};
+
+template <typename T1, typename T2>
+struct row_local<assign_impl<T1, T2> >: operands_local<T1, T2> {};
+
+template <typename T1, typename T2>
+struct row_local<chain_impl<T1, T2> >: operands_local<T1, T2> {};
+
+/* Compile time query plans */
+
 /**
- * Assignment operator implementation
- * Can not be static
+ * Expression evaluated as it is.
  */
-template <typename T1, typename T2>
-struct assign_impl
+template <typename E>
+struct plan_as_is
 {
-	typedef assign_impl<T1, T2> evaluated_type;
-	typedef typename T1::object_type object_type;
-	
-	assign_impl(T1 t1, T2 t2): t1_(t1), t2_(t2) {}
-	T1 t1_;
-	T2 t2_;
+	typedef E type;
 	
-	template <typename F1>
-	bool operator()(F1 f1)
-	{
-		t1_(f1) = t2_(f1);
-		return true;
-	}
+	/* Kernel is cheap and free of side effects? */
+	enum { simple = 0 };
 	
-	template <typename A1, typename A2>
-	chain_impl<assign_impl<T1, T2>, assign_impl<A1, A2> > operator,(assign_impl<A1, A2> f)
-	{
-		return chain_impl<assign_impl<T1, T2>, assign_impl<A1, A2> >(*this, f);
-	}
+	static type make(const E& e) { return e; }
 };
 
 /**
- * Implementation of operator== (logical AND)
+ * Query plan turns expression tree into a kernel which is cheaper to
+ * evaluate for every row. It is resolved at compile time for every
+ * shape of query, so kernels are inlined without virtual calls.
+ * Expressions without better plan are evaluated as they are.
  */
-template <typename T1, typename T2>
-struct eq_impl
+template <typename E>
+struct plan: plan_as_is<E> {};
+
+/**
+ * Comparison of field with value, which is converted to field type once
+ * instead of once per row.
+ */
+template <typename V, typename T, typename Op>
+struct compare_impl
 {
-	typedef eq_impl<T1, T2> evaluated_type;
-	typedef typename T1::object_type object_type;
+	typedef compare_impl<V, T, Op> evaluated_type;
+	typedef T object_type;
 	
-	T1 expr_;
-	T2 value_;
+	field_impl<V, T> expr_;
+	V value_;
 	
-	eq_impl(T1 t, T2 value):
-		expr_(t), value_(value) {}
+	compare_impl(const field_impl<V, T>& expr, const V& value):
+		expr_(expr), value_(value) {}
 	
 	template <typename F1>
 	bool operator()(F1 obj)
 	{
-		return expr_(obj) == value_;
-	}
-	
-	template <typename F1, typename F2>
-	F1 operator()(F1 obj, F2 val)
-	{
-		return expr_(obj, val) == value_;
+		return Op()(expr_(obj), value_);
 	}
-	
-	/* Ops */
-	IMPLEMENT_OPERATOR(and_impl, &)
 };
 
 /**
- * Implementation of operator!= (logical NOT EQUAL)
+ * Conjunction of simple kernels. Both sides are evaluated and combined
+ * without a branch.
  */
 template <typename T1, typename T2>
-struct neq_impl
+struct all_impl
 {
+	typedef all_impl<T1, T2> evaluated_type;
+	typedef typename T1::object_type object_type;
+	
 	T1 expr_;
 	T2 value_;
 	
-	neq_impl(T1 t, T2 value): expr_(t), value_(value) {}
+	all_impl(T1 t, T2 value): expr_(t), value_(value) {}
 	
 	template <typename F1>
 	bool operator()(F1 obj)
 	{
-		return expr_(obj) != value_;
-	}
-	
-	template <typename F1, typename F2>
-	F1 operator()(F1 obj, F2 val)
-	{
-		return expr_(obj, val) != value_;
+		return bool(expr_(obj)) & bool(value_(obj));
 	}
 };
 
 /**
- * Implementation of operator> (logical GREATER THAN)
+ * Disjunction of simple kernels, evaluated without a branch.
  */
 template <typename T1, typename T2>
-struct gt_impl
+struct any_impl
 {
-	typedef gt_impl<T1, T2> evaluated_type;
-	
+	typedef any_impl<T1, T2> evaluated_type;
 	typedef typename T1::object_type object_type;
 	
 	T1 expr_;
 	T2 value_;
 	
-	gt_impl(T1 t, T2 value): expr_(t), value_(value) {}
+	any_impl(T1 t, T2 value): expr_(t), value_(value) {}
 	
 	template <typename F1>
 	bool operator()(F1 obj)
 	{
-		return expr_(obj) > value_;
+		return bool(expr_(obj)) | bool(value_(obj));
 	}
+};
+
+template <typename E, typename V, typename T, typename X, typename Op,
+	bool = is_key<V, X>::value>
+struct compare_plan
+{
+	typedef compare_impl<V, T, Op> type;
 	
-	template <typename F1, typename F2>
-	F1 operator()(F1 obj, F2 val)
+	enum { simple = 1 };
+	
+	static type make(const E& e)
 	{
-		return expr_(obj, val) > value_;
+		return type(e.expr_, index_key<V>(e.value_));
 	}
-	
-	/* Ops */
-	IMPLEMENT_OPERATOR(and_impl, &)
 };
 
-/**
- * Implementation of operator< (logical LOWER THAN)
- */
-template <typename T1, typename T2>
-struct lt_impl
+/* Field compared with other expression */
+template <typename E, typename V, typename T, typename X, typename Op>
+struct compare_plan<E, V, T, X, Op, false>: plan_as_is<E> {};
+
+template <typename V, typename T, typename X>
+struct plan<eq_impl<field_impl<V, T>, X> >:
+	compare_plan<eq_impl<field_impl<V, T>, X>, V, T, X, std::equal_to<V> > {};
+
+template <typename V, typename T, typename X>
+struct plan<neq_impl<field_impl<V, T>, X> >:
+	compare_plan<neq_impl<field_impl<V, T>, X>, V, T, X, std::not_equal_to<V> > {};
+
+template <typename V, typename T, typename X>
+struct plan<lt_impl<field_impl<V, T>, X> >:
+	compare_plan<lt_impl<field_impl<V, T>, X>, V, T, X, std::less<V> > {};
+
+template <typename V, typename T, typename X>
+struct plan<gt_impl<field_impl<V, T>, X> >:
+	compare_plan<gt_impl<field_impl<V, T>, X>, V, T, X, std::greater<V> > {};
+
+/* Conjunction of simple comparisons is evaluated without branches */
+template <typename T1, typename T2,
+	bool = plan<T1>::simple && plan<T2>::simple>
+struct and_plan
 {
-	T1 expr_;
-	T2 value_;
+	typedef all_impl<typename plan<T1>::type, typename plan<T2>::type> type;
 	
-	lt_impl(T1 t, T2 value): expr_(t), value_(value) {}
+	enum { simple = 1 };
 	
-	template <typename F1>
-	bool operator()(F1 obj)
+	static type make(const and_impl<T1, T2>& e)
 	{
-		return expr_(obj) < value_;
+		return type(plan<T1>::make(e.expr_), plan<T2>::make(e.value_));
 	}
+};
+
+/* ...other conjunctions keep short circuit */
+template <typename T1, typename T2>
+struct and_plan<T1, T2, false>
+{
+	typedef and_impl<typename plan<T1>::type, typename plan<T2>::type> type;
 	
-	template <typename F1, typename F2>
-	F1 operator()(F1 obj, F2 val)
+	enum { simple = 0 };
+	
+	static type make(const and_impl<T1, T2>& e)
 	{
-		return expr_(obj, val) < value_;
+		return type(plan<T1>::make(e.expr_), plan<T2>::make(e.value_));
 	}
 };
 
-template <typename T1>
-struct value_impl
+template <typename T1, typename T2>
+struct plan<and_impl<T1, T2> >: and_plan<T1, T2> {};
+
+/* Disjunction of simple comparisons is evaluated without branches */
+template <typename T1, typename T2,
+	bool = plan<T1>::simple && plan<T2>::simple>
+struct or_plan
 {
-	/**
-	 * Ugly hack to know the type of trapped value
-	 */
-	typedef T1 value_type;
-	typedef value_impl<T1> evaluated_type;
-	
-	value_impl(T1 t1): t1_(t1) {}
-	T1 t1_;
-	
-	/**
-	 * Return trapped value
-	 */
-	T1 operator()() { return t1_; }
+	typedef any_impl<typename plan<T1>::type, typename plan<T2>::type> type;
 	
-	/**
-	 * Return trapped value and act as field_impl.
-	 */
-	template <typename F>
-	T1 operator()(F) { return t1_; }
+	enum { simple = 1 };
 	
-	/**
-	 * If accidental implicit conversion happens...
-	 */
-	operator value_type() { return t1_; }
+	static type make(const or_impl<T1, T2>& e)
+	{
+		return type(plan<T1>::make(e.expr_), plan<T2>::make(e.value_));
+	}
 };
 
-/**
- * Implementation of operator+ (A + B)
- */
+/* ...other disjunctions keep short circuit */
 template <typename T1, typename T2>
-struct plus_impl
+struct or_plan<T1, T2, false>
 {
-	typedef T1 value_type; /* plus_impl acts as value_impl too... */
-	
-	T1 expr_;
-	T2 value_;
+	typedef or_impl<typename plan<T1>::type, typename plan<T2>::type> type;
 	
-	plus_impl(T1 t, T2 value): expr_(t), value_(value) {}
+	enum { simple = 0 };
 	
-	template <typename F>
-	value_impl<typename T1::value_type> operator()(F obj)
+	static type make(const or_impl<T1, T2>& e)
 	{
-		return value_impl<typename T1::value_type>(expr_(obj) + value_(obj));
+		return type(plan<T1>::make(e.expr_), plan<T2>::make(e.value_));
 	}
 };
 
+template <typename T1, typename T2>
+struct plan<or_impl<T1, T2> >: or_plan<T1, T2> {};
+
 /**
- * Value holder
+ * Get kernel of expression.
  */
-template <typename T1>
-value_impl<T1> val(T1 t1)
+template <typename E>
+typename plan<E>::type compile(const E& e)
 {
-	return value_impl<T1>(t1);
+	return plan<E>::make(e);
 }
 
-/**
- * This class will be evaluated later to value from member class field.
- */
-template <typename T1, typename T2>
-struct field_impl
+/* Vectorized kernels */
+
+/* F(&T::member) compared with value, when member has int column */
+template <typename T, typename Op>
+struct vector_scan<compare_impl<int, T, Op>, T>
 {
-	typedef field_impl<T1, T2> evaluated_type;
-	typedef T2 object_type;
-	
-	typedef T1 value_type;
-	field<T1> T2::* field_;
-	field_impl(field<T1> T2::* t): field_(t) {}
-	
-	template <typename F>
-	assign_impl<field_impl<T1, T2>, F> operator=(F f)
-	{
-		return assign_impl<field_impl<T1, T2>, F>(*this, f);
-	}
-	
-	template <typename F1>
-	T1& operator()(F1 obj)
+	template <typename S>
+	static bool select(S& set, compare_impl<int, T, Op>& k, selection& out)
 	{
-		return (*obj.*field_).value_;
+		const int* values;
+		std::size_t n;
+		if (!int_column(set, k.expr_.field_, values, n))
+			return false;
+		out = selection(n);
+		select_ints<Op>(values, n, k.value_, out);
+		return true;
 	}
-	
-	/* Ops */
-	IMPLEMENT_OPERATOR(eq_impl, ==)
-	IMPLEMENT_OPERATOR(and_impl, &)
-	IMPLEMENT_OPERATOR(lt_impl, <)
-	IMPLEMENT_OPERATOR(gt_impl, >)
-	IMPLEMENT_OPERATOR(plus_impl, +)
 };
 
-/**
- * Implementation of MAX aggregate.
- */
-template <typename T1>
-struct max_impl
+template <typename T1, typename T2, typename T>
+struct vector_scan<all_impl<T1, T2>, T>
 {
-	typedef max_impl<T1> evaluated_type;
-	typedef int value_type;
-	
-	field_impl<int, T1> field_;
-	
-	max_impl(field_impl<int, T1> fld) :
-		field_(fld) {}
-	
-	template <typename F1>
-	int operator()(F1 f)
+	template <typename S>
+	static bool select(S& set, all_impl<T1, T2>& k, selection& out)
 	{
-		int max_val = INT_MIN; /* Min value */
-		abstract_dbset* abstract_set = f->parent_;
-		dbset<T1>* set = static_cast<dbset<T1>*>(abstract_set);
-		for (typename std::list<T1>::iterator it(set->all().begin()),
-			end(set->all().end()); it != end; ++it)
+		selection right;
+		if (!vector_scan<T1, T>::select(set, k.expr_, out) ||
+			!vector_scan<T2, T>::select(set, k.value_, right))
 		{
-			/* 
-			 * Get value of member field using current iterator as this
-			 */
-			int v = *it.*field_.field_; /* Access member field from  */
-			if (v > max_val)
-				max_val = v;
+			return false;
 		}
-		return max_val == INT_MIN ? 0 : max_val;
+		out &= right;
+		return true;
 	}
-	
-	IMPLEMENT_OPERATOR(plus_impl, +)
 };
 
-/**
- * Get max value aggregate.
- */
-template <typename T1>
-max_impl<T1> MAX(field_impl<int, T1> fld)
-{
-	return max_impl<T1>(fld);
-}
-
-/**
- * As I can not force static operator to accept type of field<T1> T2::*
- * I had to do this.
- * This thing actually spawns new instance of field_impl which just
- * holds fld value.
- */
-template <typename T1, typename T2>
-field_impl<T1, T2> F(field<T1> T2::* fld)
+template <typename T1, typename T2, typename T>
+struct vector_scan<any_impl<T1, T2>, T>
 {
-	return field_impl<T1, T2>(fld);
-}
+	template <typename S>
+	static bool select(S& set, any_impl<T1, T2>& k, selection& out)
+	{
+		selection right;
+		if (!vector_scan<T1, T>::select(set, k.expr_, out) ||
+			!vector_scan<T2, T>::select(set, k.value_, right))
+		{
+			return false;
+		}
+		out |= right;
+		return true;
+	}
+};
 
 /* Constraints implementations */
 
@@ -819,3 +7832,5 @@ struct lowercase_impl: abstract_constraint
 
 static constraint<uppercase_impl> uppercase;
 static constraint<lowercase_impl> lowercase;
+static constraint<unique_impl> unique_key;
+static constraint<primary_key_impl> primary_key;
@@ -0,0 +1,97 @@
+#include <iostream>
+#include <string>
+#include <cassert>
+#include <magicunicorns.hpp>
+
+using namespace std;
+
+/**
+ * Person
+ */
+struct person: table
+{
+	field<int> id;
+	field<string> first_name;
+	field<string> second_name;
+	person(int id = 0, const string& first_name = "", const string& second_name = "") :
+		table(this, "person"), id(this, "id", id),
+		first_name(this, "first_name", first_name),
+		second_name(this, "second_name", second_name)
+	{
+	}
+	
+	friend ostream& operator<<(ostream& out, const person& p)
+	{
+		out << "person(" << p.id << ",\"" <<
+			p.first_name << "\", \"" <<
+			p.second_name << "\")";
+		return out;
+	}
+	
+	bool operator==(person& other)
+	{
+		return (id == other.id)	&& (first_name == other.first_name) && (second_name == other.second_name);
+	}
+};
+
+struct context: dbcontext
+{
+	dbset<person> persons;
+	context(): persons(this) {}
+};
+
+int
+main(int argc, char* argv[])
+{
+	context ctx;
+	
+	/* Empty set */
+	tuple<size_t, int, double> none = ctx.persons.aggregate(COUNT(), SUM(F(&person::id)), AVG(F(&person::id)));
+	assert(get<0>(none) == 0);
+	assert(get<1>(none) == 0);
+	assert(get<2>(none) == 0);
+	
+	ctx.persons.put(person(1, "John", "Smith"));
+	ctx.persons.put(person(2, "Jan", "Kowalski"));
+	ctx.persons.put(person(3, "Adam", "Smith"));
+	ctx.persons.put(person(6, "Anna", "Kowalski"));
+	ctx.persons.put(person(8, "Jane", "Smith"));
+	
+	/* Whole set in single pass */
+	tuple<size_t, int, int, int, double> all = ctx.persons.aggregate(COUNT(),
+		SUM(F(&person::id)), MIN(F(&person::id)), MAX(F(&person::id)), AVG(F(&person::id)));
+	assert(get<0>(all) == 5);
+	assert(get<1>(all) == 20);
+	assert(get<2>(all) == 1);
+	assert(get<3>(all) == 8);
+	assert(get<4>(all) == 4.0);
+	assert(get<0>(ctx.persons.aggregate(MIN(F(&person::first_name)))) == "Adam");
+	
+	/* Filtered rows */
+	tuple<size_t, int> smiths = ctx.persons.where(F(&person::second_name) == "Smith").aggregate(COUNT(), SUM(F(&person::id)));
+	assert(get<0>(smiths) == 3);
+	assert(get<1>(smiths) == 12);
+	
+	/* Groups */
+	map<string, tuple<size_t, int, int> > groups = ctx.persons.group_by(F(&person::second_name),
+		COUNT(), SUM(F(&person::id)), MAX(F(&person::id)));
+	assert(groups.size() == 2);
+	assert(get<0>(groups["Kowalski"]) == 2);
+	assert(get<1>(groups["Kowalski"]) == 8);
+	assert(get<2>(groups["Kowalski"]) == 6);
+	assert(get<0>(groups["Smith"]) == 3);
+	assert(get<1>(groups["Smith"]) == 12);
+	assert(get<2>(groups["Smith"]) == 8);
+	
+	map<string, tuple<double> > filtered = ctx.persons.where(F(&person::id) > 2).group_by(
+		F(&person::second_name), AVG(F(&person::id)));
+	assert(get<0>(filtered["Kowalski"]) == 6.0);
+	assert(get<0>(filtered["Smith"]) == 5.5);
+	
+	/* Aggregates are expressions as well */
+	ctx.persons.update(F(&person::first_name) == "Jane", F(&person::id) = SUM(F(&person::id)) + val(1));
+	assert(ctx.persons.filter(F(&person::first_name) == "Jane").front().id == 21);
+	ctx.persons.update(F(&person::first_name) == "John", F(&person::id) = MIN(F(&person::id)) + COUNT());
+	assert(ctx.persons.filter(F(&person::first_name) == "John").front().id == 6);
+	return 0;
+}
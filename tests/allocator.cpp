@@ -0,0 +1,93 @@
+#include <iostream>
+#include <string>
+#include <cassert>
+#include <magicunicorns.hpp>
+
+using namespace std;
+
+/**
+ * Person
+ */
+struct person: table
+{
+	field<int> id;
+	field<string> first_name;
+	field<string> second_name;
+	person(int id = 0, const string& first_name = "", const string& second_name = "") :
+		table(this, "person"), id(this, "id", id),
+		first_name(this, "first_name", first_name),
+		second_name(this, "second_name", second_name)
+	{
+	}
+	
+	friend ostream& operator<<(ostream& out, const person& p)
+	{
+		out << "person(" << p.id << ",\"" <<
+			p.first_name << "\", \"" <<
+			p.second_name << "\")";
+		return out;
+	}
+	
+	bool operator==(person& other)
+	{
+		return (id == other.id)	&& (first_name == other.first_name) && (second_name == other.second_name);
+	}
+};
+
+struct context: dbcontext
+{
+	dbset<person> persons;
+	context(): persons(this) {}
+};
+
+int
+main(int argc, char* argv[])
+{
+	/* Freed blocks are reused */
+	{
+		slab_pool pool;
+		void* a = pool.allocate(40);
+		void* b = pool.allocate(40);
+		assert(a != b);
+		pool.deallocate(a, 40);
+		assert(pool.allocate(48) == a);
+		void* big = pool.allocate(1000);
+		pool.deallocate(big, 1000);
+	}
+	
+	context ctx;
+	ctx.persons.add_index<hash_index>(&person::first_name);
+	ctx.persons.add_index<ordered_index>(&person::id);
+	for (int i = 0; i < 10000; i++)
+		ctx.persons.put(person(i, i % 2 ? "John" : "Jan", "Smith"));
+	
+	/* Indexes keep working with nodes from pool */
+	ctx.persons.update(F(&person::first_name) == "Jan", F(&person::first_name) = val("Anna"));
+	ctx.persons.update(F(&person::id) < 100, F(&person::first_name) = val("Jan"));
+	assert(ctx.persons.filter(F(&person::first_name) == "Anna").size() == 4950);
+	assert(ctx.persons.filter(F(&person::first_name) == "Jan").size() == 100);
+	assert(ctx.persons.filter(F(&person::id) > 9989).size() == 10);
+	
+	/* Results in arena */
+	arena a;
+	for (int round = 0; round < 3; round++)
+	{
+		{
+			std::vector<person, arena_allocator<person> > result((arena_allocator<person>(&a)));
+			ctx.persons.filter(F(&person::first_name) == "John", result);
+			assert(result.size() == 4950);
+			ctx.persons.filter(F(&person::id) < 10, result);
+			assert(result.size() == 4960);
+			assert(result.back().id == 9);
+		}
+		a.clear();
+	}
+	
+	/* Reused container */
+	dbset<person>::container_type result;
+	ctx.persons.filter(F(&person::id) < 5, result);
+	result.clear();
+	ctx.persons.filter(F(&person::id) < 3, result);
+	assert(result.size() == 3);
+	return 0;
+}
@@ -0,0 +1,346 @@
+#include <iostream>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <chrono>
+#include <random>
+#include <atomic>
+#include <new>
+#include <magicunicorns.hpp>
+
+using namespace std;
+
+/*
+ * Benchmarks of common paths. Every workload runs on sets of several
+ * sizes with fixed random seed, so runs of different versions can be
+ * compared. Prints table, or one JSON object per line with --json.
+ * Numbers mean something only with optimized build, configure with
+ * -DCMAKE_BUILD_TYPE=Release.
+ *
+ * bench [--json] [--threads n] [size...]
+ */
+
+static const char* usage = "usage: bench [--json] [--threads n] [size...]";
+
+/* Allocations made by measured code */
+static atomic<size_t> allocations(0);
+static atomic<size_t> allocated(0);
+
+static void* allocate(size_t n)
+{
+	allocations.fetch_add(1, memory_order_relaxed);
+	allocated.fetch_add(n, memory_order_relaxed);
+	void* p = malloc(n ? n : 1);
+	if (!p)
+		throw bad_alloc();
+	return p;
+}
+
+/* Not inlined, or compiler pairs free() with operator new at call site */
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+static void release(void* p) noexcept
+{
+	free(p);
+}
+
+/* All forms are replaced, so every allocation is counted and freed alike */
+void* operator new(size_t n) { return allocate(n); }
+void* operator new[](size_t n) { return allocate(n); }
+void operator delete(void* p) noexcept { release(p); }
+void operator delete(void* p, size_t) noexcept { release(p); }
+void operator delete[](void* p) noexcept { release(p); }
+void operator delete[](void* p, size_t) noexcept { release(p); }
+
+/**
+ * Person
+ */
+struct person: table
+{
+	field<int> id;
+	field<string> first_name;
+	field<string> second_name;
+	person(int id = 0, const string& first_name = "", const string& second_name = "") :
+		table(this, "person"), id(this, "id", id),
+		first_name(this, "first_name", first_name),
+		second_name(this, "second_name", second_name)
+	{
+		addTrigger(F(&person::id) == 0, F(&person::id) = MAX(F(&person::id)) + val(1));
+	}
+
+	bool operator==(person& other)
+	{
+		return (id == other.id)	&& (first_name == other.first_name) && (second_name == other.second_name);
+	}
+};
+
+struct context: dbcontext
+{
+	dbset<person> persons;
+	context(): persons(this) {}
+};
+
+static const char* names[] = { "Smith", "Kowalski", "Schmidt", "Nowak", "Novak", "Rossi", "Garcia", "Muller" };
+
+/* First names, few common and many rare, as in real people */
+static const char* first_names[] = { "John", "Jan", "Anna", "Maria", "Hans", "Juan", "Jean",
+	"Giulia", "Piotr", "Eva", "Lukas", "Sofia", "Marco", "Olga", "Pablo", "Ingrid" };
+
+/* Result of one workload */
+struct result
+{
+	string name;
+	size_t size; /* Rows in set */
+	size_t ops;
+	double seconds; /* Total */
+	vector<double> latencies; /* Of every op, in microseconds, sorted */
+	size_t allocations;
+	size_t bytes;
+
+	double percentile(double p) const
+	{
+		if (latencies.empty())
+			return 0;
+		size_t i = size_t(p / 100 * (latencies.size() - 1) + 0.5);
+		return latencies[i];
+	}
+};
+
+/**
+ * Run op(i) for i in [0, ops) and time every call.
+ */
+template <typename Op>
+static result measure(const string& name, size_t size, size_t ops, Op op)
+{
+	typedef chrono::steady_clock clock;
+	result r;
+	r.name = name;
+	r.size = size;
+	r.ops = ops;
+	r.latencies.reserve(ops); /* Only op allocates while measured */
+	size_t first_allocations = allocations, first_bytes = allocated;
+	clock::time_point start(clock::now());
+	for (size_t i = 0; i < ops; i++)
+	{
+		clock::time_point before(clock::now());
+		op(i);
+		r.latencies.push_back(chrono::duration<double, micro>(clock::now() - before).count());
+	}
+	r.seconds = chrono::duration<double>(clock::now() - start).count();
+	r.allocations = allocations - first_allocations;
+	r.bytes = allocated - first_bytes;
+	sort(r.latencies.begin(), r.latencies.end());
+	return r;
+}
+
+static void report(const result& r, bool json)
+{
+	double throughput = r.seconds > 0 ? r.ops / r.seconds : 0;
+	if (json)
+	{
+		cout << "{\"name\":\"" << r.name << "\",\"size\":" << r.size <<
+			",\"ops\":" << r.ops << ",\"seconds\":" << r.seconds <<
+			",\"ops_per_second\":" << throughput <<
+			",\"p50_us\":" << r.percentile(50) << ",\"p90_us\":" << r.percentile(90) <<
+			",\"p99_us\":" << r.percentile(99) << ",\"max_us\":" << r.percentile(100) <<
+			",\"allocations_per_op\":" << double(r.allocations) / r.ops <<
+			",\"bytes_per_op\":" << double(r.bytes) / r.ops << "}" << endl;
+		return;
+	}
+	cout << r.name << "\t" << r.size << "\t" << r.ops << "\t" << size_t(throughput) << "\t" <<
+		r.percentile(50) << "\t" << r.percentile(90) << "\t" << r.percentile(99) << "\t" <<
+		r.percentile(100) << "\t" << double(r.allocations) / r.ops << "\t" <<
+		double(r.bytes) / r.ops << endl;
+}
+
+/* Run all workloads on set of given size */
+static void run(size_t size, unsigned threads, bool json)
+{
+	mt19937 random(size);
+	size_t queries = 100;
+
+	/* put() with MAX trigger generating ids */
+	{
+		context ctx;
+		ctx.threads(threads);
+		report(measure("put", size, size, [&](size_t i)
+		{
+			ctx.persons.put(person(0, "John", names[i % 8]));
+		}), json);
+	}
+
+	/* put() publishing version for snapshots after every row */
+	{
+		context ctx;
+		ctx.threads(threads);
+		ctx.persons.enable_snapshots();
+		report(measure("put_snapshots", size, size, [&](size_t i)
+		{
+			ctx.persons.put(person(0, "John", names[i % 8]));
+		}), json);
+	}
+
+	/* put_range() of whole set at once */
+	{
+		context ctx;
+		ctx.threads(threads);
+		vector<person> batch;
+		batch.reserve(size);
+		for (size_t i = 0; i < size; i++)
+			batch.push_back(person(0, "John", names[i % 8]));
+		report(measure("put_range", size, 1, [&](size_t)
+		{
+			ctx.persons.put_range(std::move(batch));
+		}), json);
+	}
+
+	context ctx;
+	ctx.threads(threads);
+	for (size_t i = 0; i < size; i++)
+		ctx.persons.put(person(0, "John", names[i % 8]));
+	uniform_int_distribution<int> ids(1, int(size));
+
+	/* Filter matching single row, every row, and eighth of rows */
+	report(measure("filter_selective", size, queries, [&](size_t)
+	{
+		ctx.persons.filter(F(&person::id) == ids(random));
+	}), json);
+	report(measure("filter_full", size, queries / 10, [&](size_t)
+	{
+		ctx.persons.filter(F(&person::first_name) == "John");
+	}), json);
+	report(measure("filter_string", size, queries / 10, [&](size_t i)
+	{
+		ctx.persons.filter(F(&person::second_name) == names[i % 8]);
+	}), json);
+
+	/* update(where, stmt) of single row and of all rows */
+	report(measure("update_selective", size, queries, [&](size_t)
+	{
+		ctx.persons.update(F(&person::id) == ids(random), F(&person::first_name) = val("Jan"));
+	}), json);
+	report(measure("update_full", size, queries / 10, [&](size_t i)
+	{
+		ctx.persons.update(F(&person::first_name) = val(i % 2 ? "John" : "Jan"));
+	}), json);
+
+	/* exists() of present and missing row */
+	report(measure("exists", size, queries, [&](size_t i)
+	{
+		person p(i % 2 ? ids(random) : -1, "John", names[i % 8]);
+		ctx.persons.exists(&p);
+	}), json);
+
+	/* MAX kept by put(), and recomputed after update() */
+	report(measure("max", size, queries, [&](size_t)
+	{
+		ctx.persons.max_of(&person::id);
+	}), json);
+	report(measure("max_after_update", size, queries / 10, [&](size_t)
+	{
+		ctx.persons.update(F(&person::id) == ids(random), F(&person::second_name) = val("Smith"));
+		ctx.persons.max_of(&person::id);
+	}), json);
+
+	/*
+	 * Mixed workload over people with skewed names: mostly lookups by
+	 * id and name, some updates, and new rows, interleaved as in
+	 * application serving requests.
+	 */
+	{
+		context ctx;
+		ctx.threads(threads);
+		vector<double> weights;
+		for (size_t i = 0; i < sizeof(first_names) / sizeof(first_names[0]); i++)
+			weights.push_back(1.0 / (i + 1));
+		discrete_distribution<size_t> common(weights.begin(), weights.end());
+		for (size_t i = 0; i < size; i++)
+			ctx.persons.put(person(0, first_names[common(random)], names[common(random) % 8]));
+		uniform_int_distribution<int> percent(0, 99);
+		report(measure("mixed", size, queries * 10, [&](size_t)
+		{
+			int op = percent(random);
+			int id = int(uniform_int_distribution<size_t>(1, ctx.persons.size())(random));
+			if (op < 40)
+				ctx.persons.filter(F(&person::id) == id);
+			else if (op < 60)
+				ctx.persons.filter(F(&person::first_name) == first_names[common(random)]);
+			else if (op < 70)
+				ctx.persons.filter((F(&person::first_name) == first_names[common(random)]) &
+					(F(&person::second_name) == names[common(random) % 8]));
+			else if (op < 85)
+				ctx.persons.update(F(&person::id) == id,
+					F(&person::second_name) = val(names[common(random) % 8]));
+			else
+				ctx.persons.put(person(0, first_names[common(random)], names[common(random) % 8]));
+		}), json);
+	}
+
+	/* Same paths with column and index */
+	ctx.persons.add_column(&person::id);
+	ctx.persons.add_index<hash_index>(&person::second_name);
+	report(measure("filter_selective_column", size, queries, [&](size_t)
+	{
+		ctx.persons.filter(F(&person::id) == ids(random));
+	}), json);
+	report(measure("filter_string_index", size, queries, [&](size_t i)
+	{
+		ctx.persons.filter(F(&person::second_name) == names[i % 8]);
+	}), json);
+}
+
+int
+main(int argc, char* argv[])
+{
+	bool json = false;
+	unsigned threads = 1;
+	vector<size_t> sizes;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--json") == 0)
+		{
+			json = true;
+			continue;
+		}
+		if (strcmp(argv[i], "--help") == 0)
+		{
+			cout << usage << endl;
+			return 0;
+		}
+		bool option = strcmp(argv[i], "--threads") == 0;
+		if (option && ++i == argc)
+		{
+			cerr << usage << endl;
+			return 1;
+		}
+		
+		/* Counts are positive numbers and nothing else */
+		char* end;
+		unsigned long n = strtoul(argv[i], &end, 10);
+		if (!isdigit((unsigned char)argv[i][0]) || *end || !n)
+		{
+			cerr << usage << endl;
+			return 1;
+		}
+		if (option)
+			threads = unsigned(n);
+		else
+			sizes.push_back(n);
+	}
+	if (sizes.empty())
+	{
+		sizes.push_back(1000);
+		sizes.push_back(10000);
+		sizes.push_back(100000);
+	}
+
+	if (!json)
+		cout << "name\tsize\tops\tops/s\tp50us\tp90us\tp99us\tmaxus\tallocs/op\tbytes/op" << endl;
+	for (size_t i = 0; i < sizes.size(); i++)
+		run(sizes[i], threads, json);
+	return 0;
+}
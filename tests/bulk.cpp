@@ -0,0 +1,88 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cassert>
+#include <magicunicorns.hpp>
+
+using namespace std;
+
+/**
+ * Person
+ */
+struct person: table
+{
+	field<int> id;
+	field<string> first_name;
+	field<string> second_name;
+	person(const string& first_name = "", const string& second_name = "") :
+		table(this, "person"), id(this, "id"),
+		first_name(this, "first_name", first_name),
+		second_name(this, "second_name", second_name)
+	{
+		addTrigger(F(&person::id) == 0, F(&person::id) = MAX(F(&person::id)) + val(1));
+		this->first_name.constraint = ::uppercase;
+		this->second_name.constraint = ::lowercase;
+	}
+	
+	friend ostream& operator<<(ostream& out, const person& p)
+	{
+		out << "person(" << p.id << ",\"" <<
+			p.first_name << "\", \"" <<
+			p.second_name << "\")";
+		return out;
+	}
+	
+	bool operator==(person& other)
+	{
+		return (id == other.id)	&& (first_name == other.first_name) && (second_name == other.second_name);
+	}
+};
+
+struct context: dbcontext
+{
+	dbset<person> persons;
+	context(): persons(this) {}
+};
+
+int
+main(int argc, char* argv[])
+{
+	context ctx;
+	ctx.persons.put(person("first", "FIRST"));
+	ctx.persons.add_column(&person::id);
+	ctx.persons.add_index<hash_index>(&person::first_name);
+	
+	{
+		/* Copy from iterator range */
+		person batch[] = { person("john", "SMITH"), person("jan", "KOWALSKI") };
+		ctx.persons.put_range(batch, batch + 2);
+		assert(batch[0].first_name == "john");
+	}
+	
+	{
+		/* Take over vector */
+		vector<person> batch;
+		for (int i = 0; i < 100; i++)
+			batch.push_back(person("null", "NULL"));
+		ctx.persons.put_range(std::move(batch));
+		ctx.persons.put_range(vector<person>());
+	}
+	
+	assert(ctx.persons.size() == 103);
+	
+	/* Triggers saw rows inserted before them */
+	for (size_t i = 0; i < ctx.persons.size(); i++)
+		assert(ctx.persons.all()[i].id == int(i + 1));
+	
+	/* Constraints were applied */
+	assert(ctx.persons.all()[1].first_name == "JOHN");
+	assert(ctx.persons.all()[1].second_name == "smith");
+	assert(ctx.persons.all()[102].second_name == "null");
+	
+	/* Observers follow bulk inserts */
+	assert(ctx.persons.find_column(&person::id)->values_.size() == 103);
+	assert((*ctx.persons.find_column(&person::id))[102] == 103);
+	assert(ctx.persons.filter(F(&person::first_name) == "NULL").size() == 100);
+	assert(ctx.persons.filter(F(&person::id) > 100).size() == 3);
+	return 0;
+}
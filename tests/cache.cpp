@@ -0,0 +1,100 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cassert>
+#include <magicunicorns.hpp>
+
+using namespace std;
+
+/**
+ * Person
+ */
+struct person: table
+{
+	field<int> id;
+	field<string> first_name;
+	field<string> second_name;
+	person(int id = 0, const string& first_name = "", const string& second_name = "") :
+		table(this, "person"), id(this, "id", id),
+		first_name(this, "first_name", first_name),
+		second_name(this, "second_name", second_name)
+	{
+		addTrigger(F(&person::id) == 0, F(&person::id) = MAX(F(&person::id)) + val(1));
+	}
+
+	bool operator==(person& other)
+	{
+		return (id == other.id)	&& (first_name == other.first_name) && (second_name == other.second_name);
+	}
+};
+
+struct context: dbcontext
+{
+	dbset<person> persons;
+	context(): persons(this) {}
+};
+
+int
+main(int argc, char* argv[])
+{
+	context ctx;
+	ctx.persons.enable_cache();
+	ctx.persons.put(person(0, "John", "Smith"));
+	ctx.persons.put(person(0, "Jan", "Kowalski"));
+	ctx.persons.put(person(0, "Hans", "Schmidt"));
+
+	/* Same expression with same values is cached once */
+	assert(ctx.persons.filter(F(&person::second_name) == "Smith").size() == 1);
+	assert(ctx.persons.cache_->entries_.size() == 1);
+	assert(ctx.persons.filter(F(&person::second_name) == string("Smith")).size() == 1);
+	assert(ctx.persons.filter(F(&person::second_name) == "Smith").size() == 1);
+	assert(ctx.persons.cache_->entries_.size() == 2);
+	assert(ctx.persons.filter(F(&person::second_name) == "Kowalski").size() == 1);
+	assert(ctx.persons.filter(F(&person::first_name) == "Kowalski").size() == 0);
+	assert(ctx.persons.filter((F(&person::id) > 1) & (F(&person::id) < 3)).size() == 1);
+	assert(ctx.persons.cache_->entries_.size() == 5);
+
+	/* Put rows are added to results they match */
+	ctx.persons.put(person(0, "Anna", "Smith"));
+	assert(ctx.persons.filter(F(&person::second_name) == "Smith").size() == 2);
+	assert(ctx.persons.filter(F(&person::second_name) == "Smith").back().first_name == "Anna");
+
+	/* Updated rows are copied again, or move between results */
+	ctx.persons.update(F(&person::id) == 1, F(&person::first_name) = val("Johnny"));
+	assert(ctx.persons.filter(F(&person::second_name) == "Smith").front().first_name == "Johnny");
+	ctx.persons.update(F(&person::id) == 2, F(&person::second_name) = val("Smith"));
+	assert(ctx.persons.filter(F(&person::second_name) == "Smith").size() == 3);
+	assert(ctx.persons.filter(F(&person::second_name) == "Smith")[1].id == 2);
+	assert(ctx.persons.filter(F(&person::second_name) == "Kowalski").empty());
+	ctx.persons.update(F(&person::id) = F(&person::id) + val(10));
+	assert(ctx.persons.filter((F(&person::id) > 1) & (F(&person::id) < 3)).empty());
+
+	/* Removed rows are dropped, compaction drops whole cache */
+	ctx.persons.remove(F(&person::first_name) == "Anna");
+	assert(ctx.persons.filter(F(&person::second_name) == "Smith").size() == 2);
+	ctx.persons.compact();
+	assert(ctx.persons.cache_->entries_.empty());
+	assert(ctx.persons.filter(F(&person::second_name) == "Smith").size() == 2);
+
+	/* Cached results are the same as scanned ones */
+	context plain;
+	for (int i = 0; i < 200; i++)
+		plain.persons.put(person(0, "John", i % 3 ? "Smith" : "Kowalski"));
+	context cached;
+	cached.persons.enable_cache();
+	for (int i = 0; i < 200; i++)
+		cached.persons.put(person(0, "John", i % 3 ? "Smith" : "Kowalski"));
+	for (int round = 0; round < 3; round++)
+	{
+		vector<person> expected(plain.persons.filter(F(&person::second_name) == "Kowalski"));
+		vector<person> found(cached.persons.filter(F(&person::second_name) == "Kowalski"));
+		assert(found.size() == expected.size());
+		for (size_t i = 0; i < found.size(); i++)
+			assert(found[i] == expected[i]);
+		plain.persons.update(F(&person::id) < 50 * (round + 1), F(&person::second_name) = val("Kowalski"));
+		cached.persons.update(F(&person::id) < 50 * (round + 1), F(&person::second_name) = val("Kowalski"));
+		plain.persons.put(person(0, "Anna", "Kowalski"));
+		cached.persons.put(person(0, "Anna", "Kowalski"));
+	}
+	return 0;
+}
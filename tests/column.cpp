@@ -0,0 +1,78 @@
+#include <iostream>
+#include <string>
+#include <cassert>
+#include <magicunicorns.hpp>
+
+using namespace std;
+
+/**
+ * Person
+ */
+struct person: table
+{
+	field<int> id;
+	field<string> first_name;
+	field<string> second_name;
+	person(int id = 0, const string& first_name = "", const string& second_name = "") :
+		table(this, "person"), id(this, "id", id),
+		first_name(this, "first_name", first_name),
+		second_name(this, "second_name", second_name)
+	{
+	}
+	
+	friend ostream& operator<<(ostream& out, const person& p)
+	{
+		out << "person(" << p.id << ",\"" <<
+			p.first_name << "\", \"" <<
+			p.second_name << "\")";
+		return out;
+	}
+	
+	bool operator==(person& other)
+	{
+		return (id == other.id)	&& (first_name == other.first_name) && (second_name == other.second_name);
+	}
+};
+
+struct context: dbcontext
+{
+	dbset<person> persons;
+	context(): persons(this) {}
+};
+
+int
+main(int argc, char* argv[])
+{
+	context ctx;
+	ctx.persons.put(person(1, "John", "Smith"));
+	ctx.persons.put(person(2, "Jan", "Kowalski"));
+	
+	/* Column is filled with rows already in set */
+	column<int, person>& ids = ctx.persons.add_column(&person::id);
+	assert(ids.values_.size() == 2);
+	assert(&ctx.persons.add_column(&person::id) == &ids);
+	assert(ctx.persons.find_column(&person::first_name) == NULL);
+	
+	ctx.persons.put(person(3, "hello", "world"));
+	ctx.persons.put(person(4, "asdf", "zxcv"));
+	assert(ids.values_.size() == 4);
+	assert(ids[2] == 3);
+	
+	assert(ctx.persons.filter(
+		(F(&person::id) > 1) & (F(&person::id) < 4)).size() == 2);
+	assert(ctx.persons.filter(
+		(F(&person::id) > 0) & (F(&person::first_name) == "John")).size() == 1);
+	
+	/* Column follows updates */
+	ctx.persons.update(
+		F(&person::first_name) == "Jan",
+		F(&person::id) = F(&person::id) + val(10)
+	);
+	assert(ids[1] == 12);
+	{
+		dbset<person>::container_type result = ctx.persons.filter(F(&person::id) > 10);
+		assert(result.size() == 1);
+		assert(result.front().first_name == "Jan");
+	}
+	return 0;
+}
@@ -18,11 +18,10 @@ struct person: table
 		first_name(this, "first_name", first_name),
 		second_name(this, "second_name", second_name)
 	{
-		/* TODO: Implement
-		 * this->first_name.constraint = unique;
-		 * this->second_name.constraint = unique;
-		 * assert(this->first_name.constraint.size() == 1);
-		 * assert(this->second_name.constraint.size() == 1); */
+		this->first_name.constraint = unique_key;
+		this->second_name.constraint = unique_key;
+		assert(this->first_name.constraint.size() == 1);
+		assert(this->second_name.constraint.size() == 1);
 		addTrigger(F(&person::id) == 0, F(&person::id) = MAX(F(&person::id)) + val(1));
 	}
 	
@@ -52,7 +51,20 @@ main(int argc, char* argv[])
 	context ctx;
 	ctx.persons.put(person("aaa", "bbb"));
 	ctx.persons.put(person("ccc", "ddd"));
-	ctx.persons.put(person("ccc", "ddd"));
+	
+	/* Duplicate is rejected and set is not changed */
+	bool thrown = false;
+	try
+	{
+		ctx.persons.put(person("ccc", "eee"));
+	}
+	catch (constraint_violation&)
+	{
+		thrown = true;
+	}
+	assert(thrown);
+	assert(ctx.persons.size() == 2);
+	ctx.persons.put(person("eee", "fff"));
 	
 	{
 		dbset<person>::cursor cur(ctx.persons.all());
@@ -0,0 +1,118 @@
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <cassert>
+#include <magicunicorns.hpp>
+
+using namespace std;
+
+/**
+ * Person
+ */
+struct person: table
+{
+	field<int> id;
+	field<string> first_name;
+	field<string> second_name;
+	person(int id = 0, const string& first_name = "", const string& second_name = "") :
+		table(this, "person"), id(this, "id", id),
+		first_name(this, "first_name", first_name),
+		second_name(this, "second_name", second_name)
+	{
+	}
+	
+	friend ostream& operator<<(ostream& out, const person& p)
+	{
+		out << "person(" << p.id << ",\"" <<
+			p.first_name << "\", \"" <<
+			p.second_name << "\")";
+		return out;
+	}
+	
+	bool operator==(person& other)
+	{
+		return (id == other.id)	&& (first_name == other.first_name) && (second_name == other.second_name);
+	}
+};
+
+struct context: dbcontext
+{
+	dbset<person> persons;
+	context(): persons(this) {}
+};
+
+int
+main(int argc, char* argv[])
+{
+	{
+		/* Columns are matched by name, unknown ones are ignored */
+		context ctx;
+		istringstream in(
+			"second_name,extra,id,first_name\n"
+			"Smith,x,1,John\n"
+			"\"Kowal, ski\",y,2,\"Jan \"\"J\"\"\"\r\n"
+			"\n"
+			"Broken,z,abc,Row\n"
+			"Doe,w,-4,Jane");
+		assert(read_csv(ctx.persons, in) == 3);
+		assert(ctx.persons.size() == 3);
+		assert(ctx.persons.all()[0].first_name == "John");
+		assert(ctx.persons.all()[1].second_name == "Kowal, ski");
+		assert(ctx.persons.all()[1].first_name == "Jan \"J\"");
+		assert(ctx.persons.all()[2].id == -4);
+		
+		/* Export straight from view and back */
+		ostringstream out;
+		query_view<person, eq_impl<field_impl<int, person>, int> > view(
+			ctx.persons.where(F(&person::id) == 2));
+		write_csv(out, view);
+		assert(out.str() == "id,first_name,second_name\n2,\"Jan \"\"J\"\"\",\"Kowal, ski\"\n");
+		
+		context copy;
+		istringstream again(out.str());
+		assert(read_csv(copy.persons, again) == 1);
+		assert(copy.persons.all()[0] == ctx.persons.all()[1]);
+	}
+	
+	{
+		/* JSON array of objects */
+		context ctx;
+		istringstream in(
+			"[ {\"id\": 1, \"first_name\": \"John\", \"second_name\": \"Smith\", \"tags\": [1, {\"a\": 2}]},\n"
+			"  {\"first_name\": \"Jan\\n\\u0141\", \"id\": 2, \"second_name\": null},\n"
+			"  {\"id\": \"x\", \"first_name\": \"Bad\"} ]");
+		assert(read_json(ctx.persons, in) == 2);
+		assert(ctx.persons.all()[0].second_name == "Smith");
+		assert(ctx.persons.all()[1].first_name == "Jan\n\xc5\x81");
+		assert(ctx.persons.all()[1].second_name == "");
+		
+		ostringstream out;
+		write_json(out, ctx.persons.all());
+		assert(out.str() == "[\n"
+			"{\"id\":1,\"first_name\":\"John\",\"second_name\":\"Smith\"},\n"
+			"{\"id\":2,\"first_name\":\"Jan\\n\xc5\x81\",\"second_name\":\"\"}\n"
+			"]\n");
+		
+		context copy;
+		istringstream again(out.str());
+		assert(read_json(copy.persons, again) == 2);
+		assert(copy.persons.all()[1] == ctx.persons.all()[1]);
+	}
+	
+	{
+		/* Many batches parsed on another thread */
+		context ctx;
+		string csv("id,first_name,second_name\n");
+		for (int i = 0; i < 200000; i++)
+			csv += to_string(i) + ",John,Smith\n";
+		istringstream in(csv);
+		assert(read_csv(ctx.persons, in, true) == 200000);
+		assert(ctx.persons.size() == 200000);
+		assert(ctx.persons.all()[199999].id == 199999);
+		
+		ostringstream out;
+		write_csv(out, ctx.persons.all());
+		assert(out.str() == csv);
+	}
+	return 0;
+}
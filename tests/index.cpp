@@ -0,0 +1,145 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cassert>
+#include <magicunicorns.hpp>
+
+using namespace std;
+
+/**
+ * Person
+ */
+struct person: table
+{
+	field<int> id;
+	field<string> first_name;
+	field<string> second_name;
+	person(int id = 0, const string& first_name = "", const string& second_name = "") :
+		table(this, "person"), id(this, "id", id),
+		first_name(this, "first_name", first_name),
+		second_name(this, "second_name", second_name)
+	{
+	}
+	
+	friend ostream& operator<<(ostream& out, const person& p)
+	{
+		out << "person(" << p.id << ",\"" <<
+			p.first_name << "\", \"" <<
+			p.second_name << "\")";
+		return out;
+	}
+	
+	bool operator==(person& other)
+	{
+		return (id == other.id)	&& (first_name == other.first_name) && (second_name == other.second_name);
+	}
+};
+
+/* Rows compared by tag::operator== */
+static int comparisons = 0;
+
+/**
+ * Row whose equality does not depend on indexed field
+ */
+struct tag: table
+{
+	field<int> id;
+	field<string> name;
+	tag(int id = 0, const string& name = "") :
+		table(this, "tag"), id(this, "id", id), name(this, "name", name)
+	{
+	}
+	
+	bool operator==(tag& other)
+	{
+		comparisons++;
+		return name == other.name;
+	}
+};
+
+struct context: dbcontext
+{
+	dbset<person> persons;
+	dbset<tag> tags;
+	context(): persons(this), tags(this) {}
+};
+
+int
+main(int argc, char* argv[])
+{
+	context ctx;
+	ctx.persons.put(person(1, "John", "Smith"));
+	ctx.persons.put(person(2, "Jan", "Kowalski"));
+	ctx.persons.put(person(3, "hello", "world"));
+	
+	ctx.persons.add_index<ordered_index>(&person::id);
+	ctx.persons.add_index<hash_index>(&person::first_name);
+	assert(ctx.persons.find_index<hash_index>(&person::id) == NULL);
+	
+	ctx.persons.put(person(4, "asdf", "zxcv"));
+	ctx.persons.put(person(5, "John", "Appleseed"));
+	
+	{
+		/* Expressions with indexed fields are looked up */
+		vector<size_t> positions;
+		eq_impl<field_impl<string, person>, const char*> by_name(F(&person::first_name) == "John");
+		assert((index_lookup<eq_impl<field_impl<string, person>, const char*>, person>::find(
+			ctx.persons, by_name, positions)));
+		assert(positions.size() == 2);
+		
+		positions.clear();
+		eq_impl<field_impl<string, person>, const char*> by_surname(F(&person::second_name) == "Smith");
+		assert(!(index_lookup<eq_impl<field_impl<string, person>, const char*>, person>::find(
+			ctx.persons, by_surname, positions)));
+	}
+	
+	assert(ctx.persons.filter(F(&person::first_name) == "John").size() == 2);
+	assert(ctx.persons.filter(F(&person::id) == val(2)).size() == 1);
+	assert(ctx.persons.filter(F(&person::id) > 3).size() == 2);
+	assert(ctx.persons.filter(F(&person::id) < 3).size() == 2);
+	{
+		dbset<person>::container_type result = ctx.persons.filter(
+			(F(&person::id) > 1) & (F(&person::id) < 5) & (F(&person::first_name) == "John"));
+		assert(result.empty());
+		result = ctx.persons.filter(
+			(F(&person::id) > 0) & (F(&person::first_name) == "John"));
+		assert(result.size() == 2);
+		assert(result[0].id == 1);
+		assert(result[1].id == 5);
+	}
+	
+	/* Indexes follow updates */
+	ctx.persons.update(F(&person::id) == 2, F(&person::first_name) = val("John"));
+	assert(ctx.persons.filter(F(&person::first_name) == "John").size() == 3);
+	assert(ctx.persons.filter(F(&person::first_name) == "Jan").empty());
+	ctx.persons.update(F(&person::id) > 3, F(&person::id) = F(&person::id) + val(10));
+	assert(ctx.persons.filter(F(&person::id) > 10).size() == 2);
+	assert(ctx.persons.filter(F(&person::id) == 4).empty());
+	assert(ctx.persons.filter(F(&person::id) == 14).size() == 1);
+	
+	/* exists() checks rows with the same key first */
+	person p(3, "hello", "world");
+	assert(ctx.persons.exists(&p));
+	person q(3, "hello", "there");
+	assert(!ctx.persons.exists(&q));
+	
+	/* ...but finds equal rows with other key too */
+	ctx.tags.put(tag(1, "red"));
+	ctx.tags.put(tag(2, "green"));
+	ctx.tags.add_index<hash_index>(&tag::id);
+	tag red(7, "red");
+	assert(ctx.tags.exists(&red));
+	tag blue(1, "blue");
+	assert(!ctx.tags.exists(&blue));
+	
+	/* Index of field compared by operator== answers alone */
+	for (int i = 0; i < 1000; i++)
+		ctx.tags.put(tag(i + 3, "other"));
+	ctx.tags.add_index<hash_index>(&tag::name, true);
+	comparisons = 0;
+	assert(!ctx.tags.exists(&blue));
+	assert(comparisons == 0);
+	assert(ctx.tags.exists(&red));
+	assert(comparisons == 1);
+	return 0;
+}
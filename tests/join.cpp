@@ -0,0 +1,116 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cassert>
+#include <magicunicorns.hpp>
+
+using namespace std;
+
+/**
+ * Person
+ */
+struct person: table
+{
+	field<int> id;
+	field<string> first_name;
+	field<string> second_name;
+	person(int id = 0, const string& first_name = "", const string& second_name = "") :
+		table(this, "person"), id(this, "id", id),
+		first_name(this, "first_name", first_name),
+		second_name(this, "second_name", second_name)
+	{
+		addTrigger(F(&person::id) == 0, F(&person::id) = MAX(F(&person::id)) + val(1));
+	}
+
+	bool operator==(person& other)
+	{
+		return (id == other.id)	&& (first_name == other.first_name) && (second_name == other.second_name);
+	}
+};
+
+/**
+ * Event of person
+ */
+struct event: table
+{
+	field<int> person_id;
+	field<string> name;
+	event(int person_id = 0, const string& name = "") :
+		table(this, "event"), person_id(this, "person_id", person_id),
+		name(this, "name", name) {}
+
+	bool operator==(event& other)
+	{
+		return (person_id == other.person_id) && (name == other.name);
+	}
+};
+
+struct context: dbcontext
+{
+	dbset<person> persons;
+	dbset<event> events;
+	context(): persons(this), events(this) {}
+};
+
+/* Person id and event name of every joined pair */
+template <typename R>
+static vector<pair<int, string> > pairs(R range)
+{
+	vector<pair<int, string> > out;
+	for (typename R::iterator it(range.begin()), last(range.end()); it != last; ++it)
+		out.push_back(make_pair(int((*it).first.id), string((*it).second.name)));
+	return out;
+}
+
+int
+main(int argc, char* argv[])
+{
+	context ctx;
+	ctx.persons.put(person(0, "John", "Smith"));
+	ctx.persons.put(person(0, "Jan", "Kowalski"));
+	ctx.persons.put(person(0, "Hans", "Schmidt"));
+	ctx.events.put(event(2, "login"));
+	ctx.events.put(event(1, "login"));
+	ctx.events.put(event(2, "logout"));
+	ctx.events.put(event(7, "login"));
+	ctx.events.put(event(2, "purchase"));
+
+	/* Smaller set is hashed, pairs come in order of the other one */
+	vector<pair<int, string> > joined(pairs(ctx.persons.join(ctx.events,
+		F(&person::id) == F(&event::person_id))));
+	assert(joined.size() == 4);
+	assert(joined[0] == make_pair(2, string("login")));
+	assert(joined[1] == make_pair(1, string("login")));
+	assert(joined[3] == make_pair(2, string("purchase")));
+
+	/* Rows are referenced, not copied */
+	for (auto p : ctx.persons.join(ctx.events, F(&person::id) == F(&event::person_id)))
+	{
+		if (p.second.name == "purchase")
+			assert(&p.first == &ctx.persons.all()[1]);
+	}
+
+	/* Other side is hashed when it is smaller */
+	for (int i = 0; i < 10; i++)
+		ctx.persons.put(person(0, "Anna", "Nowak"));
+	vector<pair<int, string> > probed(pairs(ctx.persons.join(ctx.events,
+		F(&person::id) == F(&event::person_id))));
+	assert(probed.size() == 5);
+	assert(probed[0] == make_pair(1, string("login")));
+	assert(probed[1] == make_pair(2, string("login")));
+	assert(probed[2] == make_pair(2, string("logout")));
+
+	/* Hash index of key is used instead of table, result is the same */
+	ctx.events.add_index<hash_index>(&event::person_id);
+	assert(pairs(ctx.persons.join(ctx.events, F(&person::id) == F(&event::person_id))) == probed);
+
+	/* Removed rows are not joined */
+	ctx.persons.remove(F(&person::id) == 2);
+	assert(pairs(ctx.persons.join(ctx.events, F(&person::id) == F(&event::person_id))).size() == 2);
+	int count = 0;
+	for (auto p : ctx.events.join(ctx.persons, F(&event::person_id) == F(&person::id)))
+		count += p.second.id == 1;
+	assert(count == 1);
+	return 0;
+}
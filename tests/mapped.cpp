@@ -0,0 +1,145 @@
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cassert>
+#include <magicunicorns.hpp>
+
+using namespace std;
+
+/**
+ * Person
+ */
+struct person: table
+{
+	field<int> id;
+	field<string> first_name;
+	field<string> second_name;
+	person(int id = 0, const string& first_name = "", const string& second_name = "") :
+		table(this, "person"), id(this, "id", id),
+		first_name(this, "first_name", first_name),
+		second_name(this, "second_name", second_name)
+	{
+	}
+	
+	friend ostream& operator<<(ostream& out, const person& p)
+	{
+		out << "person(" << p.id << ",\"" <<
+			p.first_name << "\", \"" <<
+			p.second_name << "\")";
+		return out;
+	}
+	
+	bool operator==(person& other)
+	{
+		return (id == other.id)	&& (first_name == other.first_name) && (second_name == other.second_name);
+	}
+};
+
+/**
+ * Value owning memory, with serializer of its own
+ */
+struct label
+{
+	string text;
+	
+	label(const string& t = string()): text(t) {}
+	bool operator==(const label& other) const { return text == other.text; }
+	friend ostream& operator<<(ostream& out, const label& l) { return out << l.text; }
+	friend istream& operator>>(istream& in, label& l) { return in >> l.text; }
+};
+
+template <>
+struct get_type<label> { std::string value() const { return "TEXT"; } };
+
+template <>
+struct serializer<label>
+{
+	enum { width = 0 };
+	
+	static void write(std::string& out, const label& value)
+	{
+		serializer<string>::write(out, value.text);
+	}
+	
+	static bool read(const char*& p, const char* end, label& value)
+	{
+		return serializer<string>::read(p, end, value.text);
+	}
+};
+
+struct note: table
+{
+	field<int> id;
+	field<label> text;
+	note(int id = 0, const string& text = "") :
+		table(this, "note"), id(this, "id", id), text(this, "text", label(text)) {}
+};
+
+struct context: dbcontext
+{
+	dbset<person> persons;
+	context(): persons(this) {}
+};
+
+static const int total = 10000;
+
+int
+main(int argc, char* argv[])
+{
+	context ctx;
+	for (int i = 0; i < total; i++)
+		ctx.persons.put(person(i, i % 3 ? "John" : "Jan", i % 2 ? "Smith" : "Kowalski"));
+	assert(mapped_set<person>::write(ctx.persons.all(), "persons.map"));
+	
+	mapped_set<person> persons;
+	assert(!persons.open("missing.map"));
+	assert(persons.open("persons.map"));
+	assert(persons.size() == size_t(total));
+	
+	/* Values are read in place */
+	const int* ids = persons.values(&person::id);
+	assert(ids);
+	assert(ids[0] == 0 && ids[total - 1] == total - 1);
+	assert(!persons.values(&person::first_name));
+	assert(persons.get(&person::first_name, 4) == "John");
+	assert(persons.get(&person::second_name, 3) == "Smith");
+	
+	person p(persons.row(42));
+	assert(p.id == 42);
+	assert(p.first_name == "Jan");
+	assert(p.second_name == "Kowalski");
+	
+	/* Vectorized scan of mapped column */
+	assert(persons.count(F(&person::id) < 100) == 100);
+	dbset<person>::container_type result = persons.filter((F(&person::id) > 10) & (F(&person::id) < 13));
+	assert(result.size() == 2);
+	assert(result[0].id == 11 && result[1].id == 12);
+	
+	/* Other expressions are evaluated with rows */
+	assert(persons.count(F(&person::first_name) == "Jan") == size_t((total + 2) / 3));
+	assert(persons.filter((F(&person::id) < 6) & (F(&person::second_name) == "Smith")).size() == 3);
+	
+	/* Values owning memory are stored out of line, not as their bytes */
+	{
+		vector<note> notes;
+		for (int i = 0; i < 100; i++)
+			notes.push_back(note(i, string(i, 'x')));
+		assert(mapped_set<note>::write(notes, "notes.map"));
+		mapped_set<note> mapped;
+		assert(mapped.open("notes.map"));
+		assert(!mapped.values(&note::text));
+		assert(mapped.get(&note::text, 42).text == string(42, 'x'));
+		assert(mapped.row(99).text.value_.text == string(99, 'x'));
+		remove("notes.map");
+	}
+	
+	/* Damaged file is refused */
+	{
+		FILE* f = fopen("persons.map", "r+b");
+		fputc('X', f);
+		fclose(f);
+	}
+	mapped_set<person> damaged;
+	assert(!damaged.open("persons.map"));
+	return 0;
+}
@@ -0,0 +1,103 @@
+#include <iostream>
+#include <string>
+#include <cassert>
+#include <magicunicorns.hpp>
+
+using namespace std;
+
+/**
+ * Person
+ */
+struct person: table
+{
+	field<int> id;
+	field<string> first_name;
+	field<string> second_name;
+	person(int id = 0, const string& first_name = "", const string& second_name = "") :
+		table(this, "person"), id(this, "id", id),
+		first_name(this, "first_name", first_name),
+		second_name(this, "second_name", second_name)
+	{
+	}
+	
+	friend ostream& operator<<(ostream& out, const person& p)
+	{
+		out << "person(" << p.id << ",\"" <<
+			p.first_name << "\", \"" <<
+			p.second_name << "\")";
+		return out;
+	}
+	
+	bool operator==(person& other)
+	{
+		return (id == other.id)	&& (first_name == other.first_name) && (second_name == other.second_name);
+	}
+};
+
+struct context: dbcontext
+{
+	dbset<person> persons;
+	context(): persons(this) {}
+};
+
+
+int
+main(int argc, char* argv[])
+{
+	context ctx;
+	ctx.persons.put(person(1, "John", "Smith"));
+	ctx.persons.put(person(2, "Jan", "Kowalski"));
+	
+	/* Existing rows are loaded */
+	materialized_aggregate<person, sum_impl<person, int> >& sum = ctx.persons.materialize(SUM(F(&person::id)));
+	materialized_aggregate<person, count_impl>& count = ctx.persons.materialize(COUNT());
+	materialized_aggregate<person, min_impl<person, int> >& min = ctx.persons.materialize(MIN(F(&person::id)));
+	materialized_aggregate<person, max_impl<person, int> >& max = ctx.persons.materialize(MAX(F(&person::id)));
+	materialized_aggregate<person, avg_impl<person, int> >& avg = ctx.persons.materialize(AVG(F(&person::id)));
+	materialized_group<string, person, count_impl>& names = ctx.persons.materialize(F(&person::second_name), COUNT());
+	materialized_group<string, person, max_impl<person, int> >& top = ctx.persons.materialize(F(&person::second_name), MAX(F(&person::id)));
+	assert(sum.result() == 3);
+	assert(count.result() == 2);
+	assert(names.result("Smith") == 1);
+	assert(names.result("Doe") == 0);
+	
+	/* Same aggregate is materialized once */
+	assert(&ctx.persons.materialize(SUM(F(&person::id))) == &sum);
+	assert(&ctx.persons.materialize(F(&person::second_name), COUNT()) == &names);
+	
+	/* Inserts */
+	ctx.persons.put(person(3, "Adam", "Smith"));
+	ctx.persons.put(person(6, "Anna", "Kowalski"));
+	ctx.persons.put(person(8, "Jane", "Smith"));
+	assert(sum.result() == 20);
+	assert(count.result() == 5);
+	assert(min.result() == 1);
+	assert(max.result() == 8);
+	assert(avg.result() == 4.0);
+	assert(names.size() == 2);
+	assert(names.result("Smith") == 3);
+	assert(top.result("Kowalski") == 6);
+	
+	/* Updates remove old values, including current extremes */
+	ctx.persons.update(F(&person::id) > 5, F(&person::id) = val(4));
+	assert(sum.result() == 14);
+	assert(max.result() == 4);
+	assert(top.result("Smith") == 4);
+	ctx.persons.update(F(&person::id) == 1, F(&person::id) = val(5));
+	assert(min.result() == 2);
+	assert(max.result() == 5);
+	
+	/* Rows move between groups */
+	ctx.persons.update(F(&person::second_name) == "Kowalski", F(&person::second_name) = val("Doe"));
+	assert(names.size() == 2);
+	assert(names.result("Kowalski") == 0);
+	assert(names.result("Doe") == 2);
+	assert(top.result("Doe") == 4);
+	
+	/* Expressions read materialized results */
+	ctx.persons.update(F(&person::first_name) == "Jan", F(&person::id) = SUM(F(&person::id)) + MIN(F(&person::id)));
+	assert(ctx.persons.filter(F(&person::first_name) == "Jan").front().id == 20);
+	assert(sum.result() == 36);
+	assert(get<0>(ctx.persons.aggregate(SUM(F(&person::id)))) == 36);
+	return 0;
+}
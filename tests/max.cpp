@@ -43,6 +43,19 @@ struct context: dbcontext
 
 static context ctx;
 
+/* Maximum of id is known without scan? */
+static bool max_known()
+{
+	for (size_t i = 0; i < ctx.persons.observers_.size(); i++)
+	{
+		max_aggregate<int, person>* agg =
+			dynamic_cast<max_aggregate<int, person>*>(ctx.persons.observers_[i]);
+		if (agg && agg->field_ == &person::id)
+			return agg->valid_;
+	}
+	return false;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -55,6 +68,33 @@ main(int argc, char *argv[])
 	assert((*cur).id == 2);
 	++cur;
 	assert((*cur).id == 3);
+	
+	/* Maximum is maintained by put() */
+	assert(ctx.persons.max_of(&person::id) == 3);
+	ctx.persons.put(person("null", "null"));
+	assert(ctx.persons.max_of(&person::id) == 4);
+	assert(ctx.persons.max_of(&person::first_name) == "null");
+	
+	/* ...and recomputed after update */
+	ctx.persons.update(F(&person::id) > 2, F(&person::id) = val(0));
+	assert(ctx.persons.max_of(&person::id) == 2);
+	ctx.persons.put(person("null", "null"));
+	assert(ctx.persons.all().back().id == 3);
+	
+	/* Updates which do not lower maximum keep it */
+	assert(max_known());
+	ctx.persons.update(F(&person::id) == 1, F(&person::second_name) = val("Smith"));
+	assert(max_known());
+	ctx.persons.update(F(&person::id) == 1, F(&person::id) = val(10));
+	assert(max_known());
+	assert(ctx.persons.max_of(&person::id) == 10);
+	ctx.persons.put(person("null", "null"));
+	assert(ctx.persons.all().back().id == 11);
+	
+	/* Lowered maximum is computed again */
+	ctx.persons.update(F(&person::id) == 11, F(&person::id) = val(5));
+	assert(!max_known());
+	assert(ctx.persons.max_of(&person::id) == 10);
 	return 0;
 }
 
@@ -0,0 +1,136 @@
+#include <iostream>
+#include <string>
+#include <cassert>
+#include <magicunicorns.hpp>
+
+using namespace std;
+
+/**
+ * Value which counts its copies
+ */
+struct counted
+{
+	static int copies;
+	
+	string value;
+	
+	counted(const string& v = string()): value(v) {}
+	counted(const counted& other): value(other.value) { copies++; }
+	counted(counted&& other) noexcept: value(std::move(other.value)) {}
+	counted& operator=(const counted& other) { value = other.value; copies++; return *this; }
+	counted& operator=(counted&& other) noexcept { value = std::move(other.value); return *this; }
+	
+	bool operator==(const counted& other) const { return value == other.value; }
+	bool operator<(const counted& other) const { return value < other.value; }
+	
+	friend ostream& operator<<(ostream& out, const counted& c) { return out << c.value; }
+	friend istream& operator>>(istream& in, counted& c) { return in >> c.value; }
+};
+
+int counted::copies = 0;
+
+template <>
+struct get_type<counted> { std::string value() const { return "TEXT"; } };
+
+/* Stored as its string, bytes of counted are not its value */
+template <>
+struct serializer<counted>
+{
+	enum { width = 0 };
+	
+	static void write(std::string& out, const counted& value)
+	{
+		serializer<string>::write(out, value.value);
+	}
+	
+	static bool read(const char*& p, const char* end, counted& value)
+	{
+		return serializer<string>::read(p, end, value.value);
+	}
+};
+
+/**
+ * Person
+ */
+struct person: table
+{
+	field<int> id;
+	field<counted> name;
+	person(const string& name = "") :
+		table(this, "person"), id(this, "id"),
+		name(this, "name", counted(name))
+	{
+		this->name.constraint = uppercase_name;
+		addTrigger(F(&person::id) == 0, F(&person::id) = MAX(F(&person::id)) + val(1));
+	}
+	
+	/* Constraint evaluated with row which ends up in set */
+	struct upper_impl: abstract_constraint
+	{
+		virtual void operator()(abstract_field* fld, table*, abstract_dbset*)
+		{
+			string& value = dynamic_cast<field<counted>*>(fld)->value_.value;
+			for (size_t i = 0; i < value.size(); i++)
+				value[i] = toupper(value[i]);
+		}
+	};
+	
+	static constraint<upper_impl> uppercase_name;
+	
+	bool operator==(person& other)
+	{
+		return (id == other.id) && (name == other.name);
+	}
+};
+
+constraint<person::upper_impl> person::uppercase_name;
+
+struct context: dbcontext
+{
+	dbset<person> persons;
+	context(): persons(this) {}
+};
+
+int
+main(int argc, char* argv[])
+{
+	/* Rows are moved when storage grows */
+	static_assert(std::is_nothrow_move_constructible<person>::value, "rows must move");
+	
+	context ctx;
+	counted::copies = 0;
+	ctx.persons.put(person("john"));
+	ctx.persons.emplace("jan");
+	for (int i = 0; i < 1000; i++)
+		ctx.persons.emplace("anna");
+	assert(counted::copies == 0);
+	
+	/* Constraints and triggers changed stored rows */
+	assert(ctx.persons.all()[0].name.value_.value == "JOHN");
+	assert(ctx.persons.all()[1].name.value_.value == "JAN");
+	assert(ctx.persons.all()[1].id == 2);
+	assert(ctx.persons.all().back().id == 1002);
+	
+	/* Moved row keeps its schema */
+	person moved(std::move(ctx.persons.all()[0]));
+	assert(moved.name.schema() == ctx.persons.all()[1].name.schema());
+	assert(moved.name.name() == "name");
+	
+	/* Value is serialized by its own serializer */
+	string data;
+	ctx.persons.all()[1].name.write(data);
+	person read;
+	const char* cur = data.data();
+	assert(read.name.read(cur, data.data() + data.size()));
+	assert(cur == data.data() + data.size());
+	assert(read.name.value_.value == "JAN");
+	assert(read.name.width() == 0);
+	
+	/* Only explicit copy copies */
+	person p("adam");
+	ctx.persons.put(p);
+	assert(counted::copies == 1);
+	ctx.persons.put(std::move(p));
+	assert(counted::copies == 1);
+	return 0;
+}
@@ -0,0 +1,84 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cassert>
+#include <magicunicorns.hpp>
+
+using namespace std;
+
+/**
+ * Person
+ */
+struct person: table
+{
+	field<int> id;
+	field<string> first_name;
+	field<string> second_name;
+	person(int id = 0, const string& first_name = "", const string& second_name = "") :
+		table(this, "person"), id(this, "id", id),
+		first_name(this, "first_name", first_name),
+		second_name(this, "second_name", second_name)
+	{
+		addTrigger(F(&person::id) == 0, F(&person::id) = MAX(F(&person::id)) + val(1));
+	}
+
+	bool operator==(person& other)
+	{
+		return (id == other.id)	&& (first_name == other.first_name) && (second_name == other.second_name);
+	}
+};
+
+struct context: dbcontext
+{
+	dbset<person> persons;
+	context(): persons(this) {}
+};
+
+/* Ids of rows in range */
+template <typename R>
+static vector<int> ids(R range)
+{
+	vector<int> out;
+	for (typename R::iterator it(range.begin()), last(range.end()); it != last; ++it)
+		out.push_back(it->id);
+	return out;
+}
+
+int
+main(int argc, char* argv[])
+{
+	context ctx;
+	const char* names[] = { "Smith", "Kowalski", "Schmidt", "Nowak" };
+	for (int i = 0; i < 100; i++)
+		ctx.persons.put(person(0, "John", names[(i * 7) % 4]));
+
+	/* Whole set, ascending and descending */
+	vector<int> all(ids(ctx.persons.order_by(F(&person::id))));
+	assert(all.size() == 100 && all.front() == 1 && all.back() == 100);
+	vector<int> top(ids(ctx.persons.order_by(F(&person::id), true).limit(3)));
+	assert(top.size() == 3 && top[0] == 100 && top[1] == 99 && top[2] == 98);
+
+	/* Equal keys keep order of set */
+	vector<int> page(ids(ctx.persons.order_by(F(&person::second_name)).offset(2).limit(3)));
+	assert(page.size() == 3 && page[0] == 12 && page[1] == 16 && page[2] == 20);
+
+	/* Filtered, past the end */
+	vector<int> smiths(ids(ctx.persons.where(F(&person::second_name) == "Smith").
+		order_by(F(&person::id), true).offset(20).limit(10)));
+	assert(smiths.size() == 5 && smiths[0] == 17 && smiths[4] == 1);
+	assert(ids(ctx.persons.order_by(F(&person::id)).limit(0)).empty());
+	assert(ids(ctx.persons.order_by(F(&person::id)).offset(200)).empty());
+
+	/* Ordered index is walked, result is the same */
+	ctx.persons.add_index<ordered_index>(&person::id);
+	assert(ids(ctx.persons.where(F(&person::second_name) == "Smith").
+		order_by(F(&person::id), true).offset(20).limit(10)) == smiths);
+	assert(ids(ctx.persons.order_by(F(&person::id), true).limit(3)) == top);
+	ctx.persons.add_index<ordered_index>(&person::second_name);
+	assert(ids(ctx.persons.order_by(F(&person::second_name)).offset(2).limit(3)) == page);
+
+	/* Removed rows are skipped */
+	ctx.persons.remove(F(&person::id) > 98);
+	assert(ids(ctx.persons.order_by(F(&person::id), true).limit(1))[0] == 98);
+	return 0;
+}
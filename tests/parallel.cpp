@@ -0,0 +1,132 @@
+#include <iostream>
+#include <string>
+#include <cassert>
+#include <magicunicorns.hpp>
+
+using namespace std;
+
+/**
+ * Person
+ */
+struct person: table
+{
+	field<int> id;
+	field<string> first_name;
+	field<string> second_name;
+	person(int id = 0, const string& first_name = "", const string& second_name = "") :
+		table(this, "person"), id(this, "id", id),
+		first_name(this, "first_name", first_name),
+		second_name(this, "second_name", second_name)
+	{
+	}
+	
+	friend ostream& operator<<(ostream& out, const person& p)
+	{
+		out << "person(" << p.id << ",\"" <<
+			p.first_name << "\", \"" <<
+			p.second_name << "\")";
+		return out;
+	}
+	
+	bool operator==(person& other)
+	{
+		return (id == other.id)	&& (first_name == other.first_name) && (second_name == other.second_name);
+	}
+};
+
+struct context: dbcontext
+{
+	dbset<person> persons;
+	context(): persons(this) {}
+};
+
+static const int total = 50000;
+
+int
+main(int argc, char* argv[])
+{
+	context ctx;
+	for (int i = 0; i < total; i++)
+		ctx.persons.put(person(i, i % 3 ? "John" : "Jan", "Smith"));
+	
+	dbset<person>::container_type expected = ctx.persons.filter(
+		(F(&person::id) > 100) & (F(&person::first_name) == "Jan"));
+	
+	ctx.threads(4);
+	assert(ctx.pool_->size() == 4);
+	
+	{
+		/* Same rows in the same order */
+		dbset<person>::container_type result = ctx.persons.filter(
+			(F(&person::id) > 100) & (F(&person::first_name) == "Jan"));
+		assert(result.size() == expected.size());
+		for (size_t i = 0; i < result.size(); i++)
+			assert(result[i].id == expected[i].id);
+		assert(ctx.persons.where(F(&person::first_name) == "Jan").count() == (total + 2) / 3);
+	}
+	
+	/* Parallel update keeps observers in sync */
+	ctx.persons.add_index<hash_index>(&person::first_name);
+	ctx.persons.update(F(&person::first_name) == "John", F(&person::id) = F(&person::id) + val(total));
+	ctx.persons.update(F(&person::id) > -1 /* all */, F(&person::second_name) = val("Doe"));
+	assert(ctx.persons.filter(F(&person::id) > total - 1).size() == size_t(total - (total + 2) / 3));
+	assert(ctx.persons.filter(F(&person::second_name) == "Doe").size() == size_t(total));
+	ctx.persons.update(F(&person::first_name) = val("Jan"));
+	assert(ctx.persons.filter(F(&person::first_name) == "Jan").size() == size_t(total));
+	
+	/* Parallel aggregate */
+	assert(ctx.persons.max_of(&person::id) == 2 * total - 1);
+	ctx.persons.update(F(&person::id) > total, F(&person::id) = val(0));
+	assert(ctx.persons.max_of(&person::id) == total - 2);
+	
+	/* Workers waking up late do not run chunks of the next job */
+	{
+		worker_pool pool(4);
+		vector<atomic<int> > runs(8);
+		for (int job = 0; job < 20000; job++)
+		{
+			for (size_t i = 0; i < runs.size(); i++)
+				runs[i] = 0;
+			std::function<void(size_t)> task([&runs](size_t chunk) { runs[chunk]++; });
+			pool.run(runs.size(), task);
+			for (size_t i = 0; i < runs.size(); i++)
+				assert(runs[i] == 1);
+		}
+	}
+	
+	/* Statement reading aggregate sees rows changed before, like without pool */
+	{
+		context other;
+		other.threads(4);
+		for (int i = 1; i <= 20000; i++)
+			other.persons.put(person(i, "John", "Smith"));
+		other.persons.update(F(&person::id) > 0, F(&person::id) = MAX(F(&person::id)) + val(1));
+		assert(other.persons.max_of(&person::id) == 40000);
+	}
+
+	/* Task can not run job of its own pool */
+	{
+		worker_pool pool(4);
+		atomic<int> refused(0);
+		std::function<void(size_t)> nested([](size_t) {});
+		std::function<void(size_t)> task([&pool, &nested, &refused](size_t)
+		{
+			try
+			{
+				pool.run(1, nested);
+			}
+			catch (logic_error&)
+			{
+				refused++;
+			}
+		});
+		pool.run(8, task);
+		assert(refused == 8);
+	}
+
+	/* Back to calling thread */
+	ctx.threads(1);
+	assert(ctx.pool_ == NULL);
+	assert(ctx.persons.filter(F(&person::id) == total - 2).size() == 1);
+	return 0;
+}
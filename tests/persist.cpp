@@ -0,0 +1,142 @@
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cassert>
+#include <csignal>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <magicunicorns.hpp>
+
+using namespace std;
+
+/**
+ * Person
+ */
+struct person: table
+{
+	field<int> id;
+	field<string> first_name;
+	field<string> second_name;
+	person(int id = 0, const string& first_name = "", const string& second_name = "") :
+		table(this, "person"), id(this, "id", id),
+		first_name(this, "first_name", first_name),
+		second_name(this, "second_name", second_name)
+	{
+		addTrigger(F(&person::id) == 0, F(&person::id) = MAX(F(&person::id)) + val(1));
+	}
+	
+	friend ostream& operator<<(ostream& out, const person& p)
+	{
+		out << "person(" << p.id << ",\"" <<
+			p.first_name << "\", \"" <<
+			p.second_name << "\")";
+		return out;
+	}
+	
+	bool operator==(person& other)
+	{
+		return (id == other.id)	&& (first_name == other.first_name) && (second_name == other.second_name);
+	}
+};
+
+struct context: dbcontext
+{
+	dbset<person> persons;
+	context(): persons(this)
+	{
+		persons.persist();
+	}
+};
+
+static const string path = "persist.db";
+
+int
+main(int argc, char* argv[])
+{
+	remove((path + "/snapshot").c_str());
+	remove((path + "/wal").c_str());
+	
+	{
+		/* Every put() and update() is logged */
+		context ctx;
+		assert(ctx.open(path));
+		assert(ctx.persons.size() == 0);
+		ctx.persons.put(person(0, "John", "Smith"));
+		ctx.persons.put(person(0, "Jan", "Kowalski"));
+		ctx.persons.put(person(0, "hello", "world"));
+		ctx.persons.update(F(&person::id) == 2, F(&person::second_name) = val("Nowak"));
+	}
+	
+	{
+		/* Log is replayed, triggers are not evaluated again */
+		context ctx;
+		assert(ctx.open(path));
+		assert(ctx.persons.size() == 3);
+		assert(ctx.persons.all()[0].id == 1);
+		assert(ctx.persons.all()[1].second_name == "Nowak");
+		assert(ctx.persons.all()[2].first_name == "hello");
+		
+		/* Snapshot replaces log */
+		assert(ctx.checkpoint());
+		ctx.persons.put(person(0, "Anna", "Smith"));
+		ctx.persons.update(F(&person::first_name) == "John", F(&person::first_name) = val("Johnny"));
+	}
+	
+	{
+		/* Snapshot and log tail */
+		context ctx;
+		assert(ctx.open(path));
+		assert(ctx.persons.size() == 4);
+		assert(ctx.persons.all()[0].first_name == "Johnny");
+		assert(ctx.persons.all()[3].id == 4);
+		assert(ctx.persons.max_of(&person::id) == 4);
+	}
+	
+	{
+		/* Torn record at the end of log is dropped */
+		FILE* wal = fopen((path + "/wal").c_str(), "ab");
+		fwrite("\x20\0\0\0garbage", 1, 11, wal);
+		fclose(wal);
+		
+		context ctx;
+		assert(ctx.open(path, dbcontext::commit_async));
+		assert(ctx.persons.size() == 4);
+		for (int i = 0; i < 1000; i++)
+			ctx.persons.put(person(0, "async", "write"));
+		assert(ctx.sync());
+	}
+	
+	{
+		context ctx;
+		assert(ctx.open(path));
+		assert(ctx.persons.size() == 1004);
+		assert(ctx.persons.all().back().id == 1004);
+		assert(ctx.persons.filter(F(&person::first_name) == "async").size() == 1000);
+	}
+	
+	{
+		/* Failed log is reported by put() when commit is synchronous */
+		context ctx;
+		assert(ctx.open(path));
+		struct stat st;
+		assert(stat((path + "/wal").c_str(), &st) == 0);
+		struct rlimit saved, limit;
+		getrlimit(RLIMIT_FSIZE, &saved);
+		limit = saved;
+		limit.rlim_cur = st.st_size;
+		signal(SIGXFSZ, SIG_IGN);
+		setrlimit(RLIMIT_FSIZE, &limit);
+		bool thrown = false;
+		try
+		{
+			ctx.persons.put(person(0, "lost", "write"));
+		}
+		catch (runtime_error&)
+		{
+			thrown = true;
+		}
+		setrlimit(RLIMIT_FSIZE, &saved);
+		assert(thrown);
+	}
+	return 0;
+}
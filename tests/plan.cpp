@@ -0,0 +1,84 @@
+#include <iostream>
+#include <string>
+#include <cassert>
+#include <type_traits>
+#include <magicunicorns.hpp>
+
+using namespace std;
+
+/**
+ * Person
+ */
+struct person: table
+{
+	field<int> id;
+	field<string> first_name;
+	field<string> second_name;
+	person(int id = 0, const string& first_name = "", const string& second_name = "") :
+		table(this, "person"), id(this, "id", id),
+		first_name(this, "first_name", first_name),
+		second_name(this, "second_name", second_name)
+	{
+	}
+	
+	friend ostream& operator<<(ostream& out, const person& p)
+	{
+		out << "person(" << p.id << ",\"" <<
+			p.first_name << "\", \"" <<
+			p.second_name << "\")";
+		return out;
+	}
+	
+	bool operator==(person& other)
+	{
+		return (id == other.id)	&& (first_name == other.first_name) && (second_name == other.second_name);
+	}
+};
+
+struct context: dbcontext
+{
+	dbset<person> persons;
+	context(): persons(this) {}
+};
+
+int
+main(int argc, char* argv[])
+{
+	/* Comparisons with values are compiled into compare kernels */
+	static_assert(is_same<
+		decltype(compile(F(&person::first_name) == "John")),
+		compare_impl<string, person, equal_to<string> > >::value, "eq kernel");
+	
+	/* Conjunction of comparisons is branchless */
+	static_assert(is_same<
+		decltype(compile((F(&person::id) > 1) & (F(&person::id) < 3))),
+		all_impl<compare_impl<int, person, greater<int> >,
+			compare_impl<int, person, less<int> > > >::value, "range kernel");
+	
+	/* Comparisons with expressions are kept */
+	static_assert(is_same<
+		decltype(compile(F(&person::id) == F(&person::id))),
+		eq_impl<field_impl<int, person>, field_impl<int, person> > >::value, "eq expr");
+	static_assert(is_same<
+		decltype(compile((F(&person::id) == F(&person::id)) & (F(&person::id) > 1))),
+		and_impl<eq_impl<field_impl<int, person>, field_impl<int, person> >,
+			compare_impl<int, person, greater<int> > > >::value, "and expr");
+	
+	person p(2, "John", "Smith");
+	assert(compile(F(&person::first_name) == "John")(&p));
+	assert(!compile(F(&person::first_name) == "Jan")(&p));
+	assert(compile((F(&person::id) > 1) & (F(&person::id) < 3))(&p));
+	assert(!compile((F(&person::id) > 2) & (F(&person::id) < 3))(&p));
+	assert(compile((F(&person::id) == val(2)) & (F(&person::second_name) == "Smith"))(&p));
+	
+	/* Sets evaluate compiled kernels */
+	context ctx;
+	ctx.persons.put(person(1, "John", "Smith"));
+	ctx.persons.put(person(2, "Jan", "Kowalski"));
+	ctx.persons.put(person(3, "hello", "world"));
+	assert(ctx.persons.filter((F(&person::id) > 1) & (F(&person::id) < 3)).size() == 1);
+	assert(ctx.persons.where(F(&person::first_name) == "John").count() == 1);
+	ctx.persons.update(F(&person::id) == 3, F(&person::first_name) = val("John"));
+	assert(ctx.persons.filter(F(&person::first_name) == "John").size() == 2);
+	return 0;
+}
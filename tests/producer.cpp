@@ -0,0 +1,95 @@
+#include <iostream>
+#include <string>
+#include <cassert>
+#include <thread>
+#include <magicunicorns.hpp>
+
+using namespace std;
+
+/**
+ * Person
+ */
+struct person: table
+{
+	field<int> id;
+	field<string> first_name;
+	field<string> second_name;
+	person(const string& first_name = "", const string& second_name = "") :
+		table(this, "person"), id(this, "id"),
+		first_name(this, "first_name", first_name),
+		second_name(this, "second_name", second_name)
+	{
+		addTrigger(F(&person::id) == 0, F(&person::id) = MAX(F(&person::id)) + val(1));
+	}
+	
+	friend ostream& operator<<(ostream& out, const person& p)
+	{
+		out << "person(" << p.id << ",\"" <<
+			p.first_name << "\", \"" <<
+			p.second_name << "\")";
+		return out;
+	}
+	
+	bool operator==(person& other)
+	{
+		return (id == other.id)	&& (first_name == other.first_name) && (second_name == other.second_name);
+	}
+};
+
+struct context: dbcontext
+{
+	dbset<person> persons;
+	context(): persons(this) {}
+};
+
+static const int threads = 8;
+static const int per_thread = 20000;
+
+int
+main(int argc, char* argv[])
+{
+	context ctx;
+	ctx.persons.put(person("first", "row"));
+	
+	/* Producers run while set is merged */
+	std::atomic<int> running(threads);
+	std::vector<std::thread> producers;
+	for (int t = 0; t < threads; t++)
+	{
+		producers.push_back(std::thread([&ctx, &running, t]()
+		{
+			producer<person> p(ctx.persons);
+			for (int i = 0; i < per_thread; i++)
+				p.put(person(to_string(t), to_string(i)));
+			p.flush();
+			running--;
+		}));
+	}
+	size_t merged = 0;
+	while (running)
+		merged += ctx.persons.merge();
+	for (int t = 0; t < threads; t++)
+		producers[t].join();
+	merged += ctx.persons.merge();
+	assert(merged == size_t(threads * per_thread));
+	assert(ctx.persons.merge() == 0);
+	
+	/* Ids set by trigger are unique */
+	assert(ctx.persons.size() == size_t(threads * per_thread + 1));
+	for (size_t i = 0; i < ctx.persons.size(); i++)
+		assert(ctx.persons.all()[i].id == int(i + 1));
+	
+	/* Rows of one producer keep their order */
+	int last = -1;
+	for (size_t i = 0; i < ctx.persons.size(); i++)
+	{
+		person& p = ctx.persons.all()[i];
+		if (p.first_name == "3")
+		{
+			assert(atoi(p.second_name.value_.c_str()) == last + 1);
+			last++;
+		}
+	}
+	assert(last == per_thread - 1);
+	return 0;
+}
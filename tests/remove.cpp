@@ -0,0 +1,183 @@
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cassert>
+#include <magicunicorns.hpp>
+
+using namespace std;
+
+/**
+ * Person
+ */
+struct person: table
+{
+	field<int> id;
+	field<string> first_name;
+	field<string> second_name;
+	person(int id = 0, const string& first_name = "", const string& second_name = "") :
+		table(this, "person"), id(this, "id", id),
+		first_name(this, "first_name", first_name),
+		second_name(this, "second_name", second_name)
+	{
+		addTrigger(F(&person::id) == 0, F(&person::id) = MAX(F(&person::id)) + val(1));
+	}
+
+	bool operator==(person& other)
+	{
+		return (id == other.id)	&& (first_name == other.first_name) && (second_name == other.second_name);
+	}
+};
+
+struct context: dbcontext
+{
+	dbset<person> persons;
+	context(): persons(this) {}
+};
+
+static const string path = "remove.db";
+
+int
+main(int argc, char* argv[])
+{
+	{
+		context ctx;
+		ctx.persons.add_column(&person::id);
+		ctx.persons.add_index<hash_index>(&person::second_name);
+		materialized_aggregate<person, sum_impl<person, int> >& sum =
+			ctx.persons.materialize(SUM(F(&person::id)));
+		ctx.persons.enable_snapshots();
+		for (int i = 0; i < 10; i++)
+			ctx.persons.put(person(0, "John", i % 2 ? "Smith" : "Kowalski"));
+		set_snapshot<person> before(ctx.persons.snapshot());
+
+		/* Removed rows stay in place, nothing is compacted yet */
+		assert(ctx.persons.remove((F(&person::id) == 3) | (F(&person::id) == 10)) == 2);
+		assert(ctx.persons.remove(F(&person::id) == 3) == 0);
+		assert(ctx.persons.size() == 8);
+		assert(ctx.persons.rows_.size() == 10);
+		assert(sum.result() == 55 - 13);
+		
+		/* all() holds only live rows and does not compact set */
+		assert(ctx.persons.all().size() == 8);
+		assert(ctx.persons.all()[2].id == 4);
+		assert(ctx.persons.rows_.size() == 10);
+		assert(ctx.persons.max_of(&person::id) == 9);
+
+		/* Scans of column, index and rows skip removed rows */
+		assert(ctx.persons.filter(F(&person::id) > 2).size() == 6);
+		assert(ctx.persons.filter(F(&person::second_name) == "Kowalski").size() == 4);
+		assert(ctx.persons.filter(F(&person::first_name) == "John").size() == 8);
+		assert(ctx.persons.where(F(&person::first_name) == "John").count() == 8);
+		assert(std::get<0>(ctx.persons.aggregate(COUNT())) == 8);
+		person p(3, "John", "Kowalski");
+		assert(!ctx.persons.exists(&p));
+
+		/* Updates do not touch removed rows */
+		ctx.persons.update(F(&person::first_name) = val("Jan"));
+		assert(ctx.persons.filter(F(&person::first_name) == "Jan").size() == 8);
+
+		/* Snapshots see removals once they are complete */
+		assert(before.size() == 10);
+		assert(ctx.persons.snapshot().size() == 8);
+		assert(ctx.persons.snapshot().count(F(&person::id) == 3) == 0);
+
+		/* Set is compacted when half of rows are removed */
+		assert(ctx.persons.remove(F(&person::id) < 6) == 4);
+		assert(ctx.persons.rows_.size() == 4);
+		assert(ctx.persons.rows_[0].id == 6);
+		assert(ctx.persons.filter(F(&person::id) == 9).front().id == 9);
+		assert(ctx.persons.filter(F(&person::second_name) == "Smith").size() == 2);
+		assert(sum.result() == 6 + 7 + 8 + 9);
+		assert(ctx.persons.snapshot().size() == 4);
+		assert(before.size() == 10);
+
+		/* Ids continue after maximum of live rows */
+		ctx.persons.put(person(0, "Anna", "Smith"));
+		assert(ctx.persons.all().back().id == 10);
+	}
+
+	{
+		/* Observers attached after removal skip removed rows */
+		context ctx;
+		for (int i = 0; i < 10; i++)
+			ctx.persons.put(person(0, "John", i % 2 ? "Smith" : "Kowalski"));
+		assert(ctx.persons.remove((F(&person::id) == 3) | (F(&person::id) == 10)) == 2);
+		assert(ctx.persons.rows_.size() == 10);
+		
+		ctx.persons.add_index<hash_index>(&person::id);
+		assert(ctx.persons.filter(F(&person::id) == 3).empty());
+		assert(ctx.persons.filter(F(&person::id) == 4).size() == 1);
+		person p(3, "John", "Kowalski");
+		assert(!ctx.persons.exists(&p));
+		
+		assert(ctx.persons.materialize(COUNT()).result() == 8);
+		assert(ctx.persons.materialize(SUM(F(&person::id))).result() == 55 - 13);
+		assert(ctx.persons.materialize(F(&person::second_name), COUNT()).result("Smith") == 4);
+		
+		ctx.persons.enable_snapshots();
+		set_snapshot<person> snapshot(ctx.persons.snapshot());
+		assert(snapshot.size() == 8);
+		int seen = 0;
+		for (set_snapshot<person>::iterator it(snapshot.begin()); it != snapshot.end(); ++it)
+			seen++;
+		assert(seen == 8);
+		
+		ctx.persons.add_column(&person::id);
+		assert(ctx.persons.filter(F(&person::id) > 2).size() == 6);
+	}
+
+	{
+		/* Removals are part of transaction */
+		context ctx;
+		for (int i = 0; i < 4; i++)
+			ctx.persons.put(person(0, "John", "Smith"));
+		ctx.begin();
+		ctx.persons.remove(F(&person::id) == 1);
+		assert(ctx.persons.size() == 4);
+		ctx.rollback();
+		assert(ctx.persons.size() == 4);
+		ctx.begin();
+		ctx.persons.remove(F(&person::id) == 1);
+		assert(ctx.commit());
+		assert(ctx.persons.size() == 3);
+		ctx.persons.compact();
+		assert(ctx.persons.rows_.size() == 3);
+	}
+
+	remove((path + "/snapshot").c_str());
+	remove((path + "/wal").c_str());
+	{
+		/* Removals and compactions are logged */
+		context ctx;
+		ctx.persons.persist();
+		assert(ctx.open(path));
+		for (int i = 0; i < 6; i++)
+			ctx.persons.put(person(0, "John", "Smith"));
+		ctx.persons.remove(F(&person::id) == 2);
+		ctx.persons.compact();
+		ctx.persons.remove(F(&person::id) == 4);
+		ctx.persons.update(F(&person::id) == 5, F(&person::first_name) = val("Jan"));
+	}
+
+	{
+		context ctx;
+		ctx.persons.persist();
+		assert(ctx.open(path));
+		assert(ctx.persons.size() == 4);
+		assert(ctx.persons.filter(F(&person::first_name) == "Jan").front().id == 5);
+
+		/* Snapshot holds only live rows */
+		assert(ctx.checkpoint());
+		assert(ctx.persons.rows_.size() == 4);
+		ctx.persons.remove(F(&person::id) == 1);
+	}
+
+	{
+		context ctx;
+		ctx.persons.persist();
+		assert(ctx.open(path));
+		assert(ctx.persons.size() == 3);
+		assert(ctx.persons.all()[0].id == 3);
+	}
+	return 0;
+}
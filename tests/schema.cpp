@@ -0,0 +1,196 @@
+#include <iostream>
+#include <string>
+#include <cassert>
+#include <thread>
+#include <chrono>
+#include <magicunicorns.hpp>
+
+using namespace std;
+
+/**
+ * Person
+ */
+struct person: table
+{
+	field<int> id;
+	field<string> first_name;
+	field<string> second_name;
+	person(const string& first_name = "", const string& second_name = "") :
+		table(this, "person"), id(this, "id"),
+		first_name(this, "first_name", first_name),
+		second_name(this, "second_name", second_name)
+	{
+		addTrigger(F(&person::id) == 0, F(&person::id) = MAX(F(&person::id)) + val(1));
+		this->first_name.constraint = ::uppercase;
+		assert(this->first_name.constraint.size() == 1);
+	}
+	
+	friend ostream& operator<<(ostream& out, const person& p)
+	{
+		out << "person(" << p.id << ",\"" <<
+			p.first_name << "\", \"" <<
+			p.second_name << "\")";
+		return out;
+	}
+	
+	bool operator==(person& other)
+	{
+		return (id == other.id)	&& (first_name == other.first_name) && (second_name == other.second_name);
+	}
+};
+
+/**
+ * Other row type stored in table of the same name
+ */
+struct customer: table
+{
+	field<string> name;
+	customer(): table(this, "person"), name(this, "name") {}
+	
+	/* Sets constraint default constructor does not set */
+	customer(const string& name): table(this, "person"), name(this, "name", name)
+	{
+		this->name.constraint = ::lowercase;
+	}
+};
+
+/**
+ * Row of table known by name, without default constructor
+ */
+struct user: table
+{
+	field<string> name;
+	user(const string& name): table("user"), name(this, "name", name)
+	{
+		this->name.constraint = ::uppercase;
+		this->name.constraint = ::lowercase;
+	}
+	
+	bool operator==(user& other)
+	{
+		return name == other.name;
+	}
+};
+
+/**
+ * Other row type using name of table user
+ */
+struct guest: table
+{
+	field<string> name;
+	guest(const string& name): table("user"), name(this, "name", name) {}
+	
+	bool operator==(guest& other)
+	{
+		return name == other.name;
+	}
+};
+
+/**
+ * Row of table known by name, constructed on two threads
+ */
+struct visitor: table
+{
+	field<string> name;
+	visitor(const string& name): table("visitor"), name(this, "name", name) {}
+};
+
+struct context: dbcontext
+{
+	dbset<person> persons;
+	context(): persons(this) {}
+};
+
+int
+main(int argc, char* argv[])
+{
+	context ctx;
+	for (int i = 0; i < 10; i++)
+		ctx.persons.put(person("john", "smith"));
+	
+	/* Rows share one schema */
+	person& first = ctx.persons.all().front();
+	person& last = ctx.persons.all().back();
+	assert(first.schema_ == last.schema_);
+	assert(first.schema_ == &table_schema::of<person>());
+	assert(first.tablename() == "person");
+	assert(first.first_name.schema() == last.first_name.schema());
+	
+	/* Schema is registered once */
+	table_schema* schema = first.schema_;
+	assert(schema->defined_);
+	assert(schema->fields_.size() == 3);
+	assert(schema->triggers.size() == 1);
+	assert(schema->fields_[0]->name_ == "id");
+	assert(schema->fields_[0]->type_ == "INTEGER");
+	assert(schema->fields_[1]->type_ == "TEXT");
+	assert(schema->fields_[1]->constraint.size() == 1);
+	assert(schema->fields_[2]->constraint.empty());
+	assert(last.second_name.name() == "second_name");
+	assert(last.second_name.type() == "TEXT");
+	
+	/* Copied rows still refer to the right fields */
+	assert(schema->fields_[2]->get(&last) == &last.second_name);
+	
+	/* Constraints and triggers still work */
+	assert(last.id == 10);
+	assert(last.first_name == "JOHN");
+	assert(last.second_name == "smith");
+	
+	/* Schema is keyed by row type, not by name of table */
+	customer c;
+	assert(c.schema_ != schema);
+	assert(c.tablename() == "person");
+	assert(c.schema_->fields_.size() == 1);
+	assert(schema->fields_.size() == 3);
+	
+	/* Constraints set by other constructors are ignored */
+	customer other("john");
+	assert(other.schema_ == c.schema_);
+	assert(c.name.constraint.size() == 0);
+	
+	/* Rows of table known by name share schema defined by first row */
+	user u1("john");
+	user u2("jan");
+	assert(u1.schema_ == u2.schema_);
+	assert(u1.schema_ == &table_schema::named("user"));
+	assert(u1.schema_->defined_);
+	assert(u1.tablename() == "user");
+	assert(u1.schema_->fields_.size() == 1);
+	
+	/* Constraints are appended */
+	assert(u2.name.constraint.size() == 2);
+	
+	/* Table known by name has rows of one type */
+	dbset<user> users(&ctx);
+	dbset<guest> guests(&ctx);
+	users.put(u1);
+	bool refused = false;
+	try
+	{
+		guests.put(guest("jan"));
+	}
+	catch (logic_error&)
+	{
+		refused = true;
+	}
+	assert(refused);
+	assert(guests.size() == 0);
+	
+	/* Rows on other threads wait until first row is complete */
+	{
+		visitor first("john");
+		atomic<bool> constructed(false);
+		thread other([&constructed]() { visitor v("jan"); constructed = true; });
+		this_thread::sleep_for(chrono::milliseconds(50));
+		assert(!constructed);
+		visitor copy(first);
+		other.join();
+		assert(constructed);
+		assert(first.schema_->fields_.size() == 1);
+	}
+	
+	/* Row holds only its values and pointers to schema */
+	assert(sizeof(field<int>) <= 3 * sizeof(void*));
+	return 0;
+}
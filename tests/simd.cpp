@@ -0,0 +1,90 @@
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <cassert>
+#include <magicunicorns.hpp>
+
+using namespace std;
+
+/**
+ * Measurement
+ */
+struct measurement: table
+{
+	field<int> id;
+	field<int> value;
+	field<string> name;
+	measurement(int id = 0, int value = 0, const string& name = "") :
+		table(this, "measurement"), id(this, "id", id),
+		value(this, "value", value),
+		name(this, "name", name)
+	{
+	}
+	
+	bool operator==(measurement& other)
+	{
+		return (id == other.id) && (value == other.value) && (name == other.name);
+	}
+};
+
+struct context: dbcontext
+{
+	dbset<measurement> rows;
+	dbset<measurement> columns;
+	context(): rows(this), columns(this) {}
+};
+
+/* Columnar set must select the same rows as row by row scan */
+template <typename F>
+void check(context& ctx, F f)
+{
+	dbset<measurement>::container_type expected = ctx.rows.filter(f);
+	dbset<measurement>::container_type result = ctx.columns.filter(f);
+	assert(expected.size() == result.size());
+	for (size_t i = 0; i < result.size(); i++)
+		assert(result[i].id == expected[i].id);
+	assert(ctx.columns.where(f).count() == expected.size());
+}
+
+int
+main(int argc, char* argv[])
+{
+	context ctx;
+	srand(42);
+	for (int i = 0; i < 1003; i++)
+	{
+		int value = rand() % 100 - 50;
+		ctx.rows.put(measurement(i, value, "name"));
+		ctx.columns.put(measurement(i, value, "name"));
+	}
+	ctx.columns.add_column(&measurement::id);
+	ctx.columns.add_column(&measurement::value);
+	
+	{
+		/* Vectorized kernels produce exact selection */
+		selection selected;
+		auto kernel = compile((F(&measurement::value) > -10) & (F(&measurement::value) < 10));
+		assert((vector_scan<decltype(kernel), measurement>::select(ctx.columns, kernel, selected)));
+		assert(selected.count() == ctx.rows.filter((F(&measurement::value) > -10) & (F(&measurement::value) < 10)).size());
+		assert(!(vector_scan<decltype(kernel), measurement>::select(ctx.rows, kernel, selected)));
+		
+		auto text = compile(F(&measurement::name) == "name");
+		assert(!(vector_scan<decltype(text), measurement>::select(ctx.columns, text, selected)));
+	}
+	
+	check(ctx, F(&measurement::value) == 7);
+	check(ctx, F(&measurement::value) < 0);
+	check(ctx, F(&measurement::value) > 25);
+	check(ctx, (F(&measurement::value) > -10) & (F(&measurement::value) < 10));
+	check(ctx, (F(&measurement::value) < -40) | (F(&measurement::value) > 40));
+	check(ctx, ((F(&measurement::value) < -40) | (F(&measurement::value) > 40)) & (F(&measurement::id) > 500));
+	check(ctx, (F(&measurement::value) > 0) & (F(&measurement::name) == "name"));
+	check(ctx, F(&measurement::id) > 1002);
+	
+	/* Updates through vectorized where */
+	ctx.columns.update(F(&measurement::value) < 0, F(&measurement::value) = val(0));
+	assert(ctx.columns.filter(F(&measurement::value) < 0).empty());
+	assert(ctx.columns.filter(F(&measurement::value) == 0).size() ==
+		ctx.rows.filter((F(&measurement::value) < 0) | (F(&measurement::value) == 0)).size());
+	return 0;
+}
@@ -0,0 +1,109 @@
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cassert>
+#include <magicunicorns.hpp>
+
+using namespace std;
+
+/**
+ * Person
+ */
+struct person: table
+{
+	field<int> id;
+	field<string> first_name;
+	field<string> second_name;
+	person(int id = 0, const string& first_name = "", const string& second_name = "") :
+		table(this, "person"), id(this, "id", id),
+		first_name(this, "first_name", first_name),
+		second_name(this, "second_name", second_name)
+	{
+	}
+	
+	friend ostream& operator<<(ostream& out, const person& p)
+	{
+		out << "person(" << p.id << ",\"" <<
+			p.first_name << "\", \"" <<
+			p.second_name << "\")";
+		return out;
+	}
+	
+	bool operator==(person& other)
+	{
+		return (id == other.id)	&& (first_name == other.first_name) && (second_name == other.second_name);
+	}
+};
+
+struct context: dbcontext
+{
+	dbset<person> persons;
+	context(): persons(this) {}
+};
+
+static const int total = 80000; /* More chunks than publisher starts with */
+
+int
+main(int argc, char* argv[])
+{
+	context ctx;
+	assert(ctx.persons.snapshot().size() == 0);
+	ctx.persons.put(person(1, "John", "Smith"));
+	ctx.persons.enable_snapshots();
+	
+	/* Snapshot does not change */
+	set_snapshot<person> first(ctx.persons.snapshot());
+	assert(first.size() == 1);
+	ctx.persons.put(person(2, "Jan", "Kowalski"));
+	ctx.persons.update(F(&person::id) == 1, F(&person::first_name) = val("Johnny"));
+	assert(first.size() == 1);
+	assert(first[0].first_name == "John");
+	
+	set_snapshot<person> second(ctx.persons.snapshot());
+	assert(second.size() == 2);
+	assert(second[0].first_name == "Johnny");
+	assert(second.count(F(&person::id) > 0) == 2);
+	assert(second.filter(F(&person::first_name) == "Jan").size() == 1);
+	
+	/* Readers run while rows are put and updated */
+	ctx.persons.update(F(&person::id) == 1, F(&person::second_name) = val("Doe"));
+	std::atomic<bool> done(false);
+	std::atomic<int> errors(0);
+	std::vector<std::thread> readers;
+	for (int r = 0; r < 4; r++)
+	{
+		readers.push_back(std::thread([&ctx, &done, &errors]()
+		{
+			while (!done)
+			{
+				set_snapshot<person> s(ctx.persons.snapshot());
+				/* Every version has all new rows with the same second name */
+				size_t smiths = s.count(F(&person::second_name) == "Smith");
+				if (smiths != 0 && smiths != s.size() - 2)
+					errors++;
+				size_t n = 0;
+				for (set_snapshot<person>::iterator it(s.begin()), end(s.end()); it != end; ++it)
+					n++;
+				if (n != s.size())
+					errors++;
+			}
+		}));
+	}
+	for (int i = 0; i < total; i++)
+	{
+		ctx.persons.put(person(i + 3, "Anna", "Smith"));
+		if (i % 1000 == 0)
+		{
+			/* All of them at once */
+			ctx.persons.update(F(&person::id) > 2, F(&person::second_name) = val("Doe"));
+			ctx.persons.update(F(&person::id) > 2, F(&person::second_name) = val("Smith"));
+		}
+	}
+	done = true;
+	for (size_t r = 0; r < readers.size(); r++)
+		readers[r].join();
+	assert(errors == 0);
+	assert(ctx.persons.snapshot().size() == size_t(total + 2));
+	assert(first.size() == 1 && first[0].first_name == "John");
+	return 0;
+}
@@ -0,0 +1,189 @@
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cassert>
+#include <magicunicorns.hpp>
+
+using namespace std;
+
+/**
+ * Person
+ */
+struct person: table
+{
+	field<int> id;
+	field<string> first_name;
+	field<string> second_name;
+	person(int id = 0, const string& first_name = "", const string& second_name = "") :
+		table(this, "person"), id(this, "id", id),
+		first_name(this, "first_name", first_name),
+		second_name(this, "second_name", second_name)
+	{
+		this->first_name.constraint = named;
+		addTrigger(F(&person::id) == 0, F(&person::id) = MAX(F(&person::id)) + val(1));
+	}
+	
+	/* Rejects empty names */
+	struct named_impl: abstract_constraint
+	{
+		virtual void operator()(abstract_field* fld, table*, abstract_dbset*)
+		{
+			if (dynamic_cast<field<string>*>(fld)->value_.empty())
+				throw constraint_violation("empty name");
+		}
+	};
+	
+	static constraint<named_impl> named;
+	
+	friend ostream& operator<<(ostream& out, const person& p)
+	{
+		out << "person(" << p.id << ",\"" <<
+			p.first_name << "\", \"" <<
+			p.second_name << "\")";
+		return out;
+	}
+	
+	bool operator==(person& other)
+	{
+		return (id == other.id)	&& (first_name == other.first_name) && (second_name == other.second_name);
+	}
+};
+
+constraint<person::named_impl> person::named;
+
+struct context: dbcontext
+{
+	dbset<person> persons;
+	dbset<person> archive;
+	context(): persons(this), archive(this)
+	{
+		persons.persist("persons");
+		archive.persist("archive");
+	}
+};
+
+static const string path = "transaction.db";
+
+int
+main(int argc, char* argv[])
+{
+	remove((path + "/snapshot").c_str());
+	remove((path + "/wal").c_str());
+	
+	{
+		context ctx;
+		assert(ctx.open(path));
+		
+		/* Nothing is applied before commit */
+		ctx.begin();
+		ctx.persons.put(person(0, "John", "Smith"));
+		ctx.persons.put(person(0, "Jan", "Kowalski"));
+		ctx.persons.update(F(&person::first_name) == "Jan", F(&person::second_name) = val("Nowak"));
+		ctx.persons.put(person(0, "Jan", "Doe"));
+		ctx.archive.put(person(0, "Anna", "Smith"));
+		assert(ctx.persons.size() == 0);
+		assert(ctx.archive.size() == 0);
+		
+		/* Changes are applied in order, with triggers */
+		assert(ctx.commit());
+		assert(ctx.persons.size() == 3);
+		assert(ctx.persons.all()[2].id == 3);
+		assert(ctx.persons.all()[1].second_name == "Nowak");
+		assert(ctx.persons.all()[2].second_name == "Doe");
+		assert(ctx.archive.size() == 1);
+		
+		/* Rollback */
+		ctx.begin();
+		ctx.persons.put(person(0, "Adam", "Smith"));
+		ctx.persons.update(F(&person::second_name) = val("Gone"));
+		ctx.rollback();
+		assert(ctx.commit());
+		assert(ctx.persons.size() == 3);
+		assert(ctx.persons.filter(F(&person::second_name) == "Gone").empty());
+		
+		/* Without transaction changes are applied at once */
+		ctx.persons.put(person(0, "Adam", "Smith"));
+		assert(ctx.persons.size() == 4);
+	}
+	
+	{
+		/* Committed transaction is recovered */
+		context ctx;
+		assert(ctx.open(path));
+		assert(ctx.persons.size() == 4);
+		assert(ctx.archive.size() == 1);
+		assert(ctx.persons.all()[1].second_name == "Nowak");
+		
+		ctx.begin();
+		ctx.persons.put(person(0, "Torn", "Transaction"));
+		ctx.archive.update(F(&person::first_name) = val("Torn"));
+		assert(ctx.commit());
+	}
+	
+	{
+		/* Lost end of transaction, as if it crashed while committing */
+		FILE* wal = fopen((path + "/wal").c_str(), "rb");
+		fseek(wal, 0, SEEK_END);
+		long size = ftell(wal);
+		fclose(wal);
+		/* size, checksum, sequence number, op and empty name */
+		assert(truncate((path + "/wal").c_str(), size - 21) == 0);
+		
+		context ctx;
+		assert(ctx.open(path));
+		assert(ctx.persons.size() == 4);
+		assert(ctx.archive.all()[0].first_name == "Anna");
+	}
+	
+	{
+		/* Transaction failing half way changes nothing */
+		context ctx;
+		ctx.persons.enable_snapshots();
+		assert(ctx.open(path));
+		ctx.persons.remove(F(&person::first_name) == "Adam");
+		assert(ctx.persons.size() == 3);
+		
+		ctx.begin();
+		ctx.persons.put(person(0, "Eve", "Smith"));
+		ctx.persons.update(F(&person::first_name) == "John", F(&person::second_name) = val("Changed"));
+		ctx.persons.remove(F(&person::first_name) == "Jan");
+		ctx.archive.put(person(0, "Bob", "Smith"));
+		ctx.persons.put(person(0, "", "Nameless"));
+		bool thrown = false;
+		try
+		{
+			ctx.commit();
+		}
+		catch (constraint_violation&)
+		{
+			thrown = true;
+		}
+		assert(thrown);
+		assert(!ctx.committing_);
+		assert(ctx.persons.size() == 3);
+		assert(ctx.persons.filter(F(&person::second_name) == "Changed").empty());
+		assert(ctx.persons.filter(F(&person::first_name) == "Jan").size() == 2);
+		assert(ctx.persons.filter(F(&person::first_name) == "Eve").empty());
+		assert(ctx.archive.size() == 1);
+		assert(ctx.persons.snapshot().size() == 3);
+		
+		/* Set still publishes, and later changes are logged */
+		ctx.persons.put(person(0, "Late", "Smith"));
+		assert(ctx.persons.size() == 4);
+		assert(ctx.persons.snapshot().size() == 4);
+		assert(ctx.persons.all().back().id == 4);
+	}
+	
+	{
+		/* Aborted transaction is not replayed, changes after it are */
+		context ctx;
+		assert(ctx.open(path));
+		assert(ctx.persons.size() == 4);
+		assert(ctx.persons.filter(F(&person::first_name) == "Late").size() == 1);
+		assert(ctx.persons.filter(F(&person::first_name) == "Adam").empty());
+		assert(ctx.persons.filter(F(&person::second_name) == "Changed").empty());
+		assert(ctx.persons.filter(F(&person::first_name) == "Eve").empty());
+		assert(ctx.archive.size() == 1);
+	}
+	return 0;
+}
@@ -0,0 +1,199 @@
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cassert>
+#include <magicunicorns.hpp>
+
+using namespace std;
+
+/**
+ * Person
+ */
+struct person: table
+{
+	field<int> id;
+	field<string> first_name;
+	field<string> second_name;
+	person(const string& first_name = "", const string& second_name = "") :
+		table(this, "person"), id(this, "id"),
+		first_name(this, "first_name", first_name),
+		second_name(this, "second_name", second_name)
+	{
+		this->id.constraint = primary_key;
+		this->second_name.constraint = unique_key;
+		addTrigger(F(&person::id) == 0, F(&person::id) = MAX(F(&person::id)) + val(1));
+	}
+
+	bool operator==(person& other)
+	{
+		return (id == other.id)	&& (first_name == other.first_name) && (second_name == other.second_name);
+	}
+};
+
+/**
+ * Account with text primary key
+ */
+struct account: table
+{
+	field<string> login;
+	field<int> balance;
+	account(const string& login = "", int balance = 0) :
+		table(this, "account"), login(this, "login", login),
+		balance(this, "balance", balance)
+	{
+		this->login.constraint = primary_key;
+	}
+	
+	bool operator==(account& other)
+	{
+		return (login == other.login) && (balance == other.balance);
+	}
+};
+
+struct context: dbcontext
+{
+	dbset<person> persons;
+	dbset<account> accounts;
+	context(): persons(this), accounts(this) {}
+};
+
+/* Run f and tell if it was rejected by constraint */
+template <typename F>
+static bool rejected(F f)
+{
+	try
+	{
+		f();
+	}
+	catch (constraint_violation&)
+	{
+		return true;
+	}
+	return false;
+}
+
+int
+main(int argc, char* argv[])
+{
+	context ctx;
+	ctx.persons.enable_snapshots();
+
+	/* Primary key filled by trigger is checked after it */
+	assert(person().id.schema()->triggered_);
+	assert(!person().second_name.schema()->triggered_);
+	ctx.persons.put(person("John", "Smith"));
+	ctx.persons.put(person("Jan", "Kowalski"));
+	ctx.persons.put(person("Hans", "Schmidt"));
+	assert(ctx.persons.size() == 3);
+
+	assert(rejected([&]() { ctx.persons.put(person("Juan", "Smith")); }));
+	assert(ctx.persons.size() == 3);
+
+	/* Lookup by primary key */
+	assert(ctx.persons.get(2)->second_name == "Kowalski");
+	assert(ctx.persons.get(4) == NULL);
+	{
+		person p("Jan", "Kowalski");
+		p.id = 2;
+		assert(ctx.persons.exists(&p));
+		p.id = 3;
+		assert(!ctx.persons.exists(&p));
+	}
+
+	/* Batch with duplicate changes nothing */
+	{
+		vector<person> batch;
+		batch.push_back(person("Juan", "Garcia"));
+		batch.push_back(person("Jean", "Martin"));
+		batch.push_back(person("Jose", "Garcia"));
+		assert(rejected([&]() { ctx.persons.put_range(std::move(batch)); }));
+		assert(ctx.persons.size() == 3);
+		assert(ctx.persons.get(4) == NULL);
+		assert(ctx.persons.filter(F(&person::second_name) == "Garcia").empty());
+		assert(ctx.persons.snapshot().size() == 3);
+	}
+	
+	/* Primary key written by trigger is checked row by row, and rows
+	 * before duplicate are taken out again */
+	{
+		vector<person> batch;
+		batch.push_back(person("Juan", "Garcia"));
+		batch.push_back(person("Jean", "Martin"));
+		batch.back().id = 4;
+		assert(rejected([&]() { ctx.persons.put_range(std::move(batch)); }));
+		assert(ctx.persons.size() == 3);
+		assert(ctx.persons.get(4) == NULL);
+		assert(ctx.persons.max_of(&person::id) == 3);
+		assert(ctx.persons.snapshot().size() == 3);
+	}
+	
+	{
+		vector<person> batch;
+		batch.push_back(person("Juan", "Garcia"));
+		batch.push_back(person("Jean", "Martin"));
+		ctx.persons.put_range(std::move(batch));
+		assert(ctx.persons.size() == 5);
+		assert(ctx.persons.get(5)->first_name == "Jean");
+		assert(ctx.persons.snapshot().size() == 5);
+	}
+
+	/* Update which repeats value changes nothing */
+	assert(rejected([&]() {
+		ctx.persons.update(F(&person::id) > 3, F(&person::second_name) = val("Doe")); }));
+	assert(rejected([&]() {
+		ctx.persons.update(F(&person::id) == 1, F(&person::second_name) = val("Martin")); }));
+	assert(ctx.persons.filter(F(&person::second_name) == "Doe").empty());
+	assert(ctx.persons.get(1)->second_name == "Smith");
+
+	/* Rows may swap values, and index follows changes */
+	ctx.persons.update(F(&person::id) > 0, F(&person::id) = F(&person::id) + val(10));
+	assert(ctx.persons.get(1) == NULL);
+	assert(ctx.persons.get(11)->second_name == "Smith");
+	ctx.persons.update(F(&person::id) == 11, F(&person::second_name) = val("Doe"));
+	ctx.persons.put(person("John", "Smith"));
+	assert(ctx.persons.get(16)->second_name == "Smith");
+	assert(ctx.persons.size() == 6);
+	
+	/* Aggregate in update sees rows changed before, as without constraint */
+	ctx.persons.update(F(&person::id) > 0, F(&person::id) = MAX(F(&person::id)) + val(1));
+	assert(ctx.persons.max_of(&person::id) == 22);
+	assert(ctx.persons.get(17) != NULL);
+	assert(ctx.persons.get(22) != NULL);
+	assert(ctx.persons.size() == 6);
+	
+	/* Rejected update changes rows back */
+	assert(rejected([&]() { ctx.persons.update(F(&person::id) = val(1)); }));
+	assert(ctx.persons.get(1) == NULL);
+	assert(ctx.persons.get(22)->second_name == "Smith");
+	assert(ctx.persons.max_of(&person::id) == 22);
+	
+	/* Lookup by text primary key */
+	ctx.accounts.put(account("bob", 10));
+	ctx.accounts.put(account("alice", 20));
+	assert(ctx.accounts.get("bob")->balance == 10);
+	assert(ctx.accounts.get(string("alice"))->balance == 20);
+	assert(ctx.accounts.get("eve") == NULL);
+	assert(rejected([&]() { ctx.accounts.put(account("bob", 30)); }));
+	
+	/* Index built after rows are restored skips removed ones */
+	remove("unique.db/snapshot");
+	remove("unique.db/wal");
+	{
+		context saved;
+		saved.persons.persist();
+		assert(saved.open("unique.db"));
+		saved.persons.put(person("John", "Smith"));
+		saved.persons.put(person("Jan", "Kowalski"));
+		saved.persons.remove(F(&person::second_name) == "Smith");
+	}
+	{
+		context restored;
+		restored.persons.persist();
+		assert(restored.open("unique.db"));
+		assert(restored.persons.size() == 1);
+		restored.persons.put(person("Juan", "Smith"));
+		assert(restored.persons.size() == 2);
+		assert(restored.persons.get(1) == NULL);
+	}
+	return 0;
+}
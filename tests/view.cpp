@@ -0,0 +1,100 @@
+#include <iostream>
+#include <string>
+#include <cassert>
+#include <magicunicorns.hpp>
+
+using namespace std;
+
+/**
+ * Person
+ */
+struct person: table
+{
+	field<int> id;
+	field<string> first_name;
+	field<string> second_name;
+	person(int id = 0, const string& first_name = "", const string& second_name = "") :
+		table(this, "person"), id(this, "id", id),
+		first_name(this, "first_name", first_name),
+		second_name(this, "second_name", second_name)
+	{
+	}
+	
+	friend ostream& operator<<(ostream& out, const person& p)
+	{
+		out << "person(" << p.id << ",\"" <<
+			p.first_name << "\", \"" <<
+			p.second_name << "\")";
+		return out;
+	}
+	
+	bool operator==(person& other)
+	{
+		return (id == other.id)	&& (first_name == other.first_name) && (second_name == other.second_name);
+	}
+};
+
+struct context: dbcontext
+{
+	dbset<person> persons;
+	context(): persons(this) {}
+};
+
+int
+main(int argc, char* argv[])
+{
+	context ctx;
+	ctx.persons.put(person(1, "John", "Smith"));
+	ctx.persons.put(person(2, "Jan", "Kowalski"));
+	ctx.persons.put(person(3, "hello", "world"));
+	ctx.persons.put(person(4, "John", "Appleseed"));
+	
+	{
+		/* View yields references to rows in set */
+		int total = 0;
+		for (person& p : ctx.persons.where(F(&person::first_name) == "John"))
+		{
+			assert(&p == &ctx.persons.all()[0] || &p == &ctx.persons.all()[3]);
+			total++;
+		}
+		assert(total == 2);
+		assert(ctx.persons.where(F(&person::id) > 1).count() == 3);
+		assert(ctx.persons.where(F(&person::id) > 4).empty());
+	}
+	
+	{
+		/* Consumer may stop early */
+		auto view = ctx.persons.where(F(&person::id) > 1);
+		auto it = view.begin();
+		assert((*it).id == 2);
+		++it;
+		assert(it->id == 3);
+	}
+	
+	{
+		/* Indexed view */
+		ctx.persons.add_index<hash_index>(&person::first_name);
+		auto view = ctx.persons.where((F(&person::first_name) == "John") & (F(&person::id) > 1));
+		auto it = view.begin();
+		assert(it != view.end());
+		assert(it->second_name == "Appleseed");
+		assert(++it == view.end());
+	}
+	
+	{
+		/* Cursor over all() refers to rows in set */
+		dbset<person>::cursor cur(ctx.persons.all());
+		(*cur).second_name = "Doe";
+		assert(ctx.persons.all().front().second_name == "Doe");
+		
+		/* Cursor over view */
+		int total = 0;
+		for (cursor_impl<query_view<person, gt_impl<field_impl<int, person>, int> > >
+			cur(ctx.persons.where(F(&person::id) > 2)); cur; ++cur)
+		{
+			total++;
+		}
+		assert(total == 2);
+	}
+	return 0;
+}